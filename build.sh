@@ -104,7 +104,13 @@ $CC -o ../bin/factor factor.c
 [ "$UNAME" = OpenBSD ] || $CC -o ../bin/fmtmsg fmtmsg.c
 $CC -o ../bin/fold fold.c
 $CC -o ../bin/getopt getopt.c
-$CC -o ../bin/grep grep.c
+# grep -z wants zlib; where it cannot be linked with, build grep without it
+# (NO_ZLIB), and -z says it is not supported.
+printf '#include <zlib.h>\nint main(void) { return !zlibVersion(); }\n' > ../obj/zlibtest.c
+GREPZ=-DNO_ZLIB
+$CC -o ../obj/zlibtest ../obj/zlibtest.c -lz >/dev/null 2>&1 && GREPZ=-lz
+rm -f ../obj/zlibtest ../obj/zlibtest.c
+$CC -o ../bin/grep grep.c -lpthread $GREPZ
 $CC -o ../bin/head head.c
 $CC -o ../bin/hostid hostid.c
 $CC -o ../bin/id id.c
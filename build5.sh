@@ -70,6 +70,8 @@ $CC -D__SVR4__ -c -o ../../obj/regfree.o regfree.c
 $CC -D__SVR4__ -c -o ../../obj/regsub.o regsub.c
 cd ../../obj
 ar r ../lib/libregex.a regcomp.o regerror.o regexec.o regfree.o regsub.o
+$CC -D__SVR4__ -o retest ../support/libregex/retest.c ../lib/libregex.a
+./retest ../support/libregex/tests
 cd ../src
 cp true.sh ../bin/true
 cp false.sh ../bin/false
@@ -98,7 +100,7 @@ $CC -D__SVR4__ -o ../bin/factor factor.c
 $CC -D__SVR4__ -o ../bin/fmtmsg fmtmsg.c
 $CC -D__SVR4__ -I../support -o ../bin/fold fold.c ../support/getline.c
 $CC -D__SVR4__ -o ../bin/getopt getopt.c
-$CC -D__SVR4__ -I../support -I../support/libregex -o ../bin/grep grep.c ../support/getline.c -L../lib -lregex
+$CC -D__SVR4__ -I../support -I../support/libregex -o ../bin/grep grep.c -L../lib -lregex
 $CC -D__SVR4__ -I../support -o ../bin/head head.c ../support/getline.c
 $CC -D__SVR4__ -I../support -o ../bin/id id.c ../support/getgrouplist.c
 $CC -D__SVR4__ -o ../bin/hostid hostid.c -lucb
@@ -38,7 +38,9 @@
  *   -E - Act as if invoked as "egrep" and use enhanced regex mode.
  *   -F - Act as if invoked as "fgrep" and do not use regexs at all.
  *   -H - Show filenames, even if only one file is specified.  (GNU/BSDism)
+ *   -I - Skip binary files.  (GNU/BSDism)
  *   -R - Recurse into directories, following symbolic links.  (GNUism)
+ *   -a - Treat binary files as text.  (GNU/BSDism)
  *   -b - Display "block number" before each matching (or mismatching) line.
  *        (from V6, kept in AT&T's grep and still supported by SVR5)
  *        NOTE: This does not always display the same "block number" as the
@@ -52,15 +54,47 @@
  *   -h - Do not show filenames, even if more than one file is specified.
  *        (Common, but not part of POSIX)
  *   -i - Ignore case when matching patterns.
+ *   -j - Following argument is a number of files to search at once, each in a
+ *        thread of its own.  The output is the same as without it.
  *   -l - Display only the names of files that contain at least one match
  *        (or with -v, that contain no matches).
+ *   -m - Following argument is the most lines to select in each file; the
+ *        rest of the file is not read.  (GNU/BSDism; also --max-count)
  *   -n - Display line numbers before each matching (or mismatching) line.
- *   -q - Do not display anything.  Only return an exit code.
+ *   -q - Do not display anything.  Only return an exit code.  We stop at
+ *        the first line selected, without looking at any more files.
  *   -r - Recurse into directories; do not follow symbolic links.  (GNUism)
  *   -s - Suppress open or read errors but otherwise act normally.
  *   -v - Reverse match; show mismatching lines instead of matching lines
  *        (or with -l, files with no matches instead of files with matches).
  *   -x - Match only against the whole line, instead of part of it.
+ *   -z - Search gzip-compressed files as they would read uncompressed; files
+ *        that are not compressed are searched as they are.  (Not GNU's -z,
+ *        which is for NUL-terminated lines; this is zgrep's job done
+ *        in-process.)
+ *
+ *   --include=glob     - Only search files whose name matches glob.
+ *   --exclude=glob     - Do not search files whose name matches glob.
+ *   --exclude-dir=glob - With -r or -R, do not go into directories whose
+ *                        name matches glob.
+ *   (All GNUisms; each may be given more than once.)
+ *
+ *   --make-index=file  - Instead of searching, make a trigram index of the
+ *                        files named (and, as with -r, the trees under the
+ *                        directories named) in file.  No pattern is given.
+ *   --index=file       - Use the index in file to pass over files that
+ *                        cannot match, without reading them.
+ *   --debug-regex      - When done, tell stderr what the regex library did
+ *                        for each regex: which matcher ran, how much text
+ *                        each pass went over, and so on.  (Only with the
+ *                        bundled library; elsewhere grep says so and
+ *                        goes on without.)
+ *   --regex-steps=num  - Let the regex library take at most num steps
+ *                        matching back references at any one place in a
+ *                        line; a file where a regex needs more is an error
+ *                        (exit code 2), rather than tying up a CPU
+ *                        indefinitely.  0 (the default) is no limit.
+ *                        (Again only with the bundled library.)
  *
  * (Undocumented: -L is treated as -lv.)
  *
@@ -74,7 +108,8 @@
  *        criteria.
  *   1  - At least one file scanned contained no lines matching the given
  *        criteria.
- *   2  - An error (of any type) occurred.
+ *   2  - An error (of any type) occurred, including a regex running out of
+ *        the steps --regex-steps allows it.
  *
  * The specific priority of exit codes depends on whether -q is specified.
  * 0 takes priority over 1, but with -q specified, it also takes priority over
@@ -95,8 +130,11 @@
  * historic behavior.
  *
  * POSIX specifies that grep can safely assume that all files are text files.
- * The GNU and BSD versions attempt to sanely deal with binary files; this is
- * an extension (and sometimes the detection fails).  We opted not to bother.
+ * Like the GNU and BSD versions, we take a file with a NUL byte in its first
+ * block to be a binary file, and only say whether it matches, rather than
+ * printing "lines" out of it.  -a treats it as text anyway (the POSIX
+ * behavior), and -I skips it as if it did not match.  (The detection is only
+ * a guess, and may be wrong either way.)
  *
  * In several places the code assumes a very braindead compiler (even though
  * on Debian 11, both gcc and clang compile this code with no warnings).  The
@@ -105,11 +143,10 @@
  *
  * Limits:
  *
- *   * Because we cannot know in advance how many times the -e switch will be
- *     used, or how many lines may appear in a file described by the -f
- *     switch, it is possible to overload the check list.  This limit is
- *     configurable at compile time by altering the value of PATTERN_STACK
- *     (default: 128).
+ *   * There is no limit on the number of patterns other than memory.  The
+ *     pattern table grows as needed, and the text of the patterns is kept in
+ *     large blocks: a -f file is read in one go and split up where it lies,
+ *     so loading a million patterns costs little more than reading the file.
  *
  * Other implementation details:
  *
@@ -117,16 +154,56 @@
  *     as egrep or fgrep.  This behavior is officially deprecated, but I see
  *     no reason not to implement it, given how little code it requires and
  *     that it has been for years the preferred method.
- *   * The regex library takes care of the -Eix switches (except in -F mode).
+ *   * With more than one fgrep pattern (and no -x), the patterns are built
+ *     into an Aho-Corasick automaton, so the text is gone over once no matter
+ *     how many patterns there are.
+ *   * With fgrep -x and more than one pattern, the patterns are put in a
+ *     hash set, and each line is looked up in it.
+ *   * A single fgrep pattern is searched for 16 or 32 bytes at a time with
+ *     SSE2 or AVX2 where the compiler and the CPU can do it, by looking for
+ *     its first and last bytes together; otherwise with memchr().
+ *   * Where it can be done without changing their meaning, several regexs
+ *     are joined into one extended regex, so that a block is only searched
+ *     once.  Basic regexs are rewritten as extended ones for this.
+ *   * The regex library takes care of the -Ei switches (except in -F mode).
+ *     -x is checked by the scanning engine once a line is known to match.
  *   * The diagnostic format, which prepends the name by which the command was
  *     invoked to all error and warning conditions, is consistent with my
  *     other Unix-clone utilities.
- *   * Lines are read with getline(), so any limits in line length come from
- *     there.  The maximum should be significantly higher than the original
- *     256 bytes or the SVR4 limit of 1K.
+ *   * Files are not read a line at a time.  Large regular files are mapped
+ *     into memory; everything else is read in blocks of SCAN_BLOCK bytes
+ *     (default: 256K).  The matcher is run over the whole block, and line
+ *     boundaries are only looked for around a hit (or, with -v, around the
+ *     lines between hits).  Line numbers for -n are only counted if -n was
+ *     given.  The only limit on line length is available memory; the block
+ *     buffer grows as needed to hold a line.
+ *   * With -j, the files to be searched (whether named or found by -r) are
+ *     queued up for a pool of worker threads.  Each file's output is held
+ *     back until the files before it have been written, so it comes out in
+ *     the same order as it would without -j.  No more than JOB_QUEUE files
+ *     (default: 256) are queued up at once.  Where there are no POSIX
+ *     threads, -j is accepted but has no effect.
+ *   * Also with -j, a mapped file of at least twice SCAN_CHUNK bytes
+ *     (default: 8M) is split into chunks of about that size at line
+ *     boundaries, and any idle workers help search it.  The chunks are
+ *     written out in order, with their line numbers fixed up.  (Not with
+ *     -m, which wants the first lines of the file and no more.)
+ *   * The index made by --make-index lists, for each trigram (three bytes,
+ *     folded to lower case), the files that have it.  With --index, the
+ *     literals that every match of a pattern must contain are picked out of
+ *     it, and only files that have all their trigrams (for some pattern) are
+ *     read.  A file that is not in the index, or whose size, times (to the
+ *     nanosecond, where the system keeps them) or inode have changed since,
+ *     is searched as usual, so an old index only costs speed.  So is one
+ *     changed in the second the index was made in, as a later change in
+ *     that second need not show in its times.
+ *     Files are known by the name they were found under: the tree has to be
+ *     named the same way for both.  Not with -v or -z, or where a pattern
+ *     has no literal of three bytes or more.  Files that look binary are
+ *     left out of the index, and so are always searched.
  *   * Because the files are read in strict ASCII mode and no attempt is made
  *     to preserve context, it is not possible to implement the BSD/GNU -ABC
- *     extensions, and the -DIUZdz switches do not make sense.
+ *     extensions, and the -DUZd switches do not make sense.
  *   * The BSD/GNU -L switch is implemented by acting like the -lv switch was
  *     specified.  As in the BSD and GNU versions, we simply drop out when one
  *     match is found as a speed optimization.
@@ -138,35 +215,124 @@
 #define _GNU_SOURCE 1
 #endif
 #include <ftw.h>
+#include <sys/types.h>
+#include <sys/mman.h>      /* used by mmap() */
+#include <sys/stat.h>
 
+#include <ctype.h>         /* used by tolower() */
 #include <errno.h>         /* used by xperror() */
+#include <fcntl.h>         /* used by open() */
+#include <fnmatch.h>       /* used by glob_match() */
 #include <regex.h>         /* all the documented functions are used here */
 #include <stdio.h>
 #include <stdlib.h>        /* used by exit() */
 #include <string.h>
+#include <time.h>          /* used by time() */
 #include <unistd.h>        /* used by getopt() */
 
 /*
- * Limit of pattern count, because a table of patterns and regexs is
- * statically allocated.
+ * Worker threads for -j, where there are POSIX threads to be had.  (Not on
+ * the old SVR4 systems, which may or may not have them, and do not link with
+ * them.)  Define NO_THREADS at the cc command line to do without.
+ */
+#if defined(_POSIX_THREADS) && (_POSIX_THREADS+0>0) && \
+    !defined(__SVR4__) && !defined(NO_THREADS)
+#define GREP_THREADS 1
+#include <pthread.h>
+#endif
+
+/*
+ * gzip support for -z, through zlib.  (Again not on the old SVR4 systems.)
+ * Define NO_ZLIB at the cc command line to do without; build.sh does, where
+ * it cannot link a program with -lz.
+ */
+#if !defined(__SVR4__) && !defined(NO_ZLIB)
+#define GREP_ZLIB 1
+#include <zlib.h>
+#endif
+
+/*
+ * The nanoseconds of a file's mtime and ctime, for the index to tell apart
+ * changes made within the same second.  Define NO_STAT_NSEC at the cc command
+ * line where struct stat does not have them.
+ */
+#if defined(NO_STAT_NSEC)
+#define ST_MNSEC(s) 0
+#define ST_CNSEC(s) 0
+#elif defined(__APPLE__)
+#define ST_MNSEC(s) ((s)->st_mtimespec.tv_nsec)
+#define ST_CNSEC(s) ((s)->st_ctimespec.tv_nsec)
+#else
+#define ST_MNSEC(s) ((s)->st_mtim.tv_nsec)
+#define ST_CNSEC(s) ((s)->st_ctim.tv_nsec)
+#endif
+
+/*
+ * Vector literal search, for compilers that can build SSE2 and AVX2 code
+ * without it having to be enabled for the whole program.  Whether the CPU
+ * actually has them is checked at run time.
+ */
+#if defined(__GNUC__) && (__GNUC__>=5) && \
+    (defined(__x86_64__) || defined(__i386__))
+#define VECTOR_MEMMEM 1
+#include <immintrin.h>
+#endif
+
+/*
+ * Size of the blocks that -e patterns are copied into.
+ *
+ * Can be overridden at the cc command line without altering the code.
+ */
+#ifndef PATTERN_BLOCK
+#define PATTERN_BLOCK 4096
+#endif
+int patstack, patalloc;
+
+/*
+ * Size of a block read by the scanning engine, and the smallest regular file
+ * that is worth mapping into memory instead of reading.
  *
  * Can be overridden at the cc command line without altering the code.
  */
-#ifndef PATTERN_STACK
-#define PATTERN_STACK 128
+#ifndef SCAN_BLOCK
+#define SCAN_BLOCK 262144
 #endif
-int patstack;
 
 /* Maximum handles for nftw(3) */
 #ifndef ITERATE_MAX_HANDLES
 #define ITERATE_MAX_HANDLES 5
 #endif
 
+/*
+ * Most files that -j lets be queued up (searched or not) before their output
+ * is written.  This bounds the output held back waiting on a slow file.
+ *
+ * Can be overridden at the cc command line without altering the code.
+ */
+#ifndef JOB_QUEUE
+#define JOB_QUEUE 256
+#endif
+
+/*
+ * Default for --regex-steps: the most steps the regex library may take
+ * matching back references at any one place, where it has reglimit().  0 is
+ * no limit.
+ *
+ * Can be overridden at the cc command line without altering the code.
+ */
+#ifndef REGEX_STEPS
+#define REGEX_STEPS 0
+#endif
+
 /*
  * Flags for switches and whether program was invoked as egrep or fgrep
  * (i.e., to determine how to display usage if there is a syntax error).
  */
                               /********************************************/
+#define  FLAG_Z   0x10000L    /* Look inside gzip files                   */
+#define  FLAG_M    0x8000     /* Stop after maxcount lines                */
+#define  FLAG_A    0x4000     /* Treat binary files as text               */
+#define  FLAG_SKIP 0x2000     /* Skip binary files                        */
 #define  IS_EGREP  0x1000     /* Use extended regex mode                  */
 #define  IS_FGREP  0x0800     /* Do not use regexs at all                 */
 #define  FLAG_R_L  0x0400     /* Recurse (logical mode, -R)               */
@@ -180,13 +346,8 @@ int patstack;
 #define  FLAG_S    0x0004     /* Suppress open/read errors                */
 #define  FLAG_V    0x0002     /* Invert matches                           */
 #define  FLAG_X    0x0001     /* No substring match                       */
-unsigned mode, usagemode;     /********************************************/
-
-/*
- * Catches a very specific error condition where -f is used and no patterns
- * are read.
- */
-int nulpat;
+unsigned long mode, usagemode;/********************************************/
+unsigned long maxcount;       /* for -m */
 
 /*
  * Flags for multifile mode.
@@ -204,251 +365,3148 @@ int nulpat;
 #define  MULFIL_N  0x00       /* "No" (zero for quick comparison)         */
 int mulfil;                   /********************************************/
 
-char *patterntable[PATTERN_STACK];
-regex_t regextable[PATTERN_STACK];
+/*
+ * The patterns, their lengths, and (except with fgrep) the compiled regexs.
+ * There are patstack of each, with room for patalloc.
+ */
+char **patterntable;
+size_t *patternlen;
+regex_t *regextable;
+
+/*
+ * Blocks holding the text of the patterns, chained so they can be freed.
+ * The text follows the header.
+ */
+struct patblock
+{
+ struct patblock *next;
+ size_t size, used;
+};
+struct patblock *patblocks;
+
+/*
+ * Number of regexs actually in use in regextable.  This is 1 when all the
+ * patterns could be combined into one; see combine_regex().
+ */
+int nregex;
+
+/* The combined regex, if there is one, so that -j workers can compile it. */
+char *regexall;
+
+/*
+ * Flags every regex is compiled with besides REG_EXTENDED: REG_NEWLINE,
+ * REG_ICASE for -i, and REG_UTF8 in a UTF-8 locale where the regex library
+ * has it.
+ */
+int reflags;
+
+/* --debug-regex: report the regex library's counters when done. */
+int debugregex;
+
+/* --regex-steps: the step limit for each regex, or 0 for none. */
+unsigned long regexsteps=REGEX_STEPS;
+#ifdef REGSTATS
+struct regstats *regtotals;   /* per regex, summed over the searchers */
+#endif
+
+/* Case folding table for fgrep -i. */
+unsigned char foldtab[256];
+
+/*
+ * Open-addressing hash set of the patterns, used by fgrep -x when there is
+ * more than one pattern: each line then costs one hash and (usually) one
+ * probe, however many patterns there are.  A slot holds the pattern's hash
+ * and its index plus one (0 marks an empty slot).  For -i, the patterns are
+ * already folded and the lines are folded as they are hashed.
+ */
+struct xslot
+{
+ unsigned long hash;
+ int pat;
+};
+struct xslot *xset;
+unsigned long xmask;          /* table size less one (a power of 2) */
+
+/* Literal search used for a single fgrep pattern. */
+char *(*litsearch)(char *, size_t, char *, size_t);
+
+/*
+ * Aho-Corasick automaton used by fgrep when there is more than one pattern,
+ * so that the text is only gone over once however many patterns there are.
+ *
+ * Only bytes that occur in some pattern get their own column in the table;
+ * all others share column 0 (for -i, folded bytes share a column with their
+ * other case).  Transitions hold the offset of the target row rather than
+ * the state number, with ACFINAL set if a pattern ends there.
+ */
+#define ACFINAL 0x80000000UL
+unsigned long *actrans;       /* [states*acncls] */
+unsigned char accls[256];     /* byte -> column */
+unsigned acncls;              /* columns per row */
+
+/*
+ * State of the scanning engine for one file.
+ *
+ * buf[pos] up to buf[lim] holds whole lines that have yet to be scanned;
+ * buf[lim] up to buf[len] is the start of a line that has not been read in
+ * full yet.  If the file is mapped, all of it is one block.
+ */
+struct scan
+{
+ struct searcher *w;      /* who is doing the scanning */
+ int fd;
+ int mapped;              /* buf is an mmap() of the whole file */
+ int eof;                 /* nothing more to read */
+ char *buf;
+ size_t bufsiz, len, pos, lim;
+ off_t base;              /* file offset of buf[0] (for -b) */
+ unsigned long lineno;    /* lines before lnp (for -n) */
+ char *lnp;               /* newlines counted up to here (for -n) */
+ unsigned long count;     /* lines selected */
+ int chunk;               /* line numbers are to be fixed up later */
+ int binary;              /* the first block has a NUL byte in it */
+ int reerr;               /* regexec() error that stopped the search, or 0 */
+
+ /*
+  * For -z.  If the file is gzipped, what is read is inflated first (from
+  * zmap, if the file was mapped).  If it is not, the block read to find out
+  * is handed over first from pend.
+  */
+ int gz;
+ int zend;                /* at the end of a gzip member */
+ char *zmap;
+ size_t zmaplen;
+ char *pend;
+ size_t npend;
+};
+
+/*
+ * Output held back to be written out later (see out_write()).
+ *
+ * For a chunk of a file, the line numbers for -n are not known yet, only the
+ * line numbers within the chunk; so they are left out, and noted in fix as
+ * pairs of where they go in buf and the line number within the chunk.
+ */
+struct outbuf
+{
+ char *buf, *err;
+ size_t len, siz;
+ unsigned long *fix;
+ size_t nfix, fixsiz;
+};
+
+/*
+ * A file queued up by -j.  A worker searches it, with its output (and any
+ * error message) held here, and it is written out in turn once every file
+ * queued before it has been.
+ */
+struct job
+{
+ struct job *next;
+ char *name;
+ int *cumul;              /* where the exit code goes; 0 for tally() */
+ int done, r;
+ struct outbuf o;
+};
+
+/*
+ * A large mapped file split up into chunks at line boundaries, to be
+ * searched by several -j workers at once.  Chunks are handed out in order,
+ * claim being the first one nobody has taken yet.
+ */
+struct chunk
+{
+ size_t pos, lim;         /* offsets of the chunk in the file */
+ unsigned long count;     /* lines selected */
+ unsigned long nl;        /* lines in the chunk (for -n) */
+ int done;
+ int reerr;               /* as in struct scan */
+ struct outbuf o;
+};
+struct chunkset
+{
+ struct chunkset *next;
+ char *buf, *name;
+ struct chunk *c;
+ int n, claim, binary;
+};
+
+/*
+ * Everything one thread needs to search a file with.  There is one of these
+ * for the main thread, and one for each -j worker.
+ */
+struct searcher
+{
+ char *buf;               /* block buffer, kept between files */
+ size_t bufsiz;
+ regex_t *regextable;     /* the regexs (a private copy in a worker) */
+#ifdef REGSCRATCH
+ struct re_scratch **scratch; /* regex library storage, per regex, or 0 */
+#endif
+
+ /*
+  * First line at or after the current scan position matched by each pattern
+  * (the end of the block if there is none), or 0 if not yet known.  This
+  * lets several patterns share a block without each one rescanning it on
+  * every hit.  Reset whenever the block changes.
+  */
+ char **hitcache;
+
+ struct outbuf *out;      /* output goes here, or straight to stdout if 0 */
+
+#ifdef GREP_ZLIB
+ z_stream zs;             /* for -z (reset between files) */
+ int zinit;               /* zs has been set up */
+ char *zbuf;              /* compressed data read in */
+#endif
+};
+struct searcher mainsearcher;
+
+#ifdef GREP_THREADS
+/*
+ * The -j queue.  Files are queued at jobtail and written out from jobhead;
+ * jobnext is the first one no worker has taken yet.
+ */
+static pthread_mutex_t joblock=PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t jobready=PTHREAD_COND_INITIALIZER;
+static pthread_cond_t jobdone=PTHREAD_COND_INITIALIZER;
+static struct job *jobhead, *jobnext, *jobtail;
+static struct chunkset *chunksets;  /* files with chunks still to hand out */
+static int njobs, jobquit;
+static pthread_t *workers;
+static struct searcher *wsearch;
+static int nworkers;
+#endif
+
+/*
+ * Size of the chunks a file is split into for -j.  Only files of at least
+ * twice this size are split up.
+ *
+ * Can be overridden at the cc command line without altering the code.
+ */
+#ifndef SCAN_CHUNK
+#define SCAN_CHUNK 8388608
+#endif
+
+/* Exit code so far, over all the files. */
+static int grep_status;
 
 static char *copyright="@(#) (C) Copyright 2022, 2023 S. V. Nickolas\n";
 
 static char *progname;
 
 static int grep_iterative_cumul;
-static int go_fish;
+static int go_fish, none_searched;
+
+/*
+ * Filename globs for --include, --exclude and --exclude-dir.
+ *
+ * Each glob is looked at once, when it is added: most are a plain name, or a
+ * name with a * at one end (as in "*.o" or "build*"), and those are matched
+ * with a simple comparison.  Only the rest are handed to fnmatch().
+ */
+#define  GLOB_EXACT   0       /* no wildcards */
+#define  GLOB_SUFFIX  1       /* "*" then no wildcards */
+#define  GLOB_PREFIX  2       /* no wildcards then "*" */
+#define  GLOB_FNMATCH 3       /* anything else */
+struct glob
+{
+ char *pat;
+ size_t len;              /* length of pat, less the * */
+ int kind;
+};
+struct globlist
+{
+ struct glob *g;
+ int n, alloc;
+};
+static struct globlist incglobs, excglobs, dirglobs;
+static size_t iterate_root;   /* length of the -r operand being walked */
+
+/*
+ * The trigram index for --make-index and --index (see idx_write() for what
+ * is in it).
+ *
+ * While it is being made, the trigrams are kept in an open-addressing hash
+ * table, each with its list of files so far, already in the form it is
+ * written out in.
+ */
+#define IDX_MAGIC   0x49505247UL  /* "GRPI" */
+#define IDX_VERSION 2
+#define IDX_HEAD    76            /* bytes in the header */
+#define IDX_FILE    52            /* bytes in a file table entry */
+#define IDX_TRI     16            /* bytes in a trigram table entry */
+struct idxtri
+{
+ unsigned long tri;
+ unsigned long count;     /* files it is in (0 for an empty slot) */
+ unsigned long last;      /* last file added, plus one */
+ unsigned char *post;
+ size_t len, siz;
+};
+struct idxfile
+{
+ char *name;
+ unsigned long size, mtime, mnsec, ctime, cnsec, ino;
+};
+static char *makeindex, *useindex;
+static struct idxtri *ixtab;
+static unsigned long ixmask, ixused;
+static struct idxfile *ixfiles;
+static unsigned long nixfiles, ixfilealloc;
+static char *ixbuf;
+static int ixstatus;
+static time_t ixstart;    /* when --make-index began */
+
+/*
+ * The index being used: its mapping, and the files in it that might match
+ * (one bit each), or 0 if it is not being used.  ixq holds the trigrams of
+ * the branch of a pattern being looked at, and ixrun the literal being
+ * picked out of it.
+ */
+static unsigned char *ixmap, *ixcand, *ixall, *ixtmp;
+static size_t ixmaplen;
+static unsigned long ixn, ixntri, ixnslot;
+static unsigned char *ixftab, *ixhash, *ixttab;
+static unsigned long *ixq;
+static int nixq;
+static char *ixrun;
+static size_t nixrun;
+
+/* Fold ASCII (and only ASCII) to lower case, as the index does. */
+#define IDX_FOLD(c) ((((c)>='A')&&((c)<='Z'))?((c)+'a'-'A'):(c))
+
+/*
+ * Bounded equivalent of strstr(3); neither string needs to be terminated.
+ *
+ * Look for the first byte with memchr(), which the C library usually has
+ * well optimized, and only then compare the rest.
+ */
+char *int_memmem (char *str, size_t l, char *what, size_t wl)
+{
+ char *p, *e;
+
+ if (!wl) return str;
+ if (l<wl) return 0;
+
+ e=str+(l-wl)+1;
+ for (p=str; p<e; p++)
+ {
+  p=memchr(p, *what, e-p);
+  if (!p) return 0;
+  if (!memcmp(p+1, what+1, wl-1)) return p;
+ }
+
+ return 0;
+}
+
+/*
+ * Compare a line against a pattern that has been passed through foldtab,
+ * without case sensitivity.  The lengths are known to be the same.
+ */
+int int_memcaseeq (char *str, char *what, size_t l)
+{
+ size_t i;
+
+ for (i=0; i<l; i++)
+  if (foldtab[(unsigned char)str[i]]!=(unsigned char)what[i]) return 0;
+
+ return 1;
+}
+
+/*
+ * Case-insensitive version of the above, for fgrep -i.  The pattern has
+ * already been passed through foldtab.
+ *
+ * Only positions where both the first and the last byte fit are compared in
+ * full, which weeds out most of them without a loop over the pattern.
+ */
+char *int_memcasemem (char *str, size_t l, char *what, size_t wl)
+{
+ size_t i;
+ unsigned char f, z;
+
+ if (!wl) return str;
+ if (l<wl) return 0;
+
+ f=(unsigned char)what[0];
+ z=(unsigned char)what[wl-1];
+ for (i=0; i+wl<=l; i++)
+  if ((foldtab[(unsigned char)str[i]]==f)&&
+      (foldtab[(unsigned char)str[i+wl-1]]==z)&&
+      int_memcaseeq(str+i+1, what+1, wl-1))
+   return str+i;
+
+ return 0;
+}
+
+#ifdef VECTOR_MEMMEM
+/*
+ * The same search 16 (SSE2) or 32 (AVX2) positions at a time.
+ *
+ * Each block of text is compared against the first byte of the pattern, and
+ * the block wl-1 bytes further on against the last byte; only where both
+ * agree is the rest compared.  For -i each is compared against both cases,
+ * and in the exact case the second compare is simply the same as the first.
+ * Whatever is left at the end, too short for a whole block, is left to the
+ * plain versions.
+ */
+__attribute__((target("sse2")))
+static char *sse2_memmem (char *str, size_t l, char *what, size_t wl)
+{
+ __m128i f1, f2, z1, z2, a, b;
+ unsigned m;
+ size_t i;
+ int fold;
+
+ if (!wl) return str;
+
+ fold=mode&FLAG_I;
+ f1=_mm_set1_epi8(what[0]);
+ f2=_mm_set1_epi8(fold?toupper((unsigned char)what[0]):what[0]);
+ z1=_mm_set1_epi8(what[wl-1]);
+ z2=_mm_set1_epi8(fold?toupper((unsigned char)what[wl-1]):what[wl-1]);
+
+ for (i=0; i+wl+15<=l; i+=16)
+ {
+  a=_mm_loadu_si128((__m128i *)(str+i));
+  b=_mm_loadu_si128((__m128i *)(str+i+wl-1));
+  a=_mm_or_si128(_mm_cmpeq_epi8(a, f1), _mm_cmpeq_epi8(a, f2));
+  b=_mm_or_si128(_mm_cmpeq_epi8(b, z1), _mm_cmpeq_epi8(b, z2));
+  m=(unsigned)_mm_movemask_epi8(_mm_and_si128(a, b));
+  while (m)
+  {
+   char *p;
+
+   p=str+i+__builtin_ctz(m);
+   if (fold?int_memcaseeq(p+1, what+1, wl-1):!memcmp(p+1, what+1, wl-1))
+    return p;
+   m&=m-1;
+  }
+ }
+
+ return (fold?int_memcasemem:int_memmem)(str+i, l-i, what, wl);
+}
+
+__attribute__((target("avx2")))
+static char *avx2_memmem (char *str, size_t l, char *what, size_t wl)
+{
+ __m256i f1, f2, z1, z2, a, b;
+ unsigned m;
+ size_t i;
+ int fold;
+
+ if (!wl) return str;
+
+ fold=mode&FLAG_I;
+ f1=_mm256_set1_epi8(what[0]);
+ f2=_mm256_set1_epi8(fold?toupper((unsigned char)what[0]):what[0]);
+ z1=_mm256_set1_epi8(what[wl-1]);
+ z2=_mm256_set1_epi8(fold?toupper((unsigned char)what[wl-1]):what[wl-1]);
+
+ for (i=0; i+wl+31<=l; i+=32)
+ {
+  a=_mm256_loadu_si256((__m256i *)(str+i));
+  b=_mm256_loadu_si256((__m256i *)(str+i+wl-1));
+  a=_mm256_or_si256(_mm256_cmpeq_epi8(a, f1), _mm256_cmpeq_epi8(a, f2));
+  b=_mm256_or_si256(_mm256_cmpeq_epi8(b, z1), _mm256_cmpeq_epi8(b, z2));
+  m=(unsigned)_mm256_movemask_epi8(_mm256_and_si256(a, b));
+  while (m)
+  {
+   char *p;
+
+   p=str+i+__builtin_ctz(m);
+   if (fold?int_memcaseeq(p+1, what+1, wl-1):!memcmp(p+1, what+1, wl-1))
+    return p;
+   m&=m-1;
+  }
+ }
+
+ return sse2_memmem(str+i, l-i, what, wl);
+}
+#endif
+
+/*
+ * Pick the literal search for a lone fgrep pattern: the best the CPU can do,
+ * otherwise the plain version for the case (in)sensitivity in force.
+ */
+char *(*pick_memmem (void))(char *, size_t, char *, size_t)
+{
+#ifdef VECTOR_MEMMEM
+ __builtin_cpu_init();
+ if (__builtin_cpu_supports("avx2")) return avx2_memmem;
+ if (__builtin_cpu_supports("sse2")) return sse2_memmem;
+#endif
+ return (mode&FLAG_I)?int_memcasemem:int_memmem;
+}
+
+/*
+ * Modified version of perror(3) that shows the program name
+ * (as uso believes a *x app should do with all diagnostics).
+ */
+void xperror (char *filename)
+{
+ fprintf (stderr, "%s: %s: %s\n", progname, filename, strerror(errno));
+}
+
+/* Method of dying screaming when the Grim Memory Reaper comes to call. */
+void scram (void)
+{
+ fprintf (stderr, "%s: out of memory\n", progname);
+ exit(2);
+}
+
+/*
+ * FNV-1a hash of a line, folded for -i.  (Patterns are folded beforehand,
+ * so folding them again here does no harm.)
+ */
+static unsigned long xhash (char *p, size_t l)
+{
+ unsigned long h;
+ size_t i;
+
+ h=2166136261UL;
+ if (mode&FLAG_I)
+  for (i=0; i<l; i++) h=(h^foldtab[(unsigned char)p[i]])*16777619UL;
+ else
+  for (i=0; i<l; i++) h=(h^(unsigned char)p[i])*16777619UL;
+ return h&0xFFFFFFFFUL;
+}
+
+/* Is this line in the set?  Return the pattern index, or -1. */
+static int xlookup (char *p, size_t l)
+{
+ unsigned long h, i;
+ int t;
+
+ h=xhash(p, l);
+ for (i=h&xmask; xset[i].pat; i=(i+1)&xmask)
+ {
+  if (xset[i].hash!=h) continue;
+  t=xset[i].pat-1;
+  if (patternlen[t]!=l) continue;
+  if ((mode&FLAG_I)?int_memcaseeq(p, patterntable[t], l)
+                   :!memcmp(p, patterntable[t], l))
+   return t;
+ }
+ return -1;
+}
+
+/*
+ * Build the hash set for fgrep -x, at most half full.  Duplicate patterns
+ * are only entered once.
+ */
+void xset_build (void)
+{
+ unsigned long h, i, n;
+ int t;
+
+ for (n=2; n<2*(unsigned long)patstack; n<<=1);
+ xmask=n-1;
+ xset=calloc(n, sizeof(struct xslot));
+ if (!xset) scram();
+
+ for (t=0; t<patstack; t++)
+ {
+  if (xlookup(patterntable[t], patternlen[t])>=0) continue;
+  h=xhash(patterntable[t], patternlen[t]);
+  for (i=h&xmask; xset[i].pat; i=(i+1)&xmask);
+  xset[i].hash=h;
+  xset[i].pat=t+1;
+ }
+}
 
 /*
- * On SVR4, these are not part of the base libc (they're in libucb, which is
- * known to have issues, and in some versions is infamously coderotted).
- * Instead, provide our own.  (The code for regex comes from 4.4BSD and is
- * built and linked separately.)
+ * Rewrite a basic regex as an extended one, so that it can be joined to the
+ * others with |.  Return the new string, or 0 if it cannot be done safely:
+ * back-references would be renumbered, and escapes other than the ones POSIX
+ * gives a meaning to (\+, \?, \| and the like are GNU extensions to BREs)
+ * might not mean the same thing in an ERE.
+ *
+ * Per POSIX, ^ is an anchor only at the start of the regex or of a \(
+ * subexpression, $ only at the end of either, and * is an ordinary character
+ * where there is nothing before it to repeat.  Brackets are the same in both
+ * and are copied as they are.
  */
-#ifdef __SVR4__
-#include <ctype.h>
-#define strcasecmp  int_strcasecmp
-#define strncasecmp int_strncasecmp
+char *bre_to_ere (char *re)
+{
+ char *out, *o;
+ int first;
+
+ out=o=malloc(2*strlen(re)+1);
+ if (!out) scram();
+
+ first=1;
+ if (*re=='^') *o++=*re++;
+ while (*re)
+ {
+  switch (*re)
+  {
+   case '\\':
+    re++;
+    switch (*re)
+    {
+     case '(':
+      *o++='(';
+      re++;
+      first=1;
+      if (*re=='^') *o++=*re++;
+      continue;
+     case ')':
+      *o++=')';
+      break;
+     case '{':
+      *o++='{';
+      while (*++re && (*re!='\\')) *o++=*re;
+      if ((*re!='\\')||(re[1]!='}')) goto nope;
+      *o++='}';
+      re++;
+      break;
+     case '.': case '[': case ']': case '*': case '^': case '$': case '\\':
+      *o++='\\';
+      *o++=*re;
+      break;
+     default:
+      goto nope;
+    }
+    re++;
+    first=0;
+    continue;
+   case '[':
+    *o++=*re++;
+    if (*re=='^') *o++=*re++;
+    if (*re==']') *o++=*re++;
+    while (*re!=']')
+    {
+     if (!*re) goto nope;
+     if ((*re=='[')&&((re[1]==':')||(re[1]=='.')||(re[1]=='=')))
+     {
+      char d;
+
+      d=re[1];
+      *o++=*re++;
+      *o++=*re++;
+      while (!((*re==d)&&(re[1]==']')))
+      {
+       if (!*re) goto nope;
+       *o++=*re++;
+      }
+      *o++=*re++;
+     }
+     *o++=*re++;
+    }
+    *o++=*re++;
+    first=0;
+    continue;
+   case '*':
+    if (first) *o++='\\';
+    *o++=*re++;
+    first=0;
+    continue;
+   case '$':
+    if ((re[1])&&!((re[1]=='\\')&&(re[2]==')'))) *o++='\\';
+    *o++=*re++;
+    first=0;
+    continue;
+   case '^': case '+': case '?': case '(': case ')': case '{': case '}':
+   case '|':
+    *o++='\\';
+    /* FALLTHROUGH */
+   default:
+    *o++=*re++;
+    first=0;
+  }
+ }
+ *o=0;
+ return out;
+
+nope:
+ free(out);
+ return 0;
+}
 
-static int int_strcasecmp (const char *a, const char *b)
+#ifdef REG_UTF8
+/*
+ * Whether the locale's character set is UTF-8, going by the environment the
+ * way setlocale() would: LC_ALL, then LC_CTYPE, then LANG, the first that is
+ * set and not empty.  Nothing else is done with the locale.
+ */
+static int utf8_locale (void)
 {
- char *aa, *bb;
+ static const char *const vars[]={"LC_ALL", "LC_CTYPE", "LANG"};
+ const char *v, *u;
+ int t;
+
+ for (v=0, t=0; t<3; t++)
+ {
+  v=getenv(vars[t]);
+  if (v&&*v) break;
+ }
+ if (t==3) return 0;
+ v=strchr(v, '.');
+ if (!v) return 0;
+
+ /* "UTF-8", "utf8" and so on, perhaps followed by "@modifier" */
+ for (v++, u="utf8"; *u; v++)
+ {
+  if (*v=='-') continue;
+  if (tolower((unsigned char)*v)!=*u++) return 0;
+ }
+ return (!*v)||(*v=='@');
+}
+#endif
+
+/*
+ * Try to replace all the regexs with one that is their alternation, so that
+ * each block is only searched once, and the search stops at the first line
+ * that any of them matches.  If this cannot be done (back-references, an
+ * empty pattern, or the result will not compile), everything stays as it is
+ * and the regexs are searched side by side.
+ */
+void combine_regex (void)
+{
+ char *all, *o, *x;
+ size_t l;
+ int t;
+ regex_t re;
+
+ l=1;
+ for (t=0; t<nregex; t++)
+ {
+  if (!*patterntable[t]) return;
+  l+=2*strlen(patterntable[t])+1;
+ }
+ all=o=malloc(l);
+ if (!all) scram();
+
+ for (t=0; t<nregex; t++)
+ {
+  if (mode&IS_EGREP)
+  {
+   for (x=patterntable[t]; *x; x++)
+    if ((*x=='\\')&&(x[1]>='1')&&(x[1]<='9')) break;
+   if (*x) break;
+   x=patterntable[t];
+  }
+  else
+  {
+   x=bre_to_ere(patterntable[t]);
+   if (!x) break;
+  }
+  if (t) *o++='|';
+  strcpy(o, x);
+  o+=strlen(o);
+  if (x!=patterntable[t]) free(x);
+ }
+
+ if ((t==nregex)&&
+     (!regcomp(&re, all, REG_EXTENDED|reflags)))
+ {
+  while (nregex) regfree(&regextable[--nregex]);
+  regextable[0]=re;
+  nregex=1;
+  regexall=all;
+ }
+ else
+  free(all);
+}
+
+/*
+ * Build the Aho-Corasick automaton from the fgrep patterns (already folded
+ * for -i).  The trie is built first, then the failure links are followed
+ * breadth-first to fill in every missing transition, leaving a complete DFA.
+ */
+void ac_build (void)
+{
+ unsigned long nstates, total, o, f, *queue, *fail, head, tail;
+ unsigned char *final;
+ int t, c;
+ size_t e;
+
+ /* Give every byte that appears in a pattern a column of its own. */
+ acncls=1;
+ for (t=0; t<patstack; t++)
+  for (e=0; e<patternlen[t]; e++)
+  {
+   c=(unsigned char)patterntable[t][e];
+   if (!accls[c]) accls[c]=acncls++;
+  }
+ if (mode&FLAG_I)
+  for (c=0; c<256; c++) accls[c]=accls[foldtab[c]];
+
+ total=1;
+ for (t=0; t<patstack; t++) total+=patternlen[t];
+
+ actrans=calloc(total*acncls, sizeof(unsigned long));
+ final=calloc(total, 1);
+ fail=malloc(total*sizeof(unsigned long));
+ queue=malloc(total*sizeof(unsigned long));
+ if ((!actrans)||(!final)||(!fail)||(!queue)) scram();
+
+ /* The trie.  Nothing in a trie goes back to the root, so 0 is "none". */
+ nstates=1;
+ for (t=0; t<patstack; t++)
+ {
+  o=0;
+  for (e=0; e<patternlen[t]; e++)
+  {
+   c=accls[(unsigned char)patterntable[t][e]];
+   if (!actrans[o+c]) actrans[o+c]=(nstates++)*acncls;
+   o=actrans[o+c];
+  }
+  final[o/acncls]=1;
+ }
+
+ /*
+  * Breadth-first over the trie, so that the failure state of anything taken
+  * off the queue is already complete.  queue[] holds row offsets.
+  */
+ head=tail=0;
+ for (c=0; c<(int)acncls; c++)
+  if (actrans[c])
+  {
+   fail[actrans[c]/acncls]=0;
+   queue[tail++]=actrans[c];
+  }
+ while (head<tail)
+ {
+  o=queue[head++];
+  f=fail[o/acncls];
+  if (final[f/acncls]) final[o/acncls]=1;
+  for (c=0; c<(int)acncls; c++)
+  {
+   if (actrans[o+c])
+   {
+    fail[actrans[o+c]/acncls]=actrans[f+c];
+    queue[tail++]=actrans[o+c];
+   }
+   else
+    actrans[o+c]=actrans[f+c];
+  }
+ }
+
+ /* Mark transitions into final states, now that those are all known. */
+ for (o=0; o<nstates*acncls; o++)
+  if (final[actrans[o]/acncls]) actrans[o]|=ACFINAL;
+
+ free(queue);
+ free(fail);
+ free(final);
+}
+
+/* Set aside l bytes of pattern text. */
+char *pat_alloc (size_t l)
+{
+ struct patblock *b;
+ size_t z;
+
+ b=patblocks;
+ if ((!b)||(b->size-b->used<l))
+ {
+  z=(l>PATTERN_BLOCK)?l:PATTERN_BLOCK;
+  b=malloc(sizeof(struct patblock)+z);
+  if (!b) scram();
+  b->size=z;
+  b->used=0;
+  b->next=patblocks;
+  patblocks=b;
+ }
+ b->used+=l;
+ return ((char *)(b+1))+(b->used-l);
+}
+
+/* Add a pattern (which must be NUL terminated) to the table. */
+void pat_add (char *p, size_t l)
+{
+ if (patstack==patalloc)
+ {
+  patalloc=patalloc?(patalloc<<1):16;
+  patterntable=realloc(patterntable, patalloc*sizeof(char *));
+  patternlen=realloc(patternlen, patalloc*sizeof(size_t));
+  if ((!patterntable)||(!patternlen)) scram();
+ }
+ patterntable[patstack]=p;
+ patternlen[patstack]=l;
+ patstack++;
+}
+
+/*
+ * Read a pattern file whole into a block of its own, and make each line of
+ * it a pattern in place.  Return 0 on success, 1 if the file could not be
+ * read, or 2 if it was empty.
+ */
+int pat_file (char *filename)
+{
+ struct patblock *b, *n;
+ char *p, *q, *e;
+ size_t z;
+ ssize_t r;
+ int fd;
+
+ fd=open(filename, O_RDONLY);
+ if (fd<0) return 1;
+
+ z=PATTERN_BLOCK;
+ b=malloc(sizeof(struct patblock)+z+1);
+ if (!b) scram();
+ b->used=0;
+ while (1)
+ {
+  if (b->used==z)
+  {
+   z<<=1;
+   n=realloc(b, sizeof(struct patblock)+z+1);
+   if (!n) scram();
+   b=n;
+  }
+  r=read(fd, ((char *)(b+1))+b->used, z-b->used);
+  if (r<0)
+  {
+   if (errno==EINTR) continue;
+   free(b);
+   close(fd);
+   return 1;
+  }
+  if (!r) break;
+  b->used+=r;
+ }
+ close(fd);
+
+ b->size=z+1;
+ b->next=patblocks;
+ patblocks=b;
+
+ /*
+  * Also sprach Posix:
+  *   "A null pattern can be specified by an empty line in pattern_file"
+  * 
+  * Also sprach Posix:
+  *   "the pattern_file's contents shall consist of one or more patterns
+  *    terminated by a <newline> character"
+  * 
+  * NetBSD says "the behaviour of the -f flag when using an empty pattern
+  * file is left undefined", but the standard does say "one or more", and
+  * zero isn't "one or more", so I would argue that zero lines in the
+  * pattern file is an error condition.
+  */
+ if (!b->used) return 2;
+
+ /* Split it into lines, the last of which might not have a newline. */
+ p=(char *)(b+1);
+ e=p+b->used;
+ *e=0;
+ while (p<e)
+ {
+  q=memchr(p, '\n', e-p);
+  if (!q) q=e;
+  *q=0;
+  pat_add(p, q-p);
+  p=q+1;
+ }
+ return 0;
+}
+
+/* Start of the line that contains p, not looking back past lo. */
+static char *line_start (char *lo, char *p)
+{
+ while ((p>lo)&&(p[-1]!='\n')) p--;
+ return p;
+}
+
+/* End of the line that starts at p (its newline, or the end of the block). */
+static char *line_end (char *p, char *end)
+{
+ char *q;
+
+ q=memchr(p, '\n', end-p);
+ return q?q:end;
+}
+
+#ifdef REGSTATS
+/* Add what a scratch context counted to a regex's totals. */
+static void stats_add (struct regstats *to, struct re_scratch *sc)
+{
+ struct regstats st;
+
+ if (regstats(sc, &st)) return;
+ to->simple+=st.simple;
+ to->small+=st.small;
+ to->large+=st.large;
+ to->mustrejects+=st.mustrejects;
+ to->fastbytes+=st.fastbytes;
+ to->faststeps+=st.faststeps;
+ to->slowcalls+=st.slowcalls;
+ to->slowbytes+=st.slowbytes;
+ to->startretries+=st.startretries;
+ to->falsealarms+=st.falsealarms;
+ to->backrefsteps+=st.backrefsteps;
+ if (st.backrefdepth>to->backrefdepth) to->backrefdepth=st.backrefdepth;
+ to->buflines+=st.buflines;
+}
+
+/* --debug-regex: tell stderr what the regex library did for each regex. */
+static void stats_report (void)
+{
+ struct regstats *st;
+ int t;
+
+ fflush(stdout);
+ for (t=0; t<nregex; t++)
+ {
+  st=&regtotals[t];
+  fprintf (stderr, "%s: regex %d: %s\n", progname, t+1,
+           regexall?regexall:patterntable[t]);
+  fprintf (stderr, "  searches: %lu simple, %lu small, %lu large; "
+                   "%lu turned away by the musts\n",
+           st->simple, st->small, st->large, st->mustrejects);
+  fprintf (stderr, "  lines handed on by regexec_buf(): %lu\n", st->buflines);
+  fprintf (stderr, "  fast(): %lu bytes, %lu stepped without the DFA\n",
+           st->fastbytes, st->faststeps);
+  fprintf (stderr, "  slow(): %lu calls, %lu bytes; %lu start retries\n",
+           st->slowcalls, st->slowbytes, st->startretries);
+  fprintf (stderr, "  backref(): %lu steps, depth %lu; %lu false alarms\n",
+           st->backrefsteps, st->backrefdepth, st->falsealarms);
+ }
+}
+#endif
+
+#ifdef REGSCRATCH
+/*
+ * A searcher's scratch space for each regex.  Each is made the first time
+ * its regex is searched with; if there is no memory for one, the library
+ * just allocates as it goes, as it would without.
+ */
+static void scratch_init (struct searcher *w)
+{
+ int t;
+
+ w->scratch=malloc(patstack*sizeof(struct re_scratch *));
+ if (!w->scratch) scram();
+ for (t=0; t<patstack; t++) w->scratch[t]=0;
+}
+
+/*
+ * Free a searcher's scratch space, before the regexs are freed.  For
+ * --debug-regex, what it counted is added to the totals first.
+ */
+static void scratch_free (struct searcher *w)
+{
+ int t;
+
+ for (t=0; t<patstack; t++)
+ {
+#ifdef REGSTATS
+  if (regtotals&&w->scratch[t]) stats_add(&regtotals[t], w->scratch[t]);
+#endif
+  regscratchfree(w->scratch[t]);
+ }
+ free(w->scratch);
+ w->scratch=0;
+}
+#endif
+
+/* Count the newlines from p up to end. */
+static unsigned long count_nl (char *p, char *end)
+{
+ unsigned long n;
+
+ n=0;
+ while ((p<end)&&(p=memchr(p, '\n', end-p)))
+ {
+  n++;
+  p++;
+ }
+ return n;
+}
+
+/*
+ * Run regex t over m->rm_so to m->rm_eo from p, leaving the match in *m.
+ * Return nonzero if there is none; if the regex library gave up, say why in
+ * s->reerr.
+ */
+static int run_regex (struct scan *s, int t, char *p, regmatch_t *m)
+{
+ int e;
+
+#ifdef REGSCRATCH
+ e=regexec_r(&s->w->regextable[t], p, 1, m, REG_STARTEND, s->w->scratch[t]);
+#else
+ e=regexec(&s->w->regextable[t], p, 1, m, REG_STARTEND);
+#endif
+ if (e&&(e!=REG_NOMATCH)) s->reerr=e;
+ return e;
+}
+
+/*
+ * Find the first line from p up to end that matches pattern t.  Return the
+ * start of the line, or end if no line matches.
+ */
+static char *find_hit (struct scan *s, int t, char *p, char *end)
+{
+ char *q, *le;
+ regmatch_t m;
+#ifdef REGEXEC_BUF
+ int e;
+#endif
+
+ if (mode&IS_FGREP)
+ {
+  if (litsearch)
+   q=litsearch(p, end-p, patterntable[t], patternlen[t]);
+  else
+   q=((mode&FLAG_I)?int_memcasemem:int_memmem)(p, end-p, patterntable[t],
+                                               patternlen[t]);
+  return q?line_start(p, q):end;
+ }
+
+ /*
+  * A whole block is handed over at once.  The regexs are compiled with
+  * REG_NEWLINE, so . never matches a newline and ^ and $ work at each line;
+  * but a bracket expression such as [[:space:]] or [^a] still does match
+  * one, so a match can run on from one line into the next.  Such a match
+  * says nothing about either line, so its first line is tried again alone.
+  * Leave off the final newline, or "^$" would find an empty line after it.
+  *
+  * -x is checked after the fact: a whole-line match starts at the start of
+  * the line, so it is the leftmost, and it is the longest; so if one exists,
+  * that is what regexec() finds on that line.
+  *
+  * The bundled regex library can find the line itself (keeping to one line,
+  * as above), and go straight to the lines that have a string any match
+  * must contain.  It can also keep its working storage from one call to the
+  * next.
+  */
+#ifdef REGSCRATCH
+ if (!s->w->scratch[t]) s->w->scratch[t]=regscratch(&s->w->regextable[t]);
+#endif
+#ifdef REGEXEC_BUF
+ if (!(mode&FLAG_X))
+ {
+  if (p==end) return end;
+#ifdef REGSCRATCH
+  e=regexec_buf_r(&s->w->regextable[t], p, (end-p)-(end[-1]=='\n'), &m, 0,
+                  s->w->scratch[t]);
+#else
+  e=regexec_buf(&s->w->regextable[t], p, (end-p)-(end[-1]=='\n'), &m, 0);
+#endif
+  if (e&&(e!=REG_NOMATCH)) s->reerr=e;
+  if (e) return end;
+  return p+m.rm_so;
+ }
+#endif
+ while (p<end)
+ {
+  m.rm_so=0;
+  m.rm_eo=(end-p)-(end[-1]=='\n');
+  if (run_regex(s, t, p, &m)) return end;
+  q=line_start(p, p+m.rm_so);
+  le=line_end(q, end);
+  if (p+m.rm_eo>le)
+  {
+   m.rm_so=0;
+   m.rm_eo=le-q;
+   if (run_regex(s, t, q, &m))
+   {
+    if (s->reerr||(le==end)) break;
+    p=le+1;
+    continue;
+   }
+   p=q;
+  }
+  if (!(mode&FLAG_X)) return q;
+  if ((p+m.rm_so==q)&&(p+m.rm_eo==le)) return q;
+  if (le==end) break;
+  p=le+1;
+ }
+ return end;
+}
+
+/*
+ * Run the Aho-Corasick automaton from p up to end.  Patterns cannot contain a
+ * newline, so the first match to end is in the first line that matches.
+ * Return the start of that line, or end if no line matches.
+ */
+static char *ac_search (char *p, char *end)
+{
+ unsigned char *q;
+ unsigned long o;
+
+ o=0;
+ for (q=(unsigned char *)p; q<(unsigned char *)end; q++)
+ {
+  o=actrans[o+accls[*q]];
+  if (o&ACFINAL) return line_start(p, (char *)q);
+ }
+ return end;
+}
+
+/*
+ * Find the first line from p up to end that matches any pattern.  Return the
+ * start of the line, or end if no line matches.
+ */
+static char *next_match (struct scan *s, char *p, char *end)
+{
+ int t;
+ char *q, *le, *best;
+ char **hitcache;
+
+ /* fgrep -x: no use searching, just compare every line. */
+ if ((mode&(IS_FGREP|FLAG_X))==(IS_FGREP|FLAG_X))
+ {
+  for (q=p; q<end; q=le+1)
+  {
+   le=line_end(q, end);
+   if (xset)
+   {
+    if (xlookup(q, le-q)>=0) return q;
+    if (le==end) break;
+    continue;
+   }
+   for (t=0; t<patstack; t++)
+   {
+    if ((size_t)(le-q)!=patternlen[t]) continue;
+    if ((mode&FLAG_I)?int_memcaseeq(q, patterntable[t], patternlen[t])
+                     :!memcmp(q, patterntable[t], patternlen[t]))
+     return q;
+   }
+   if (le==end) break;
+  }
+  return end;
+ }
+
+ if (actrans) return ac_search(p, end);
+
+ best=end;
+ hitcache=s->w->hitcache;
+ for (t=0; t<((mode&IS_FGREP)?patstack:nregex); t++)
+ {
+  if ((!hitcache[t])||(hitcache[t]<p)) hitcache[t]=find_hit(s, t, p, end);
+  if (hitcache[t]<best) best=hitcache[t];
+  if (best==p) break;
+ }
+ return best;
+}
+
+#ifdef GREP_ZLIB
+/*
+ * For -z: see whether a file is gzipped (the same check as autodec() makes
+ * in compress.c), and if it is, get ready to inflate it.  Return -1 on a
+ * read error.
+ */
+static int gz_open (struct scan *s)
+{
+ struct searcher *w;
+ unsigned char *m;
+ ssize_t n;
+
+ w=s->w;
+ if (s->mapped)
+ {
+  m=(unsigned char *)s->buf;
+  if ((m[0]!=0x1F)||(m[1]!=0x8B)) return 0;
+ }
+ else
+ {
+  if (!w->zbuf)
+  {
+   w->zbuf=malloc(SCAN_BLOCK);
+   if (!w->zbuf) scram();
+  }
+  while ((n=read(s->fd, w->zbuf, SCAN_BLOCK))<0)
+   if (errno!=EINTR) return -1;
+  m=(unsigned char *)w->zbuf;
+  if ((n<2)||(m[0]!=0x1F)||(m[1]!=0x8B))
+  {
+   s->pend=w->zbuf;
+   s->npend=n;
+   return 0;
+  }
+ }
+
+ /* 15+16: a gzip header is expected, and the largest window. */
+ if (!w->zinit)
+ {
+  w->zs.zalloc=Z_NULL;
+  w->zs.zfree=Z_NULL;
+  w->zs.opaque=Z_NULL;
+  w->zs.next_in=Z_NULL;
+  w->zs.avail_in=0;
+  if (inflateInit2(&w->zs, 15+16)!=Z_OK) scram();
+  w->zinit=1;
+ }
+ else
+  inflateReset(&w->zs);
+
+ /* A mapped file is inflated from the mapping, and is then read like any. */
+ if (s->mapped)
+ {
+  w->zs.next_in=(Bytef *)s->buf;
+  w->zs.avail_in=s->len;
+  s->zmap=s->buf;
+  s->zmaplen=s->len;
+  s->mapped=0;
+  s->len=s->bufsiz=0;
+ }
+ else
+ {
+  w->zs.next_in=(Bytef *)w->zbuf;
+  w->zs.avail_in=n;
+ }
+ s->gz=1;
+ s->zend=0;
+ return 0;
+}
+
+/* Let go of what a searcher has kept for -z. */
+static void gz_free (struct searcher *w)
+{
+ if (w->zinit) inflateEnd(&w->zs);
+ free(w->zbuf);
+}
+#endif
+
+/*
+ * Read up to n bytes of the file into p, inflating them first for -z.
+ * Return the number read, 0 at end of file, or -1 on a read error (or, for
+ * -z, damaged data).
+ */
+static ssize_t scan_read (struct scan *s, char *p, size_t n)
+{
+#ifdef GREP_ZLIB
+ z_stream *z;
+ ssize_t r;
+ int e;
+#endif
+
+ if (s->npend)
+ {
+  if (n>s->npend) n=s->npend;
+  memcpy(p, s->pend, n);
+  s->pend+=n;
+  s->npend-=n;
+  return n;
+ }
+
+#ifdef GREP_ZLIB
+ if (s->gz)
+ {
+  z=&s->w->zs;
+  z->next_out=(Bytef *)p;
+  z->avail_out=n;
+  while (z->avail_out==n)
+  {
+   if (!z->avail_in)
+   {
+    r=0;
+    if (!s->zmap)
+    {
+     r=read(s->fd, s->w->zbuf, SCAN_BLOCK);
+     if (r<0)
+     {
+      if (errno==EINTR) continue;
+      return -1;
+     }
+    }
+
+    /* Running out in the middle of a member means the file was cut off. */
+    if (!r)
+    {
+     if (s->zend) return 0;
+     errno=EIO;
+     return -1;
+    }
+    z->next_in=(Bytef *)s->w->zbuf;
+    z->avail_in=r;
+   }
+
+   /* Several gzip members one after another are read as one. */
+   e=inflate(z, Z_NO_FLUSH);
+   if (e==Z_STREAM_END)
+   {
+    s->zend=1;
+    inflateReset(z);
+   }
+   else if (e==Z_OK)
+    s->zend=0;
+   else
+   {
+    errno=EIO;
+    return -1;
+   }
+  }
+  return n-z->avail_out;
+ }
+#endif
+
+ return read(s->fd, p, n);
+}
+
+/*
+ * Make the next run of whole lines available as buf[pos] up to buf[lim].
+ * Return 1 if there is one, 0 at end of file, -1 on a read error.
+ */
+static int scan_fill (struct scan *s)
+{
+ ssize_t n;
+ size_t o;
+ char *q;
+
+ if (s->mapped)
+ {
+  if (s->pos==s->len) return 0;
+  s->lim=s->len;
+  return 1;
+ }
+
+ /* Drop what has been scanned, and keep any partial line. */
+ if (s->pos)
+ {
+  s->base+=s->pos;
+  memmove(s->buf, s->buf+s->pos, s->len-s->pos);
+  s->len-=s->pos;
+  s->pos=0;
+ }
+
+ while (1)
+ {
+  /* A last line with no newline on it is still a line. */
+  if (s->eof)
+  {
+   s->lim=s->len;
+   return s->len?1:0;
+  }
+
+  /* The line does not fit, so make room for it. */
+  if (s->len==s->bufsiz)
+  {
+   q=realloc(s->buf, s->bufsiz<<1);
+   if (!q) scram();
+   s->buf=s->w->buf=q;
+   s->bufsiz=s->w->bufsiz=s->bufsiz<<1;
+  }
+
+  n=scan_read(s, s->buf+s->len, s->bufsiz-s->len);
+  if (n<0)
+  {
+   if (errno==EINTR) continue;
+   return -1;
+  }
+  if (!n)
+  {
+   s->eof=1;
+   continue;
+  }
+
+  o=s->len;
+  s->len+=n;
+
+  /*
+   * A NUL in the first block read makes it a binary file.  Give up on it
+   * right away if it is to be skipped.
+   */
+  if ((!s->base)&&(!o)&&(!(mode&FLAG_A)))
+  {
+   s->binary=(memchr(s->buf, 0, n)!=0);
+   if (s->binary&&(mode&FLAG_SKIP)) return 0;
+  }
+  for (q=s->buf+s->len; q>s->buf+o; )
+   if (*--q=='\n')
+   {
+    s->lim=(q+1)-s->buf;
+    return 1;
+   }
+ }
+}
+
+/*
+ * Write out part of the output for a file: straight to stdout, or with -j
+ * into the file's job (or chunk), to be written out once its turn comes.
+ */
+static void out_write (struct searcher *w, char *p, size_t l)
+{
+ struct outbuf *o;
+ size_t z;
+ char *q;
+
+ o=w->out;
+ if (!o)
+ {
+  fwrite (p, 1, l, stdout);
+  return;
+ }
+
+ if (o->siz-o->len<l)
+ {
+  z=o->siz?o->siz:4096;
+  while (z-o->len<l) z<<=1;
+  q=realloc(o->buf, z);
+  if (!q) scram();
+  o->buf=q;
+  o->siz=z;
+ }
+ memcpy(o->buf+o->len, p, l);
+ o->len+=l;
+}
+
+static void out_str (struct searcher *w, char *p)
+{
+ out_write(w, p, strlen(p));
+}
+
+static void out_num (struct searcher *w, unsigned long n, int c)
+{
+ char b[24];
+
+ sprintf (b, "%lu%c", n, c);
+ out_write(w, b, strlen(b));
+}
+
+/* Note a line number within a chunk, to be fixed up when it is written. */
+static void out_fix (struct searcher *w, unsigned long n)
+{
+ struct outbuf *o;
+ unsigned long *q;
+ size_t z;
+
+ o=w->out;
+ if (o->nfix==o->fixsiz)
+ {
+  z=o->fixsiz?(o->fixsiz<<1):64;
+  q=realloc(o->fix, z*2*sizeof(unsigned long));
+  if (!q) scram();
+  o->fix=q;
+  o->fixsiz=z;
+ }
+ o->fix[2*o->nfix]=o->len;
+ o->fix[2*o->nfix+1]=n;
+ o->nfix++;
+}
+
+#ifdef GREP_THREADS
+/* Set up an empty output buffer. */
+static void out_init (struct outbuf *o)
+{
+ o->buf=o->err=0;
+ o->len=o->siz=0;
+ o->fix=0;
+ o->nfix=o->fixsiz=0;
+}
+#endif
+
+/*
+ * Report that a file could not be opened or read, or searched: e says why.
+ * With -j the message is held back with the file's output, so that it comes
+ * out in the same place.
+ */
+static void scan_error (struct searcher *w, char *filename, char *e)
+{
+ struct outbuf *o;
+
+ o=w->out;
+ if (!o)
+ {
+  fprintf (stderr, "%s: %s: %s\n", progname, filename, e);
+  return;
+ }
+
+ free(o->err);
+ o->err=malloc(strlen(progname)+strlen(filename)+strlen(e)+6);
+ if (!o->err) scram();
+ sprintf (o->err, "%s: %s: %s\n", progname, filename, e);
+}
+
+/*
+ * -q has found a line, so grep is done, with 0.  For --debug-regex, what the
+ * searchers have counted so far is reported first.  Searching is done
+ * without joblock held, so a worker can take it here, and hold up any other
+ * that gets here too until the exit.
+ */
+static void quit_found (void)
+{
+#ifdef REGSTATS
+ int t;
+#ifdef GREP_THREADS
+ int u;
+#endif
+
+ if (regtotals)
+ {
+#ifdef GREP_THREADS
+  if (nworkers) pthread_mutex_lock(&joblock);
+#endif
+  for (t=0; t<patstack; t++)
+  {
+   if (mainsearcher.scratch[t])
+    stats_add(&regtotals[t], mainsearcher.scratch[t]);
+#ifdef GREP_THREADS
+   for (u=0; u<nworkers; u++)
+    if (wsearch[u].scratch[t])
+     stats_add(&regtotals[t], wsearch[u].scratch[t]);
+#endif
+  }
+  stats_report();
+ }
+#endif
+ exit(0);
+}
+
+/*
+ * Select a line: count it, and print it unless only a count, a filename or
+ * an exit code is wanted.
+ *
+ * Line and block numbers are only worked out here, so that nobody pays for
+ * them unless -n or -b was specified.  The block number is computed the way
+ * it was when lines were read one by one, from the file position after the
+ * line.
+ *
+ * (POSIX specifies %d, but it should really be %u as this is an unsigned
+ *  value. Herp de derp.)
+ */
+static void select_line (struct scan *s, char *realname, char *ls, char *le,
+                         char *end)
+{
+ s->count++;
+
+ /*
+  * With -q, the first line selected anywhere settles it: 0 takes priority
+  * over every other exit code, and nothing is printed.  So there is no need
+  * to look at the rest of this file, or at any other.
+  */
+ if (mode&FLAG_Q) quit_found();
+
+ if ((mode&(FLAG_C|FLAG_L))||s->binary) return;
+
+ if (mulfil)
+ {
+  out_str(s->w, realname);
+  out_write(s->w, ":", 1);
+ }
+ if (mode&FLAG_B)
+  out_num(s->w, (unsigned long)
+          ((s->base+(off_t)(le-s->buf)+(le<end)+1)>>9), ':');
+ if (mode&FLAG_N)
+ {
+  s->lineno+=count_nl(s->lnp, ls);
+  s->lnp=ls;
+  if (s->chunk)
+   out_fix(s->w, s->lineno+1);
+  else
+   out_num(s->w, s->lineno+1, ':');
+ }
+ out_write(s->w, ls, le-ls);
+ out_write(s->w, "\n", 1);
+}
+
+/*
+ * Run the scanning engine over a file (or a chunk of one), selecting lines.
+ * Return 0 at the end, or -1 on a read error or if the regex library gave up
+ * (with the error in s->reerr).
+ */
+static int scan_lines (struct scan *s, char *realname)
+{
+ int e, t, inv;
+ unsigned long most;
+ char *p, *q, *le, *end;
+
+ /*
+  * With -v, the lines selected are the ones between matches; but -lv has to
+  * be special-cased, as it lists the files with no matches at all.
+  */
+ inv=((mode&(FLAG_V|FLAG_L))==FLAG_V);
+
+ /*
+  * Speed optimization.
+  *
+  * This technique is documented in at least one other version:  If we are
+  * just looking for *if* a file matches, we only have to find one match to
+  * know if it does or not.  (This, regardless of the presence of the -v
+  * switch.)  The same goes for a binary file, unless its lines are counted.
+  *
+  * -m sets the most lines to select before giving up on the file.
+  */
+ most=(mode&FLAG_M)?maxcount:(unsigned long)-1;
+ if ((most>1)&&((mode&FLAG_L)||(s->binary&&!(mode&FLAG_C)))) most=1;
+ if (!most) return 0;
+
+ while ((e=scan_fill(s))>0)
+ {
+  p=s->buf+s->pos;
+  end=s->buf+s->lim;
+  s->lnp=p;
+  for (t=0; t<patstack; t++) s->w->hitcache[t]=0;
+
+  while (p<end)
+  {
+   q=next_match(s, p, end);
+   if (s->reerr) return -1;
+
+   if (inv)
+   {
+    while (p<q)
+    {
+     le=line_end(p, q);
+     select_line(s, realname, p, le, end);
+     p=(le<q)?le+1:q;
+     if (s->count>=most) break;
+    }
+    if ((q==end)||(s->count>=most)) break;
+    le=line_end(q, end);
+    p=(le<end)?le+1:end;
+   }
+   else
+   {
+    if (q==end) break;
+    le=line_end(q, end);
+    select_line(s, realname, q, le, end);
+    p=(le<end)?le+1:end;
+    if (s->count>=most) break;
+   }
+  }
+
+  if (s->count>=most) break;
+
+  if (mode&FLAG_N) s->lineno+=count_nl(s->lnp, end);
+  s->pos=s->lim;
+ }
+ return e;
+}
+
+#ifdef GREP_THREADS
+/*
+ * Take the next chunk of a file to search.  Once the last one has been
+ * taken, nobody else needs to be offered the file.  Call with joblock held.
+ */
+static int chunk_claim (struct chunkset *cs)
+{
+ struct chunkset **p;
+ int k;
+
+ k=cs->claim++;
+ if (cs->claim==cs->n)
+ {
+  for (p=&chunksets; *p!=cs; p=&(*p)->next);
+  *p=cs->next;
+ }
+ return k;
+}
+
+/*
+ * Mark a chunk done, and let its file's owner know.  For -l and -q, one
+ * selected line anywhere settles it, so hand out no more of the file.  Call
+ * with joblock held.
+ */
+static void chunk_done (struct chunkset *cs, int k)
+{
+ struct chunkset **p;
+
+ cs->c[k].done=1;
+ if (((mode&(FLAG_L|FLAG_Q))||(cs->binary&&!(mode&FLAG_C)))&&
+     cs->c[k].count&&(cs->claim<cs->n))
+ {
+  for (p=&chunksets; *p!=cs; p=&(*p)->next);
+  *p=cs->next;
+  cs->n=cs->claim;
+ }
+ pthread_cond_broadcast(&jobdone);
+}
+
+/* Search one chunk of a file, holding its output back in the chunk. */
+static void chunk_search (struct searcher *w, struct chunkset *cs, int k)
+{
+ struct chunk *c;
+ struct outbuf *o;
+ struct scan s;
+
+ c=&cs->c[k];
+ s.w=w;
+ s.fd=-1;
+ s.mapped=s.chunk=1;
+ s.eof=0;
+ s.binary=cs->binary;
+ s.reerr=0;
+ s.buf=cs->buf;
+ s.bufsiz=s.len=c->lim;
+ s.pos=s.lim=c->pos;
+ s.base=0;
+ s.lineno=s.count=0;
+ s.gz=0;
+ s.zmap=s.pend=0;
+ s.npend=0;
+
+ o=w->out;
+ w->out=&c->o;
+ scan_lines(&s, cs->name);
+ w->out=o;
+
+ c->count=s.count;
+ c->nl=s.lineno;
+ c->reerr=s.reerr;
+}
+
+/*
+ * Search a large mapped file with -j: split it into chunks at line
+ * boundaries, and let any idle workers help with them.  The chunks are
+ * written out in order as they are done, and the line numbers in them
+ * (which start over in each chunk) are fixed up with the number of lines in
+ * the chunks before.  The block numbers are right as they stand, since every
+ * chunk is searched in place in the one mapping.
+ */
+static int scan_chunks (struct scan *s, char *realname)
+{
+ struct chunkset cs;
+ struct chunk *c;
+ unsigned long lnbase;
+ size_t f, o, pos, lim;
+ char *q;
+ int k, m;
+
+ cs.c=malloc((s->len/SCAN_CHUNK+1)*sizeof(struct chunk));
+ if (!cs.c) scram();
+ cs.n=0;
+ for (pos=0; pos<s->len; pos=lim)
+ {
+  lim=pos+SCAN_CHUNK;
+  if (lim>=s->len)
+   lim=s->len;
+  else
+  {
+   q=memchr(s->buf+lim-1, '\n', s->len-(lim-1));
+   lim=q?(size_t)(q-s->buf)+1:s->len;
+  }
+  c=&cs.c[cs.n++];
+  c->pos=pos;
+  c->lim=lim;
+  c->count=c->nl=0;
+  c->done=c->reerr=0;
+  out_init(&c->o);
+ }
+ cs.buf=s->buf;
+ cs.name=realname;
+ cs.binary=s->binary;
+ cs.claim=0;
+
+ pthread_mutex_lock(&joblock);
+ cs.next=chunksets;
+ chunksets=&cs;
+ pthread_cond_broadcast(&jobready);
+
+ m=0;
+ lnbase=0;
+ while (1)
+ {
+  /* Write out what is done, in order. */
+  if ((m<cs.claim)&&cs.c[m].done)
+  {
+   pthread_mutex_unlock(&joblock);
+   c=&cs.c[m++];
+   s->count+=c->count;
+   if (c->reerr) s->reerr=c->reerr;
+   for (o=f=0; f<c->o.nfix; f++)
+   {
+    if (c->o.fix[2*f]>o) out_write(s->w, c->o.buf+o, c->o.fix[2*f]-o);
+    out_num(s->w, c->o.fix[2*f+1]+lnbase, ':');
+    o=c->o.fix[2*f];
+   }
+   if (c->o.len>o) out_write(s->w, c->o.buf+o, c->o.len-o);
+   lnbase+=c->nl;
+   free(c->o.buf);
+   free(c->o.fix);
+   pthread_mutex_lock(&joblock);
+   continue;
+  }
+
+  /* Otherwise help search it. */
+  if (cs.claim<cs.n)
+  {
+   k=chunk_claim(&cs);
+   pthread_mutex_unlock(&joblock);
+   chunk_search(s->w, &cs, k);
+   pthread_mutex_lock(&joblock);
+   chunk_done(&cs, k);
+   continue;
+  }
+
+  if (m==cs.claim) break;
+  pthread_cond_wait(&jobdone, &joblock);
+ }
+ pthread_mutex_unlock(&joblock);
+
+ free(cs.c);
+ return s->reerr?-1:0;
+}
+#endif
+
+/*
+ * The trigram index.
+ *
+ * The file is made of 32-bit little-endian words (two of them, low word
+ * first, for offsets, sizes and times):
+ *
+ *   header:        IDX_MAGIC, IDX_VERSION, the number of files, trigrams and
+ *                  name hash slots, then the offsets of the file table, name
+ *                  hash, trigram table, names and postings, the size of the
+ *                  whole file, and when it was made
+ *   file table:    per file, the offset and length of its name, its size,
+ *                  its mtime (seconds, then nanoseconds in one word), its
+ *                  ctime (likewise) and its inode number
+ *   name hash:     a power of 2 of slots, at least twice the number of
+ *                  files, each a file number plus one (0 for an empty slot),
+ *                  by idx_hash() of the name
+ *   trigram table: in ascending order, each trigram, the number of files it
+ *                  is in, and the offset of their numbers in the postings
+ *   names:         one after another, with no NULs
+ *   postings:      for each trigram, the numbers of its files in ascending
+ *                  order, each as the difference from the one before (the
+ *                  first from -1), 7 bits to a byte, low bits first, with the
+ *                  top bit set on all but the last byte
+ */
+static unsigned long idx_get (unsigned char *p)
+{
+ return ((unsigned long)p[0])|(((unsigned long)p[1])<<8)|
+        (((unsigned long)p[2])<<16)|(((unsigned long)p[3])<<24);
+}
+
+static size_t idx_get2 (unsigned char *p)
+{
+ return ((size_t)idx_get(p))|((((size_t)idx_get(p+4))<<16)<<16);
+}
+
+static void idx_put (FILE *f, unsigned long v)
+{
+ putc((int)(v&0xFF), f);
+ putc((int)((v>>8)&0xFF), f);
+ putc((int)((v>>16)&0xFF), f);
+ putc((int)((v>>24)&0xFF), f);
+}
+
+static void idx_put2 (FILE *f, unsigned long v)
+{
+ idx_put(f, v&0xFFFFFFFFUL);
+ idx_put(f, (v>>16)>>16);
+}
+
+/* FNV-1a hash of a file name. */
+static unsigned long idx_hash (const char *p, size_t l)
+{
+ unsigned long h;
+ size_t i;
+
+ h=2166136261UL;
+ for (i=0; i<l; i++) h=(h^(unsigned char)p[i])*16777619UL;
+ return h&0xFFFFFFFFUL;
+}
+
+/* Note that file number f has trigram t. */
+static void idx_tri_add (unsigned long t, unsigned long f)
+{
+ struct idxtri *x, *o;
+ unsigned long i, n, d;
+
+ /* Keep the table at most half full. */
+ if (ixused>=(ixmask+1)/2)
+ {
+  o=ixtab;
+  n=ixmask+1;
+  ixmask=ixtab?(2*n-1):65535;
+  ixtab=calloc(ixmask+1, sizeof(struct idxtri));
+  if (!ixtab) scram();
+  if (o)
+  {
+   for (i=0; i<n; i++)
+    if (o[i].count)
+    {
+     for (d=(o[i].tri*2654435761UL)&ixmask; ixtab[d].count; d=(d+1)&ixmask);
+     ixtab[d]=o[i];
+    }
+   free(o);
+  }
+ }
+
+ for (i=(t*2654435761UL)&ixmask; ixtab[i].count; i=(i+1)&ixmask)
+  if (ixtab[i].tri==t) break;
+ x=&ixtab[i];
+ if (!x->count)
+ {
+  x->tri=t;
+  ixused++;
+ }
+ else if (x->last==f+1)
+  return;
+
+ /* Five bytes is enough for a 32-bit file number. */
+ if (x->siz-x->len<5)
+ {
+  x->siz=x->siz?(2*x->siz):8;
+  x->post=realloc(x->post, x->siz);
+  if (!x->post) scram();
+ }
+ for (d=f+1-x->last; d>=0x80; d>>=7) x->post[x->len++]=(unsigned char)(d|0x80);
+ x->post[x->len++]=(unsigned char)d;
+ x->last=f+1;
+ x->count++;
+}
+
+/*
+ * Add a file found by --make-index to the index.  One that has a NUL in its
+ * first block is taken to be binary and left out.  One that cannot be read
+ * in full, or that was changed after the index was begun, is put in with a
+ * size it cannot have, so that it is always searched.
+ */
+static void idx_add (const char *filename, const struct stat *st)
+{
+ struct idxfile *x;
+ unsigned long t, f;
+ ssize_t r, i;
+ int fd, k, first;
+
+ if (!S_ISREG(st->st_mode)) return;
+
+ fd=open(filename, O_RDONLY);
+ if (fd<0)
+ {
+  if (!(mode&FLAG_S)) xperror((char *)filename);
+  ixstatus=2;
+  return;
+ }
+ if (!ixbuf)
+ {
+  ixbuf=malloc(SCAN_BLOCK);
+  if (!ixbuf) scram();
+ }
+
+ if (nixfiles==ixfilealloc)
+ {
+  ixfilealloc=ixfilealloc?(ixfilealloc<<1):1024;
+  ixfiles=realloc(ixfiles, ixfilealloc*sizeof(struct idxfile));
+  if (!ixfiles) scram();
+ }
+ f=nixfiles;
+ x=&ixfiles[f];
+ x->size=(unsigned long)st->st_size;
+ x->mtime=(unsigned long)st->st_mtime;
+ x->mnsec=(unsigned long)ST_MNSEC(st);
+ x->ctime=(unsigned long)st->st_ctime;
+ x->cnsec=(unsigned long)ST_CNSEC(st);
+ x->ino=(unsigned long)st->st_ino;
+ if ((st->st_mtime>=ixstart)||(st->st_ctime>=ixstart)) x->size=~0UL;
+
+ t=0;
+ k=0;
+ first=1;
+ while (1)
+ {
+  r=read(fd, ixbuf, SCAN_BLOCK);
+  if (r<0)
+  {
+   if (errno==EINTR) continue;
+   if (!(mode&FLAG_S)) xperror((char *)filename);
+   ixstatus=2;
+   x->size=~0UL;
+   break;
+  }
+  if (!r) break;
+  if (first&&memchr(ixbuf, 0, r))
+  {
+   close(fd);
+   return;
+  }
+  first=0;
+
+  for (i=0; i<r; i++)
+  {
+   if (ixbuf[i]=='\n')
+   {
+    k=0;
+    continue;
+   }
+   t=((t<<8)|IDX_FOLD((unsigned char)ixbuf[i]))&0xFFFFFF;
+   if (++k>=3) idx_tri_add(t, f);
+  }
+ }
+ close(fd);
+
+ x->name=malloc(strlen(filename)+1);
+ if (!x->name) scram();
+ strcpy(x->name, filename);
+ nixfiles++;
+}
+
+static int idx_cmp (const void *a, const void *b)
+{
+ unsigned long x, y;
+
+ x=((const struct idxtri *)a)->tri;
+ y=((const struct idxtri *)b)->tri;
+ return (x<y)?-1:(x>y);
+}
+
+/* Write out the index made by --make-index.  Return 0, or 2 on an error. */
+static int idx_write (char *filename)
+{
+ FILE *f;
+ char *tmp;
+ unsigned long n, i, h, nslot, *slot;
+ size_t l, o, ofile, ohash, otri, oname, opost, end;
+
+ /* Pack the trigrams down and put them in order. */
+ for (n=i=0; i<=ixmask&&ixtab; i++)
+  if (ixtab[i].count) ixtab[n++]=ixtab[i];
+ if (n) qsort(ixtab, n, sizeof(struct idxtri), idx_cmp);
+
+ for (nslot=2; nslot<2*nixfiles; nslot<<=1);
+ slot=calloc(nslot, sizeof(unsigned long));
+ if (!slot) scram();
+ for (i=0; i<nixfiles; i++)
+ {
+  l=strlen(ixfiles[i].name);
+  for (h=idx_hash(ixfiles[i].name, l)&(nslot-1); slot[h]; h=(h+1)&(nslot-1));
+  slot[h]=i+1;
+ }
+
+ ofile=IDX_HEAD;
+ ohash=ofile+IDX_FILE*nixfiles;
+ otri=ohash+4*nslot;
+ oname=otri+IDX_TRI*n;
+ for (opost=oname, i=0; i<nixfiles; i++) opost+=strlen(ixfiles[i].name);
+ for (end=opost, i=0; i<n; i++) end+=ixtab[i].len;
+
+ /* Write it under another name, and only put it in place once it is whole. */
+ tmp=malloc(strlen(filename)+5);
+ if (!tmp) scram();
+ strcpy(tmp, filename);
+ strcat(tmp, ".tmp");
+ f=fopen(tmp, "wb");
+ if (!f)
+ {
+  xperror(tmp);
+  free(tmp);
+  free(slot);
+  return 2;
+ }
+
+ idx_put(f, IDX_MAGIC);
+ idx_put(f, IDX_VERSION);
+ idx_put(f, nixfiles);
+ idx_put(f, n);
+ idx_put(f, nslot);
+ idx_put2(f, ofile);
+ idx_put2(f, ohash);
+ idx_put2(f, otri);
+ idx_put2(f, oname);
+ idx_put2(f, opost);
+ idx_put2(f, end);
+ idx_put2(f, (unsigned long)ixstart);
+ for (o=oname, i=0; i<nixfiles; i++)
+ {
+  l=strlen(ixfiles[i].name);
+  idx_put2(f, o);
+  idx_put(f, l);
+  idx_put2(f, ixfiles[i].size);
+  idx_put2(f, ixfiles[i].mtime);
+  idx_put(f, ixfiles[i].mnsec);
+  idx_put2(f, ixfiles[i].ctime);
+  idx_put(f, ixfiles[i].cnsec);
+  idx_put2(f, ixfiles[i].ino);
+  o+=l;
+ }
+ for (i=0; i<nslot; i++) idx_put(f, slot[i]);
+ for (o=opost, i=0; i<n; i++)
+ {
+  idx_put(f, ixtab[i].tri);
+  idx_put(f, ixtab[i].count);
+  idx_put2(f, o);
+  o+=ixtab[i].len;
+ }
+ for (i=0; i<nixfiles; i++) fputs(ixfiles[i].name, f);
+ for (i=0; i<n; i++) fwrite(ixtab[i].post, 1, ixtab[i].len, f);
+
+ free(slot);
+ if (ferror(f)|fclose(f))
+ {
+  xperror(tmp);
+  unlink(tmp);
+  free(tmp);
+  return 2;
+ }
+ if (rename(tmp, filename))
+ {
+  xperror(filename);
+  unlink(tmp);
+  free(tmp);
+  return 2;
+ }
+ free(tmp);
+ return 0;
+}
+
+/* Map in the index for --index.  Return 0, or 2 (having said why). */
+static int idx_open (char *filename)
+{
+ struct stat statbuf;
+ unsigned char *m;
+ size_t ofile, ohash, otri, oname, opost;
+ int fd;
+
+ fd=open(filename, O_RDONLY);
+ if (fd<0)
+ {
+  xperror(filename);
+  return 2;
+ }
+ if (fstat(fd, &statbuf)||(statbuf.st_size<IDX_HEAD)||
+     ((off_t)(size_t)statbuf.st_size!=statbuf.st_size))
+ {
+  close(fd);
+  goto bad;
+ }
+ ixmaplen=(size_t)statbuf.st_size;
+ m=mmap(0, ixmaplen, PROT_READ, MAP_PRIVATE, fd, 0);
+ close(fd);
+ if (m==(unsigned char *)MAP_FAILED)
+ {
+  xperror(filename);
+  return 2;
+ }
+ ixmap=m;
+
+ ixn=idx_get(m+8);
+ ixntri=idx_get(m+12);
+ ixnslot=idx_get(m+16);
+ ofile=idx_get2(m+20);
+ ohash=idx_get2(m+28);
+ otri=idx_get2(m+36);
+ oname=idx_get2(m+44);
+ opost=idx_get2(m+52);
+ if ((idx_get(m)!=IDX_MAGIC)||(idx_get(m+4)!=IDX_VERSION)||
+     (idx_get2(m+60)!=ixmaplen)||(ofile!=IDX_HEAD)||
+     (ohash!=ofile+IDX_FILE*(size_t)ixn)||
+     (otri!=ohash+4*(size_t)ixnslot)||
+     (oname!=otri+IDX_TRI*(size_t)ixntri)||
+     (opost<oname)||(opost>ixmaplen)||
+     (!ixnslot)||(ixnslot&(ixnslot-1))||(ixnslot/2<ixn))
+  goto bad;
+ ixftab=m+ofile;
+ ixhash=m+ohash;
+ ixttab=m+otri;
+ return 0;
+
+bad:
+ fprintf (stderr, "%s: %s: not a usable index\n", progname, filename);
+ return 2;
+}
+
+/*
+ * Mark in ixall the files with every trigram in ixq, and add them to
+ * ixcand.  If the postings turn out not to make sense, every file is taken
+ * to match.
+ */
+static void idx_and (void)
+{
+ unsigned char *e, *p, *end;
+ unsigned long lo, hi, mid, n, f, d;
+ size_t z;
+ int i, b;
+
+ z=(ixn+7)>>3;
+ memset(ixall, 0xFF, z);
+ end=ixmap+ixmaplen;
+ for (i=0; i<nixq; i++)
+ {
+  lo=0;
+  hi=ixntri;
+  while (lo<hi)
+  {
+   mid=lo+(hi-lo)/2;
+   if (idx_get(ixttab+IDX_TRI*mid)<ixq[i]) lo=mid+1; else hi=mid;
+  }
+  if ((lo==ixntri)||(idx_get(ixttab+IDX_TRI*lo)!=ixq[i])) return;
+
+  e=ixttab+IDX_TRI*lo;
+  n=idx_get(e+4);
+  if (idx_get2(e+8)>ixmaplen) goto bad;
+  p=ixmap+idx_get2(e+8);
+  memset(ixtmp, 0, z);
+  for (f=0; n--; )
+  {
+   d=0;
+   b=0;
+   do
+   {
+    if ((p==end)||(b>28)) goto bad;
+    d|=((unsigned long)(*p&0x7F))<<b;
+    b+=7;
+   } while (*p++&0x80);
+   f+=d;
+   if ((!d)||(f>ixn)) goto bad;
+   ixtmp[(f-1)>>3]|=1<<((f-1)&7);
+  }
+  for (lo=0; lo<z; lo++) ixall[lo]&=ixtmp[lo];
+ }
+ for (lo=0; lo<z; lo++) ixcand[lo]|=ixall[lo];
+ return;
+
+bad:
+ memset(ixcand, 0xFF, z);
+}
+
+/* The literal has come to an end; add its trigrams to ixq. */
+static void idx_flush (void)
+{
+ unsigned long t;
+ size_t i;
+
+ for (t=i=0; i<nixrun; i++)
+ {
+  t=((t<<8)|(unsigned char)ixrun[i])&0xFFFFFF;
+  if (i>=2) ixq[nixq++]=t;
+ }
+ nixrun=0;
+}
+
+/* Add a byte to the literal being picked out of a pattern. */
+static void idx_lit (int c)
+{
+ /*
+  * A newline is never in the index, and for -i, a byte outside ASCII might
+  * be folded in a way the index does not know about.
+  */
+ if ((c=='\n')||((mode&FLAG_I)&&(c&0x80)))
+ {
+  idx_flush();
+  return;
+ }
+ ixrun[nixrun++]=(char)IDX_FOLD(c);
+}
+
+/*
+ * Take back the last character of the literal, now that it turns out to be
+ * optional.  (All of it, if it is a UTF-8 sequence.)
+ */
+static void idx_drop (void)
+{
+ while (nixrun&&((ixrun[nixrun-1]&0xC0)==0x80)) nixrun--;
+ if (nixrun) nixrun--;
+}
+
+/*
+ * A branch of a pattern has come to an end.  Return -1 if there was no
+ * literal in it long enough to be any use.
+ */
+static int idx_branch (void)
+{
+ idx_flush();
+ if (!nixq) return -1;
+ idx_and();
+ nixq=0;
+ return 0;
+}
+
+/* Skip a bracket expression, p being at its [; 0 if it does not end. */
+static char *idx_bracket (char *p)
+{
+ char d;
+
+ p++;
+ if (*p=='^') p++;
+ if (*p==']') p++;
+ while (*p!=']')
+ {
+  if (!*p) return 0;
+  if ((*p=='[')&&((p[1]==':')||(p[1]=='.')||(p[1]=='=')))
+  {
+   d=p[1];
+   p+=2;
+   while (!((*p==d)&&(p[1]==']')))
+   {
+    if (!*p) return 0;
+    p++;
+   }
+   p++;
+  }
+  p++;
+ }
+ return p+1;
+}
+
+/* Skip a subexpression, p being just inside it; 0 if it does not end. */
+static char *idx_group (char *p, int ere)
+{
+ int depth;
+
+ depth=1;
+ while (*p)
+ {
+  if (*p=='[')
+  {
+   p=idx_bracket(p);
+   if (!p) return 0;
+   continue;
+  }
+  if (*p=='\\')
+  {
+   if (!p[1]) return 0;
+   if (!ere)
+   {
+    if (p[1]=='(') depth++;
+    if ((p[1]==')')&&!--depth) return p+2;
+   }
+   p+=2;
+   continue;
+  }
+  if (ere)
+  {
+   if (*p=='(') depth++;
+   if ((*p==')')&&!--depth) return p+1;
+  }
+  p++;
+ }
+ return 0;
+}
+
+/*
+ * Pick out of a pattern the literals that anything it matches has to have,
+ * and add the files in the index that have all their trigrams to ixcand.
+ * Each branch of a top-level alternation is taken on its own.  Return -1 if
+ * some branch has no literal of three bytes or more, so that the index is of
+ * no use.
+ *
+ * This only has to be safe, not thorough: anything in parentheses, and any
+ * escape or construct not understood, just ends the literal.
+ */
+static int idx_pattern (char *re)
+{
+ char *p, *q;
+ int ere;
+
+ ixrun=malloc(strlen(re)+1);
+ ixq=malloc((strlen(re)+1)*sizeof(unsigned long));
+ if ((!ixrun)||(!ixq)) scram();
+ nixrun=0;
+ nixq=0;
+
+ if (mode&IS_FGREP)
+ {
+  for (p=re; *p; p++) idx_lit((unsigned char)*p);
+  goto done;
+ }
+
+ ere=(mode&IS_EGREP)?1:0;
+ p=re;
+ while (*p)
+ {
+  switch (*p)
+  {
+   case '\\':
+    p++;
+    if (!*p) continue;
+    if (!ere)
+    {
+     switch (*p)
+     {
+      case '(':
+       idx_flush();
+       p=idx_group(p+1, 0);
+       if (!p) goto nope;
+       continue;
+      case '{':
+       idx_drop();
+       idx_flush();
+       q=strstr(p, "\\}");
+       p=q?(q+2):(p+1);
+       continue;
+      case '|':
+       if (idx_branch()) goto nope;
+       p++;
+       continue;
+      case '?':
+       idx_drop();
+       idx_flush();
+       p++;
+       continue;
+      case '+':
+       idx_flush();
+       p++;
+       continue;
+     }
+    }
+    if (strchr(".[]*^$\\+?(){}|", *p)) idx_lit((unsigned char)*p); else idx_flush();
+    p++;
+    continue;
+   case '[':
+    idx_flush();
+    p=idx_bracket(p);
+    if (!p) goto nope;
+    continue;
+   case '.': case '^': case '$':
+    idx_flush();
+    break;
+   case '*':
+    idx_drop();
+    idx_flush();
+    break;
+   case '?': case '+': case '{': case '|': case '(': case ')':
+    if (!ere)
+    {
+     idx_lit((unsigned char)*p);
+     break;
+    }
+    switch (*p)
+    {
+     case '?':
+      idx_drop();
+      idx_flush();
+      break;
+     case '+': case ')':
+      idx_flush();
+      break;
+     case '{':
+      idx_drop();
+      idx_flush();
+      q=strchr(p, '}');
+      if (q) p=q;
+      break;
+     case '|':
+      if (idx_branch()) goto nope;
+      break;
+     case '(':
+      idx_flush();
+      p=idx_group(p+1, 1);
+      if (!p) goto nope;
+      continue;
+    }
+    break;
+   default:
+    idx_lit((unsigned char)*p);
+  }
+  p++;
+ }
+
+done:
+ if (idx_branch()) goto nope;
+ free(ixrun);
+ free(ixq);
+ return 0;
+
+nope:
+ free(ixrun);
+ free(ixq);
+ return -1;
+}
+
+/*
+ * For --index: work out which files in the index might match any of the
+ * patterns.  If it cannot be told for some pattern, ixcand is left 0, and
+ * every file is searched.  Return 0, or 2 if the index cannot be used.
+ */
+static int idx_query (void)
+{
+ size_t z;
+ int t;
+
+ if (idx_open(useindex)) return 2;
+ z=((ixn+7)>>3)+1;
+ ixcand=calloc(z, 1);
+ ixall=malloc(z);
+ ixtmp=malloc(z);
+ if ((!ixcand)||(!ixall)||(!ixtmp)) scram();
+ for (t=0; t<patstack; t++)
+  if (idx_pattern(patterntable[t]))
+  {
+   free(ixcand);
+   ixcand=0;
+   break;
+  }
+ free(ixall);
+ free(ixtmp);
+ return 0;
+}
+
+/*
+ * Can the index tell that a file has nothing in it to find?  Only if it is
+ * in the index, not one of the files that might match, and has not changed
+ * since.  (The name hash is looked through at most once, in case it has no
+ * empty slot.)
+ */
+static int idx_skip (char *filename)
+{
+ struct stat statbuf;
+ unsigned char *e;
+ unsigned long i, f, n;
+ size_t l, o;
+
+ l=strlen(filename);
+ for (i=idx_hash(filename, l)&(ixnslot-1), n=0;
+      (n<ixnslot)&&(f=idx_get(ixhash+4*i)); i=(i+1)&(ixnslot-1), n++)
+ {
+  if (--f>=ixn) return 0;
+  e=ixftab+IDX_FILE*f;
+  o=idx_get2(e);
+  if ((idx_get(e+8)!=l)||(o>ixmaplen)||(ixmaplen-o<l)||
+      memcmp(ixmap+o, filename, l))
+   continue;
+  if (ixcand[f>>3]&(1<<(f&7))) return 0;
+  if (stat(filename, &statbuf)||!S_ISREG(statbuf.st_mode)) return 0;
+  return (idx_get2(e+12)==(size_t)(unsigned long)statbuf.st_size)&&
+         (idx_get2(e+20)==(size_t)(unsigned long)statbuf.st_mtime)&&
+         (idx_get(e+28)==(unsigned long)ST_MNSEC(&statbuf))&&
+         (idx_get2(e+32)==(size_t)(unsigned long)statbuf.st_ctime)&&
+         (idx_get(e+40)==(unsigned long)ST_CNSEC(&statbuf))&&
+         (idx_get2(e+44)==(size_t)(unsigned long)statbuf.st_ino);
+ }
+ return 0;
+}
+
+/* The meat of the program. */
+int do_grep (struct searcher *w, char *filename)
+{
+ int e, r;
+ int is_stdin;
+ char *realname;
+ struct scan s;
+ struct stat statbuf;
+
+ r=1;
+
+ is_stdin=0;
+ s.w=w;
+ s.mapped=s.eof=s.chunk=s.binary=s.reerr=0;
+ s.len=s.pos=s.lim=0;
+ s.base=0;
+ s.lineno=s.count=0;
+ s.gz=0;
+ s.zmap=s.pend=0;
+ s.npend=0;
+
+ /* A file the index rules out is not even opened. */
+ if (ixcand&&*filename&&strcmp(filename, "-")&&idx_skip(filename))
+ {
+  if (mode&FLAG_C)
+  {
+   if (mulfil)
+   {
+    out_str(w, filename);
+    out_write(w, ":", 1);
+   }
+   out_num(w, 0, '\n');
+  }
+  return 1;
+ }
+
+ /*
+  * Treat a filename of "-" as referring to stdin.
+  *
+  * Note that POSIX specifies that the file is to be treated as text in all
+  * cases (some versions will special-case a file if they think it is binary).
+  *
+  * As for the string "(standard input)", I would prefer "(stdin)", but the
+  * standard specifies exact verbiage here.
+  */
+ if (*filename && strcmp(filename, "-"))
+ {
+  realname=filename;
+  s.fd=open(filename, O_RDONLY);
+  if (s.fd<0)
+  {
+   if (!(mode&(FLAG_Q|FLAG_S))) scan_error(w, filename, strerror(errno));
+   return 2;
+  }
+
+  /*
+   * Map large regular files instead of copying them through the buffer.
+   * If that fails for any reason, just fall back on reading them.
+   */
+  if ((!fstat(s.fd, &statbuf))&&S_ISREG(statbuf.st_mode)&&
+      (statbuf.st_size>=SCAN_BLOCK)&&
+      ((off_t)(size_t)statbuf.st_size==statbuf.st_size))
+  {
+   s.buf=mmap(0, (size_t)statbuf.st_size, PROT_READ, MAP_PRIVATE, s.fd, 0);
+   if (s.buf!=(char *)MAP_FAILED)
+   {
+#ifdef MADV_SEQUENTIAL
+    madvise(s.buf, (size_t)statbuf.st_size, MADV_SEQUENTIAL);
+#endif
+    s.mapped=1;
+    s.len=s.bufsiz=(size_t)statbuf.st_size;
+
+    /* As in scan_fill(), look for a NUL in the first block. */
+    if (!(mode&FLAG_A))
+     s.binary=(memchr(s.buf, 0, SCAN_BLOCK)!=0);
+   }
+  }
+ }
+ else
+ {
+  is_stdin=1;
+  realname="(standard input)"; /* POSIX me harder */
+  s.fd=0;
+  lseek(0, 0, SEEK_SET);
+ }
+
+ /*
+  * For -z, a gzipped file is read through inflate() instead.  Binary files
+  * are then judged by what comes out.
+  */
+ e=0;
+#ifdef GREP_ZLIB
+ if (mode&FLAG_Z)
+ {
+  e=gz_open(&s);
+  if (s.gz) s.binary=0;
+ }
+#endif
+
+ if (!s.mapped)
+ {
+  if (!w->buf)
+  {
+   w->buf=malloc(SCAN_BLOCK);
+   if (!w->buf) scram();
+   w->bufsiz=SCAN_BLOCK;
+  }
+  s.buf=w->buf;
+  s.bufsiz=w->bufsiz;
+ }
+
+ if (e<0)
+  ;
+ else if (s.binary&&(mode&FLAG_SKIP))
+  e=0;
+#ifdef GREP_THREADS
+ else if (nworkers&&s.mapped&&(s.len>=2*(size_t)SCAN_CHUNK)&&!(mode&FLAG_M))
+  e=scan_chunks(&s, realname);
+#endif
+ else
+  e=scan_lines(&s, realname);
+ if (s.reerr)
+ {
+  char eb[128];
+
+  regerror(s.reerr, &w->regextable[0], eb, sizeof(eb));
+  scan_error(w, realname, eb);
+  r=2;
+ }
+ else if (e<0)
+ {
+  if (!(mode&(FLAG_Q|FLAG_S))) scan_error(w, realname, strerror(errno));
+  r=2;
+ }
+
+ if (s.count) r=0;
+
+ /* For a binary file, say that it matched instead of printing lines. */
+ if (s.binary&&s.count&&!(mode&(FLAG_C|FLAG_Q|FLAG_L)))
+ {
+  out_str(w, "Binary file ");
+  out_str(w, realname);
+  out_str(w, " matches\n");
+ }
+
+ /* Close the file.  If stdin, just reset the stream. */
+ if (s.mapped) munmap(s.buf, s.len);
+ if (s.zmap) munmap(s.zmap, s.zmaplen);
+ if (is_stdin) lseek(0, 0, SEEK_SET); else close(s.fd);
+
+ /*
+  * If -l was set, then we did not reverse the "lines found" flag even if -v
+  * was set, so do it now.
+  */
+ if (((mode&(FLAG_V|FLAG_L))==(FLAG_V|FLAG_L)) && (r<2)) r=!r;
+
+ /*
+  * For -c, display the sum total of lines found.
+  * (Behavior has been tested and matches GNU grep.)
+  */
+ if (mode&FLAG_C)
+ {
+  if (mulfil)
+  {
+   out_str(w, realname);
+   out_write(w, ":", 1);
+  }
+  out_num(w, s.count, '\n');
+ }
+
+ /*
+  * For -l, display the names of any files containing matching lines
+  * (or, with -v, no matching lines).
+  *
+  * This is the reason -lv has to be special-cased.
+  */
+ if ((!r) && (mode&FLAG_L))
+ {
+  out_str(w, realname);
+  out_write(w, "\n", 1);
+ }
+
+ /* Return exit code. */
+ return r;
+}
+
+/*
+ * Fold the exit code for one file operand into the overall one.
+ * Priority is 0>2>1 with -q; 2>0>1 without (as per POSIX).
+ */
+static void tally (int e)
+{
+ if (mode&FLAG_Q)
+ {
+  if (!e) grep_status=0;
+ }
+ else
+ {
+  if ((!e)&&(grep_status==1))
+   grep_status=0;
+  else
+   if (e>grep_status) grep_status=e;
+ }
+}
+
+/*
+ * Take the exit code for a file: the worst one so far goes in *cumul (for
+ * the files under one -r operand), or if cumul is 0, it is tallied.
+ */
+static void collect (int r, int *cumul)
+{
+ if (!cumul)
+  tally(r);
+ else
+  if (r>*cumul) *cumul=r;
+}
+
+#ifdef GREP_THREADS
+#ifndef REGSCRATCH
+/*
+ * Compile a worker's own copy of the regexs.  The regex library may (and
+ * glibc's does) only let one thread at a time search with a compiled regex,
+ * so sharing them would leave the workers taking turns.  They compiled once
+ * already, so they will again.  The bundled one does not, and the workers
+ * share the main table, each with its own scratch space.
+ */
+static regex_t *regex_copy (void)
+{
+ regex_t *tab;
+ int f, t;
+
+ tab=malloc(nregex*sizeof(regex_t));
+ if (!tab) scram();
+ f=reflags;
+ if (regexall)
+ {
+  if (regcomp(&tab[0], regexall, f|REG_EXTENDED)) scram();
+ }
+ else for (t=0; t<nregex; t++)
+  if (regcomp(&tab[t], patterntable[t], f|((mode&IS_EGREP)?REG_EXTENDED:0)))
+   scram();
+ return tab;
+}
+#endif
+
+/*
+ * A -j worker: search the queued files, one at a time, as they come; but
+ * first help out with any file that has been split into chunks.
+ */
+static void *worker (void *arg)
+{
+ struct searcher *w;
+ struct chunkset *cs;
+ struct job *j;
+ int k;
+
+ w=arg;
+#ifndef REGSCRATCH
+ if (!(mode&IS_FGREP)) w->regextable=regex_copy();
+#endif
+
+ pthread_mutex_lock(&joblock);
+ while (1)
+ {
+  if (chunksets)
+  {
+   cs=chunksets;
+   k=chunk_claim(cs);
+   pthread_mutex_unlock(&joblock);
+   chunk_search(w, cs, k);
+   pthread_mutex_lock(&joblock);
+   chunk_done(cs, k);
+   continue;
+  }
+  if (!jobnext)
+  {
+   if (jobquit) break;
+   pthread_cond_wait(&jobready, &joblock);
+   continue;
+  }
+  j=jobnext;
+  jobnext=j->next;
+  pthread_mutex_unlock(&joblock);
+
+  w->out=&j->o;
+  j->r=do_grep(w, j->name);
+  w->out=0;
+
+  pthread_mutex_lock(&joblock);
+  j->done=1;
+  pthread_cond_broadcast(&jobdone);
+ }
+ pthread_mutex_unlock(&joblock);
+ return 0;
+}
+
+/*
+ * Write out the files at the head of the queue that are done, in the order
+ * they were queued.  If all is set, wait for every file; otherwise only wait
+ * if too many are queued up.  Called (and returns) with joblock held.
+ */
+static void job_flush (int all)
+{
+ struct job *j;
+
+ while (jobhead)
+ {
+  j=jobhead;
+  if (!j->done)
+  {
+   if ((!all)&&(njobs<=JOB_QUEUE)) break;
+   pthread_cond_wait(&jobdone, &joblock);
+   continue;
+  }
+  jobhead=j->next;
+  if (!jobhead) jobtail=0;
+  njobs--;
 
- aa=(char *)a; bb=(char *)b;
- while (toupper(*aa++)==toupper(*bb++))
-  if (!*aa) return 0; /* Match. */
- bb--;
- return *aa-*bb;
+  /* Only this thread touches a job once it is done. */
+  pthread_mutex_unlock(&joblock);
+  if (j->o.len) fwrite (j->o.buf, 1, j->o.len, stdout);
+  if (j->o.err) fputs (j->o.err, stderr);
+  collect(j->r, j->cumul);
+  free(j->name);
+  free(j->o.buf);
+  free(j->o.err);
+  free(j);
+  pthread_mutex_lock(&joblock);
+ }
 }
 
-static int int_strncasecmp (const char *a, const char *b, size_t n)
+/* Start n workers for -j. */
+static void start_workers (int n)
 {
- char *aa, *bb;
+ int t;
 
- aa=(char *)a; bb=(char *)b;
- while ((--n)&&(toupper(*aa++)==toupper(*bb++)))
-  if (!*aa) return 0; /* Match. */
- bb--;
- return *aa-*bb;
-}
+ workers=malloc(n*sizeof(pthread_t));
+ wsearch=malloc(n*sizeof(struct searcher));
+ if ((!workers)||(!wsearch)) scram();
+ for (t=0; t<n; t++)
+ {
+  wsearch[t].buf=0;
+  wsearch[t].bufsiz=0;
+#ifdef REGSCRATCH
+  wsearch[t].regextable=regextable;
+  scratch_init(&wsearch[t]);
+#else
+  wsearch[t].regextable=0;
 #endif
+  wsearch[t].out=0;
+#ifdef GREP_ZLIB
+  wsearch[t].zinit=0;
+  wsearch[t].zbuf=0;
+#endif
+  wsearch[t].hitcache=malloc(patstack*sizeof(char *));
+  if (!wsearch[t].hitcache) scram();
+  if (pthread_create(&workers[t], 0, worker, &wsearch[t]))
+  {
+   fprintf (stderr, "%s: cannot start worker threads\n", progname);
+   exit(2);
+  }
+ }
+}
 
-/*
- * Equivalent to GNU's version.
- *
- * In the case that we are using fgrep mode, -i is specified and -x is not,
- * we need to be able to find a substring without case sensitivity.  This
- * method should work well enough though probably far from the most efficient.
- */
-char *int_strcasestr (char *str, char *what)
+/* Let the workers finish up, and clean up after them. */
+static void stop_workers (void)
 {
- int z=0;
+ int t;
+#ifndef REGSCRATCH
+ int e;
+#endif
+
+ pthread_mutex_lock(&joblock);
+ job_flush(1);
+ jobquit=1;
+ pthread_cond_broadcast(&jobready);
+ pthread_mutex_unlock(&joblock);
 
- while (strlen(str)>=strlen(what))
+ for (t=0; t<nworkers; t++)
  {
-  if (!strncasecmp(str, what, strlen(what)))
+  pthread_join(workers[t], 0);
+#ifdef REGSCRATCH
+  scratch_free(&wsearch[t]);
+#else
+  if (wsearch[t].regextable)
   {
-   z=1;
-   break;
+   for (e=0; e<nregex; e++) regfree(&wsearch[t].regextable[e]);
+   free(wsearch[t].regextable);
   }
-  str++;
+#endif
+  free(wsearch[t].buf);
+  free(wsearch[t].hitcache);
+#ifdef GREP_ZLIB
+  gz_free(&wsearch[t]);
+#endif
  }
-
- return z?str:0;
+ free(workers);
+ free(wsearch);
 }
+#endif
 
 /*
- * Modified version of perror(3) that shows the program name
- * (as uso believes a *x app should do with all diagnostics).
+ * Search a file, or with -j, queue it up for a worker.  The exit code goes
+ * to collect().
  */
-void xperror (char *filename)
+static void grep_file (char *filename, int *cumul)
 {
- fprintf (stderr, "%s: %s: %s\n", progname, filename, strerror(errno));
+#ifdef GREP_THREADS
+ struct job *j;
+
+ if (nworkers)
+ {
+  j=malloc(sizeof(struct job));
+  if (!j) scram();
+  j->name=malloc(strlen(filename)+1);
+  if (!j->name) scram();
+  strcpy(j->name, filename);
+  j->next=0;
+  j->cumul=cumul;
+  j->done=j->r=0;
+  out_init(&j->o);
+
+  pthread_mutex_lock(&joblock);
+  if (jobtail) jobtail->next=j; else jobhead=j;
+  jobtail=j;
+  if (!jobnext) jobnext=j;
+  njobs++;
+  pthread_cond_signal(&jobready);
+  job_flush(0);
+  pthread_mutex_unlock(&joblock);
+  return;
+ }
+#endif
+
+ collect(do_grep(&mainsearcher, filename), cumul);
 }
 
-/* Method of dying screaming when the Grim Memory Reaper comes to call. */
-void scram (void)
+/* Wait until every file queued up by -j has been searched and written out. */
+static void grep_wait (void)
 {
- fprintf (stderr, "%s: out of memory\n", progname);
- exit(2);
+#ifdef GREP_THREADS
+ if (!nworkers) return;
+ pthread_mutex_lock(&joblock);
+ job_flush(1);
+ pthread_mutex_unlock(&joblock);
+#endif
 }
 
-/* The meat of the program. */
-int do_grep (char *filename)
+/* Add a glob to a list, working out how it can be matched. */
+static void glob_add (struct globlist *l, char *pat)
 {
- int r, t;
- char *realname;
- char *curlin;
- int is_stdin;
- FILE *file;
- long e;
- unsigned long l, x, c, bn;
-
- l=c=0;
-
- r=1;
+ struct glob *g;
+ size_t z;
 
- is_stdin=0;
-
- /*
-  * Treat a filename of "-" as referring to stdin.
-  *
-  * Note that POSIX specifies that the file is to be treated as text in all
-  * cases (some versions will special-case a file if they think it is binary).
-  *
-  * As for the string "(standard input)", I would prefer "(stdin)", but the
-  * standard specifies exact verbiage here.
-  */
- if (*filename && strcmp(filename, "-"))
+ if (l->n==l->alloc)
  {
-  realname=filename;
-  file=fopen(filename, "rt");
-  if (!file)
-  {
-   if (!(mode&(FLAG_Q|FLAG_S))) xperror (filename);
-   return 2;
-  }
+  l->alloc=l->alloc?(l->alloc<<1):8;
+  l->g=realloc(l->g, l->alloc*sizeof(struct glob));
+  if (!l->g) scram();
  }
- else
+ g=&l->g[l->n++];
+ g->pat=pat;
+ z=strlen(pat);
+ g->len=strcspn(pat, "*?[\\");
+ if (g->len==z)
+  g->kind=GLOB_EXACT;
+ else if ((g->len==z-1)&&(pat[z-1]=='*'))
+  g->kind=GLOB_PREFIX;
+ else if ((*pat=='*')&&(strcspn(pat+1, "*?[\\")==z-1))
  {
-  is_stdin=1;
-  realname="(standard input)"; /* POSIX me harder */
-  file=stdin;
-  rewind(file);
+  g->kind=GLOB_SUFFIX;
+  g->pat++;
+  g->len=z-1;
  }
+ else
+  g->kind=GLOB_FNMATCH;
+}
 
- curlin=0;
- while (1)
+/* Does name (with no directory part) match any glob in the list? */
+static int glob_match (struct globlist *l, const char *name)
+{
+ struct glob *g;
+ size_t z;
+ int t;
+
+ z=strlen(name);
+ for (t=0; t<l->n; t++)
  {
-  l++;
-  x=0;
-  if (curlin) free (curlin);
-  e=getline(&curlin, &x, file);
-  bn=((ftell(file)+1)>>9);
-  if (e==-1)
+  g=&l->g[t];
+  switch (g->kind)
   {
-   if (!((mode&(FLAG_Q|FLAG_S))||feof(file))) xperror(realname);
-   break;
-  }
-  else
-  {
-   if (curlin[strlen(curlin)-1]=='\n') curlin[strlen(curlin)-1]=0;
-
-   /*
-    * Modes:
-    *   * fgrep: use strstr / strcasestr (-i)
-    *                !strcmp (-x) / !strcasecmp (-ix)
-    *   * otherwise: !regexec
-    *
-    * Invert the result if -v supplied (but do it differently for -l!)
-    */
-   if (mode&IS_FGREP)
-   {
-    e=0;
-
-    for (t=0; t<patstack; t++)
-    {
-     if (mode&FLAG_X)
-     {
-      if (!(((mode&FLAG_I)?strcasecmp:strcmp)(curlin, patterntable[t]))) e=1;
-     }
-     else
-     {
-      if (mode&FLAG_I)
-      {
-       if (int_strcasestr(curlin, patterntable[t])) e=1;
-      }
-      else
-      {
-       if (strstr(curlin, patterntable[t])) e=1;
-      }
-     }
-    }
-   }
-   else
-   {
-    e=0;
-
-    for (t=0; t<patstack; t++)
-     if (!regexec(&regextable[t], curlin, 0, 0, 0)) e=1;
-   }
-   if ((mode&FLAG_V)&&(!(mode&FLAG_L))) e=!e;
-
-   /*
-    * Display matching line, if appropriate.
-    * (POSIX specifies %d, but it should really be %u as this is an unsigned
-    *  value. Herp de derp.)
-    */
-   if (e)
-   {
-    c++;
-    if (r==1) r=0;
-
-    if (!(mode&(FLAG_C|FLAG_Q|FLAG_L)))
-    {
-     if (mulfil) printf ("%s:", realname);
-     if (mode&FLAG_B) printf ("%lu:", bn);
-     if (mode&FLAG_N) printf ("%lu:", l);
-     printf ("%s\n", curlin);
-    }
-   }
-
-   /*
-    * Speed optimization.
-    *
-    * This technique is documented in at least one other version:  If we are
-    * just looking for *if* a file matches, we only have to find one match to
-    * know if it does or not.  (This, regardless of the presence of the -v
-    * switch.)
-    */
-   if ((mode&FLAG_L)&&e) break;
+   case GLOB_EXACT:
+    if ((z==g->len)&&!memcmp(name, g->pat, z)) return 1;
+    break;
+   case GLOB_SUFFIX:
+    if ((z>=g->len)&&!memcmp(name+z-g->len, g->pat, g->len)) return 1;
+    break;
+   case GLOB_PREFIX:
+    if ((z>=g->len)&&!memcmp(name, g->pat, g->len)) return 1;
+    break;
+   default:
+    if (!fnmatch(g->pat, name, 0)) return 1;
   }
  }
+ return 0;
+}
 
- /* Close the file.  If stdin, just reset the stream. */
- if (is_stdin) rewind(file); else fclose(file);
+/* Should this file be searched, going by --include and --exclude? */
+static int want_file (const char *path)
+{
+ const char *base;
 
- /*
-  * If -l was set, then we did not reverse the "lines found" flag even if -v
-  * was set, so do it now.
-  */
- if (((mode&(FLAG_V|FLAG_L))==(FLAG_V|FLAG_L)) && (r<2)) r=!r;
+ base=strrchr(path, '/');
+ base=base?base+1:path;
+ if (incglobs.n&&!glob_match(&incglobs, base)) return 0;
+ return !glob_match(&excglobs, base);
+}
 
- /*
-  * For -c, display the sum total of lines found.
-  * (Behavior has been tested and matches GNU grep.)
-  */
- if (mode&FLAG_C)
+#ifndef FTW_ACTIONRETVAL
+/*
+ * Without a way to tell nftw() not to go into a directory, check each file
+ * found for a directory on its way down from the operand that is excluded.
+ */
+static int in_excluded_dir (const char *path, int base)
+{
+ char name[FILENAME_MAX];
+ const char *p, *q;
+
+ for (p=path+iterate_root; p<path+base; p=q+1)
  {
-  if (mulfil) printf ("%s:", realname);
-  printf ("%lu\n", c);
+  while (*p=='/') p++;
+  q=strchr(p, '/');
+  if ((!q)||(q>=path+base)) break;
+  if ((size_t)(q-p)>=sizeof(name)) continue;
+  memcpy(name, p, q-p);
+  name[q-p]=0;
+  if (glob_match(&dirglobs, name)) return 1;
  }
+ return 0;
+}
+#endif
 
- /*
-  * For -l, display the names of any files containing matching lines
-  * (or, with -v, no matching lines).
-  *
-  * This is the reason -lv has to be special-cased.
-  */
- if ((!r) && (mode&FLAG_L)) printf ("%s\n", realname);
+/* Is this directory operand (not found by the walk) excluded? */
+static int dir_excluded (char *filename)
+{
+ struct stat statbuf;
+ char *p;
 
- /* Return exit code. */
- return r;
+ if (stat(filename, &statbuf)||!S_ISDIR(statbuf.st_mode)) return 0;
+ p=strrchr(filename, '/');
+ return glob_match(&dirglobs, p?p+1:filename);
 }
 
 /* Used for -R.  Callback from nftw(). */
@@ -457,16 +3515,38 @@ int do_grep (char *filename)
 int iterate_hit (const char *filename, const struct stat *statptr,
                  int fileflags, struct FTW *pftw)
 {
+ /*
+  * Prune a directory excluded by --exclude-dir before it is gone into
+  * (but not the one named on the command line).
+  */
+#ifdef FTW_ACTIONRETVAL
+ if ((fileflags == FTW_D) && pftw->level &&
+     glob_match(&dirglobs, filename+pftw->base))
+  return FTW_SKIP_SUBTREE;
+#endif
+
  if (fileflags == FTW_F)
  {
-  int r;
-
   /* Mark we found something. */
   go_fish=0;
+
+#ifndef FTW_ACTIONRETVAL
+  if (dirglobs.n && in_excluded_dir(filename, pftw->base)) return 0;
+#endif
+  if (!want_file(filename)) return 0;
+
+  /* Until a file is searched, the answer is "no match". */
+  if (none_searched)
+  {
+   none_searched=0;
+   grep_iterative_cumul=0;
+  }
   
-  /* Do the grep and mark if there was an error. */
-  r=do_grep((char *)filename);
-  if (r>grep_iterative_cumul) grep_iterative_cumul=r;
+  /* Do the grep and mark if there was an error (or index the file). */
+  if (makeindex)
+   idx_add(filename, statptr);
+  else
+   grep_file((char *)filename, &grep_iterative_cumul);
  }
 
  return 0;
@@ -476,14 +3556,38 @@ int iterate_hit (const char *filename, const struct stat *statptr,
 /* Used for -R.  Handles iteration into folders. */
 int iterative_grep (char *filename, int flags)
 {
+ int e;
+
  grep_iterative_cumul=0;
  
  /* stdin pseudofile. */
- if (!strcmp(filename, "-")) return do_grep(filename);
+ if (!strcmp(filename, "-"))
+ {
+  grep_file(filename, &grep_iterative_cumul);
+  grep_wait();
+  return grep_iterative_cumul;
+ }
 
- /* Set default to "we didn't find anything", then start searching. */
+ /*
+  * Set default to "we didn't find anything", then start searching.
+  * The files under this operand all have to be searched before we can say
+  * how it went.  If every file is left out by --include and the like, none
+  * was searched and none matched.
+  */
  go_fish=1;
- if (nftw(filename, iterate_hit, ITERATE_MAX_HANDLES, flags)==-1)
+ none_searched=1;
+ grep_iterative_cumul=1;
+ iterate_root=strlen(filename);
+
+ /* As in GNU grep, --exclude-dir also applies to a directory named here. */
+ if (dirglobs.n&&dir_excluded(filename)) return 1;
+
+#ifdef FTW_ACTIONRETVAL
+ if (dirglobs.n) flags|=FTW_ACTIONRETVAL;
+#endif
+ e=nftw(filename, iterate_hit, ITERATE_MAX_HANDLES, flags);
+ grep_wait();
+ if (e==-1)
  {
   xperror(filename);
   return 2;
@@ -508,17 +3612,25 @@ void usage (void)
 {
  if (!(mode&(IS_EGREP|IS_FGREP)))
  {
-  fprintf(stderr, "%s: usage: %s [-E|-F] [-c|-l|-q] [-HRbhinrsvx] pattern [file ...]\n"
-                  "%s: usage: %s [-E|-F] [-c|-l|-q] [-HRbhinrsvx]\n"
-                  "                  {-e pattern | -f patternfile} [...] [file ...]\n",
-                  progname, progname, progname, progname);
+  fprintf(stderr, "%s: usage: %s [-E|-F] [-c|-l|-q] [-HIRabhinrsvxz] [-j jobs] [-m num] pattern [file ...]\n"
+                  "%s: usage: %s [-E|-F] [-c|-l|-q] [-HIRabhinrsvxz] [-j jobs] [-m num]\n"
+                  "                  [--include=glob] [--exclude=glob] [--exclude-dir=glob]\n"
+                  "                  [--index=file] [--debug-regex] [--regex-steps=num]\n"
+                  "                  {-e pattern | -f patternfile} [...] [file ...]\n"
+                  "%s: usage: %s --make-index=file [-R|-r] [-s] [--include=glob] [--exclude=glob]\n"
+                  "                  [--exclude-dir=glob] [file ...]\n",
+                  progname, progname, progname, progname, progname, progname);
  }
  else
  {
-  fprintf(stderr, "%s: usage: %s [-c|-l|-q] [-HRbhinrsvx] pattern [file ...]\n"
-                  "%s: usage: %s [-c|-l|-q] [-HRbhinrsvx]\n"
-                  "                    {-e pattern | -f patternfile} [...] [file ...]\n",
-                  progname, progname, progname, progname);
+  fprintf(stderr, "%s: usage: %s [-c|-l|-q] [-HIRabhinrsvxz] [-j jobs] [-m num] pattern [file ...]\n"
+                  "%s: usage: %s [-c|-l|-q] [-HIRabhinrsvxz] [-j jobs] [-m num]\n"
+                  "                    [--include=glob] [--exclude=glob] [--exclude-dir=glob]\n"
+                  "                    [--index=file] [--debug-regex] [--regex-steps=num]\n"
+                  "                    {-e pattern | -f patternfile} [...] [file ...]\n"
+                  "%s: usage: %s --make-index=file [-R|-r] [-s] [--include=glob] [--exclude=glob]\n"
+                  "                    [--exclude-dir=glob] [file ...]\n",
+                  progname, progname, progname, progname, progname, progname);
  }
  exit(2);
 }
@@ -530,6 +3642,122 @@ void exclusive (char *args)
  exit(2);
 }
 
+/* -m: stop after this many lines selected in a file. */
+void set_max (char *arg)
+{
+ char *e;
+
+ if ((*arg<'0')||(*arg>'9')) usage();
+ maxcount=strtoul(arg, &e, 10);
+ if (*e) usage();
+ mode |= FLAG_M;
+}
+
+/* --regex-steps: the step limit for each regex (0 for none). */
+void set_steps (char *arg)
+{
+ char *e;
+
+ if ((*arg<'0')||(*arg>'9')) usage();
+ regexsteps=strtoul(arg, &e, 10);
+ if (*e) usage();
+#ifndef REGLIMIT
+ if (regexsteps)
+  fprintf (stderr, "%s: --regex-steps needs the bundled regex library; "
+                   "ignored\n", progname);
+#endif
+}
+
+/*
+ * Take the long options (--include, --exclude, --exclude-dir and
+ * --max-count, as in GNU grep, and --index, --make-index, --debug-regex and
+ * --regex-steps) out of the command line, so that getopt() only sees the rest.
+ * Their argument (--debug-regex has none) can be joined on with = or be the
+ * next argument.  Care is
+ * taken not to mistake the argument to -e, -f or -j for one, and nothing
+ * after "--" is touched.  Return the new argc.
+ */
+int long_opts (int argc, char **argv)
+{
+ struct globlist *l;
+ char *a, *v, **sv;
+ void (*nv)(char *);
+ int i, o;
+ size_t z;
+
+ for (i=o=1; i<argc; i++)
+ {
+  a=argv[i];
+  if (!strcmp(a, "--"))
+  {
+   while (i<argc) argv[o++]=argv[i++];
+   break;
+  }
+
+  if ((a[0]=='-')&&(a[1]=='-'))
+  {
+   a+=2;
+   z=strcspn(a, "=");
+   l=0;
+   sv=0;
+   nv=set_max;
+   if ((z==7)&&!strncmp(a, "include", z))
+    l=&incglobs;
+   else if ((z==7)&&!strncmp(a, "exclude", z))
+    l=&excglobs;
+   else if ((z==11)&&!strncmp(a, "exclude-dir", z))
+    l=&dirglobs;
+   else if ((z==9)&&!strncmp(a, "max-count", z))
+    ;
+   else if ((z==11)&&!strncmp(a, "regex-steps", z))
+    nv=set_steps;
+   else if ((z==5)&&!strncmp(a, "index", z))
+    sv=&useindex;
+   else if ((z==10)&&!strncmp(a, "make-index", z))
+    sv=&makeindex;
+   else if ((z==11)&&!strncmp(a, "debug-regex", z)&&!a[z])
+   {
+#ifndef REGSTATS
+    if (!debugregex)
+     fprintf (stderr, "%s: --debug-regex needs the bundled regex library; "
+                      "ignored\n", progname);
+#endif
+    debugregex=1;
+    continue;
+   }
+   else
+    usage();
+   if (a[z])
+    v=a+z+1;
+   else
+   {
+    if (++i==argc) usage();
+    v=argv[i];
+   }
+   if (l)
+    glob_add(l, v);
+   else if (sv)
+    *sv=v;
+   else
+    nv(v);
+   continue;
+  }
+
+  argv[o++]=a;
+  if ((a[0]=='-')&&a[1])
+  {
+   for (a++; *a; a++)
+    if (strchr("efjm", *a))
+    {
+     if ((!a[1])&&(i+1<argc)) argv[o++]=argv[++i];
+     break;
+    }
+  }
+ }
+ argv[o]=0;
+ return o;
+}
+
 /*
  * Entry point.
  * Resolve the command line, and act accordingly.
@@ -537,8 +3765,9 @@ void exclusive (char *args)
 int main (int argc, char **argv)
 {
  int e, r, t;
+ size_t l;
 
- mulfil=mode=usagemode=patstack=0;
+ mulfil=mode=usagemode=patstack=nregex=0;
 
  /*
   * Find whether we were invoked as "egrep" or "fgrep".
@@ -557,7 +3786,8 @@ int main (int argc, char **argv)
   * If conflicting options are specified, die screaming.
   * If -E or -F is specified when in egrep/fgrep mode, die screaming.
   */
- while (-1!=(e=getopt(argc, argv, "EFHLRbce:f:hlinqrsvx")))
+ argc=long_opts(argc, argv);
+ while (-1!=(e=getopt(argc, argv, "EFHILRabce:f:hj:linm:qrsvxz")))
  {
   switch (e)
   {
@@ -577,6 +3807,10 @@ int main (int argc, char **argv)
     if (mulfil) exclusive("-H and -h");
     mulfil = MULFIL_FY;
     break;
+   case 'I':
+    mode |= FLAG_SKIP;
+    if ((mode&(FLAG_A|FLAG_SKIP))==(FLAG_A|FLAG_SKIP)) exclusive("-I and -a");
+    break;
    case 'L':
     mode |= (FLAG_L|FLAG_V);
     if ((mode&(FLAG_C|FLAG_L|FLAG_Q))!=FLAG_L) exclusive("-c, -l and -q");
@@ -585,6 +3819,10 @@ int main (int argc, char **argv)
     mulfil = MULFIL_FY;
     mode |= FLAG_R_L;
     break;
+   case 'a':
+    mode |= FLAG_A;
+    if ((mode&(FLAG_A|FLAG_SKIP))==(FLAG_A|FLAG_SKIP)) exclusive("-I and -a");
+    break;
    case 'b':
     mode |= FLAG_B;
     break;
@@ -593,69 +3831,31 @@ int main (int argc, char **argv)
     if ((mode&(FLAG_C|FLAG_L|FLAG_Q))!=FLAG_C) exclusive("-c, -l and -q");
     break;
    case 'e':
-    patterntable[patstack]=strdup(optarg);
-    if (!patterntable[patstack]) scram();
-    patstack++;
-    if (patstack>=PATTERN_STACK) scram();
+    l=strlen(optarg);
+    pat_add(strcpy(pat_alloc(l+1), optarg), l);
     break;
    case 'f':
-   {
-    FILE *file;
-
-    nulpat=1;
-
-    file=fopen(optarg, "rt");
-    if (!file)
-    {
-     xperror(optarg);
-     return 2;
-    }
-
-    while (1)
+    switch (pat_file(optarg))
     {
-     size_t l;
-     ssize_t n;
-
-     n=getline(&(patterntable[patstack]), &l, file);
-     if (n<0)
-     {
-      fclose(file);
-      
-      /*
-       * Also sprach Posix:
-       *   "A null pattern can be specified by an empty line in pattern_file"
-       * 
-       * Also sprach Posix:
-       *   "the pattern_file's contents shall consist of one or more patterns
-       *    terminated by a <newline> character"
-       * 
-       * NetBSD says "the behaviour of the -f flag when using an empty pattern
-       * file is left undefined", but the standard does say "one or more", and
-       * zero isn't "one or more", so I would argue that zero lines in the
-       * pattern file is an error condition.
-       */
-      if (nulpat)
-      {
-       fprintf (stderr, "%s: %s: empty pattern file\n", progname, optarg);
-       return 2;
-      }
-      break;
-     }
-     nulpat=0;
-     
-     /* Strip off the newline. */
-     if (patterntable[patstack][strlen(patterntable[patstack])-1]=='\n')
-      patterntable[patstack][strlen(patterntable[patstack])-1]=0;
-     
-     patstack++;
-     if (patstack>=PATTERN_STACK) scram();
+     case 1:
+      xperror(optarg);
+      return 2;
+     case 2:
+      fprintf (stderr, "%s: %s: empty pattern file\n", progname, optarg);
+      return 2;
     }
     break;
-   }
    case 'h':
     if (mulfil) exclusive("-H and -h");
     mulfil = MULFIL_FN;
     break;
+   case 'j':
+    t=atoi(optarg);
+    if (t<1) usage();
+#ifdef GREP_THREADS
+    nworkers=(t>1)?t:0;
+#endif
+    break;
    case 'l':
     mode |= FLAG_L;
     if ((mode&(FLAG_C|FLAG_L|FLAG_Q))!=FLAG_L) exclusive("-c, -l and -q");
@@ -663,6 +3863,9 @@ int main (int argc, char **argv)
    case 'i':
     mode |= FLAG_I;
     break;
+   case 'm':
+    set_max(optarg);
+    break;
    case 'n':
     mode |= FLAG_N;
     break;
@@ -683,6 +3886,14 @@ int main (int argc, char **argv)
    case 'x':
     mode |= FLAG_X;
     break;
+   case 'z':
+#ifdef GREP_ZLIB
+    mode |= FLAG_Z;
+#else
+    fprintf (stderr, "%s: -z: not supported on this system\n", progname);
+    return 2;
+#endif
+    break;
    default:
     usage();
   }
@@ -690,6 +3901,28 @@ int main (int argc, char **argv)
 
  if ((mode&(FLAG_R_L|FLAG_R_P))==(FLAG_R_L|FLAG_R_P)) exclusive ("-r and -R");
 
+ /*
+  * --make-index takes no pattern: walk the files named (as -r would, by
+  * default) and write the index out.
+  */
+ if (makeindex)
+ {
+  if (useindex) exclusive("--index and --make-index");
+  if (!(mode&FLAG_R_L)) mode |= FLAG_R_P;
+  e=(mode&FLAG_R_P)?FTW_PHYS:0;
+  ixstart=time(0);
+  if (argc==optind)
+  {
+   if (iterative_grep(".", e)==2) ixstatus=2;
+  }
+  else for (t=optind; t<argc; t++)
+  {
+   if (strcmp(argv[t], "-")&&(iterative_grep(argv[t], e)==2)) ixstatus=2;
+  }
+  e=idx_write(makeindex);
+  return e?e:ixstatus;
+ }
+
  /*
   * No -e or -f switches were supplied, so treat the next argument as if it
   * were passed to -e.  If there is no next argument, die screaming.
@@ -697,9 +3930,8 @@ int main (int argc, char **argv)
  if (!patstack)
  {
   if (argc==optind) usage();
-  patterntable[0]=strdup(argv[optind++]);
-  if (!patterntable[0]) scram();
-  patstack=1;
+  pat_add(argv[optind], strlen(argv[optind]));
+  optind++;
  }
 
  /*
@@ -716,35 +3948,58 @@ int main (int argc, char **argv)
   {
    if (t>=patstack) break;
 
-   for (e=0; ; e++)
+   for (l=0; l<patternlen[t]; l++)
    {
-    if (!patterntable[t][e]) break;
-
-    if ((patterntable[t][e]=='|')||(patterntable[t][e]=='\n'))
+    if ((patterntable[t][l]=='|')||(patterntable[t][l]=='\n'))
     {
-     char *p;
-
-     p=&(patterntable[t][e]);
-     *(p++)=0;
-     if (patstack>=PATTERN_STACK) scram();
-     patterntable[patstack]=strdup(p);
-     patstack++;
+     patterntable[t][l]=0;
+     pat_add(patterntable[t]+l+1, patternlen[t]-(l+1));
+     patternlen[t]=l;
     }
    }
   }
+
+  /* For -i, fold the patterns once here so that only the text needs it. */
+  for (t=0; t<256; t++) foldtab[t]=tolower(t);
+  for (t=0; t<patstack; t++)
+  {
+   if (mode&FLAG_I)
+    for (e=0; patterntable[t][e]; e++)
+     patterntable[t][e]=foldtab[(unsigned char)patterntable[t][e]];
+  }
+
+  /*
+   * Several patterns are searched for all at once.  (Not with -x, where the
+   * whole line is compared anyway; and an empty pattern matches every line,
+   * so there is nothing to search for.)
+   */
+  for (t=0; t<patstack; t++)
+   if (!patternlen[t]) break;
+  if ((patstack>1)&&(!(mode&FLAG_X))&&(t==patstack)) ac_build();
+  if ((patstack==1)&&(!(mode&FLAG_X))) litsearch=pick_memmem();
+  if ((patstack>1)&&(mode&FLAG_X)) xset_build();
  }
  else
  {
+  regextable=malloc(patstack*sizeof(regex_t));
+  if (!regextable) scram();
+  reflags=((mode&FLAG_I)?REG_ICASE:0)|REG_NEWLINE;
+#ifdef REG_UTF8
+  if (utf8_locale()) reflags|=REG_UTF8;
+#endif
   for (t=0; t<patstack; t++)
   {
    /*
     * Precompile the regexs, taking note of any flags we were passed that
     * might affect the compilation.  REG_EXTENDED here is the only difference
     * between running in grep(1) mode and running in egrep(1) mode.
+    *
+    * REG_NEWLINE lets the scanning engine hand the regex a whole block of
+    * lines at once.  We do want to know where the match is, for -x.
+    * REG_UTF8 makes . and bracket expressions match whole characters.
     */
    e=regcomp(&regextable[t], patterntable[t], ((mode&IS_EGREP)?REG_EXTENDED:0)
-                                             |((mode&FLAG_I)?REG_ICASE:0)
-                                             |((mode&FLAG_X)?REG_NOSUB:0));
+                                             |reflags);
    /*
     * Die screaming if the regex precompilation failed.
     *
@@ -765,8 +4020,30 @@ int main (int argc, char **argv)
     free(es);
     return 2;
    }
+   nregex++;
   }
+  if (nregex>1) combine_regex();
+#ifdef REGLIMIT
+  if (regexsteps)
+   for (t=0; t<nregex; t++) reglimit(&regextable[t], regexsteps);
+#endif
+ }
+ mainsearcher.regextable=regextable;
+ mainsearcher.hitcache=malloc(patstack*sizeof(char *));
+ if (!mainsearcher.hitcache) scram();
+#ifdef REGSCRATCH
+ scratch_init(&mainsearcher);
+#endif
+#ifdef REGSTATS
+ if (debugregex)
+ {
+  regtotals=calloc(patstack, sizeof(struct regstats));
+  if (!regtotals) scram();
  }
+#endif
+
+ /* With --index, work out which files need to be looked at at all. */
+ if (useindex&&!(mode&(FLAG_V|FLAG_Z))&&idx_query()) return 2;
 
  /*
   * Multifile mode: prefix appropriate lines with filenames.
@@ -781,38 +4058,35 @@ int main (int argc, char **argv)
   * Execute the actual grep operation, and aggregate our return code.
   *
   * If no file was specified, use stdin; else iterate over files specified.
-  * Exit priority is 0>2>1 with -q; 2>0>1 without (as per POSIX).
+  * With -j, the files are handed out to the workers as they are found, and
+  * their output is written in the order they were found.
   */
- r=1;
+#ifdef GREP_THREADS
+ if (nworkers) start_workers(nworkers);
+#endif
+ grep_status=1;
  if (argc==optind)
  {
   if (mode&FLAG_R_P)
-   r=iterative_grep(".", FTW_PHYS);
+   grep_status=iterative_grep(".", FTW_PHYS);
   else if (mode&FLAG_R_L)
-   r=iterative_grep(".", 0);
+   grep_status=iterative_grep(".", 0);
   else
-   r=do_grep("-");
+   grep_status=do_grep(&mainsearcher, "-");
  }
  else for (t=optind; t<argc; t++)
  {
   if (mode&FLAG_R_P)
-   e=iterative_grep(argv[optind], FTW_PHYS);
+   tally(iterative_grep(argv[t], FTW_PHYS));
   else if (mode&FLAG_R_L)
-   e=iterative_grep(argv[optind], 0);
-  else
-   e=do_grep(argv[optind]);
-  if (mode&FLAG_Q)
-  {
-   if (!e) r=0;
-  }
-  else
-  {
-   if ((!e)&&(r==1))
-    r=0;
-   else
-    if (e>r) r=e;
-  }
+   tally(iterative_grep(argv[t], 0));
+  else if ((!strcmp(argv[t], "-"))||want_file(argv[t]))
+   grep_file(argv[t], 0);
  }
+#ifdef GREP_THREADS
+ if (nworkers) stop_workers();
+#endif
+ r=grep_status;
 
  /*
   * Free dynamically allocated memory.
@@ -821,11 +4095,36 @@ int main (int argc, char **argv)
   * table BEFORE we execute, since we have already compiled it into a regex
   * table.  Are we bothered, though?
   */
- while (patstack)
+#ifdef REGSCRATCH
+ scratch_free(&mainsearcher);
+#endif
+#ifdef REGSTATS
+ if (regtotals)
+ {
+  stats_report();
+  free(regtotals);
+ }
+#endif
+ while (nregex) regfree(&regextable[--nregex]);
+ while (patblocks)
  {
-  free(patterntable[--patstack]);
-  if (!(mode&IS_FGREP)) regfree(&regextable[patstack]);
+  struct patblock *b;
+
+  b=patblocks->next;
+  free(patblocks);
+  patblocks=b;
  }
+ free(patterntable);
+ free(patternlen);
+ free(regextable);
+ free(regexall);
+ free(mainsearcher.buf);
+ free(mainsearcher.hitcache);
+#ifdef GREP_ZLIB
+ gz_free(&mainsearcher);
+#endif
+ free(ixcand);
+ if (ixmap) munmap(ixmap, ixmaplen);
 
  /* Return exit code. */
  return r;
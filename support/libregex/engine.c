@@ -49,8 +49,12 @@
 #define	matcher	smatcher
 #define	fast	sfast
 #define	slow	sslow
+#define	leftmost	sleftmost
 #define	dissect	sdissect
 #define	backref	sbackref
+#define	backstep	sbackstep
+#define	memokey	smemokey
+#define	dfaslot	sdfa
 #define	step	sstep
 #define	print	sprint
 #define	at	sat
@@ -61,8 +65,12 @@
 #define	matcher	lmatcher
 #define	fast	lfast
 #define	slow	lslow
+#define	leftmost	lleftmost
 #define	dissect	ldissect
 #define	backref	lbackref
+#define	backstep	lbackstep
+#define	memokey	lmemokey
+#define	dfaslot	ldfa
 #define	step	lstep
 #define	print	lprint
 #define	at	lat
@@ -70,6 +78,502 @@
 #define	nope	lnope
 #endif
 
+#ifndef DFADONE
+#define	DFADONE		/* never again */
+/*
+ * fast() keeps a lazily built DFA.  A DFA state is a set of NFA states
+ * plus what matters about the character before it; its transitions are
+ * indexed by byte class (see classify() in regcomp.c) and are filled in
+ * the first time step() has to work one out.  The states live in one
+ * block, addressed by offset so that the block can be realloc()ed, each
+ * being a struct dstate, then next[nclasses], then the NFA set.  When the
+ * block reaches DFAMEM the cache is flushed and starts over; if that keeps
+ * happening, fast() stops caching and just steps.
+ */
+struct dstate {
+	unsigned int hnext;	/* next state on the hash chain, or 0 */
+	unsigned int hv;	/* hash value */
+	unsigned char ctx;	/* DC_* bits for the character before */
+	unsigned char fresh;	/* the NFA set is the fresh-start one */
+	unsigned int next[1];	/* [nclasses]: DNONE, DMATCH, or a state */
+};
+#define	DNONE	0		/* transition not known yet */
+#define	DMATCH	1		/* a match ends before this character */
+#define	DC_OUT	01		/* before the start of the string */
+#define	DC_BOL	02		/* a line can begin after it */
+#define	DC_WORD	04		/* a word character */
+
+struct dfa {
+	char *mem;		/* the states */
+	size_t used;		/* bytes of mem in use */
+	size_t size;		/* bytes of mem allocated */
+	size_t ssize;		/* bytes per state */
+	size_t setoff;		/* where a state's NFA set starts */
+	size_t setsize;		/* bytes in an NFA set */
+	size_t nclasses;	/* copy of g->nclasses */
+	unsigned int *hash;	/* hash chain heads */
+	size_t nhash;		/* slots in hash, a power of 2 */
+	size_t nstates;		/* states in the cache */
+	int flushes;		/* times the cache has been flushed */
+};
+#define	DSTATE(d, o)	((struct dstate *)((d)->mem + (o)))
+#define	DSET(d, ds)	((char *)(ds) + (d)->setoff)
+#define	DFIRST	((size_t)8)	/* offset of the first state */
+#define	DFAMINLEN	64	/* shorter strings are just stepped through */
+#define	DFAMEM	((size_t)1 << 20)	/* most memory one cache may use */
+#define	DFAFLUSHES	8	/* flushes before giving up on caching */
+
+/*
+ * backref() remembers where it has failed.  Whether it can get from a
+ * given sop at a given place in the string to the end depends only on
+ * what it has recorded on the way there:  the subexpression offsets,
+ * for back references further on, and where the current pass of each
+ * enclosing + began, for the null-pass check.  A key is all of those
+ * (see memokey()); a second visit with the same key fails without
+ * looking.  Entries are a chain link (entry number + 1, or 0) and then
+ * the key.  Once the block reaches BMEMOMEM, each new entry takes the
+ * place of one picked at random.  Some REs need room for a good many
+ * keys per character of the string, so that can happen.  Emptying the
+ * memo would start the search over, and so would forgetting the oldest
+ * entries first, since the search comes back to them in the same order
+ * it made them; losing a random few costs only a little work over again.
+ * reglimit() is the real bound on the work.
+ */
+struct bmemo {
+	regoff_t *mem;		/* the entries */
+	size_t klen;		/* regoff_ts in a key */
+	size_t used;		/* entries in use */
+	size_t size;		/* entries allocated */
+	unsigned long rnd;	/* picks the entry to replace when full */
+	size_t *hash;		/* chain heads, entry number + 1 */
+	size_t nhash;		/* slots in hash, a power of 2 */
+	regoff_t *key;		/* [klen], the key being looked for */
+};
+#define	BMENTRY(b, e)	((b)->mem + (e)*((b)->klen + 1))
+#define	BMEMOMEM	((size_t)1 << 24)	/* most memory one memo may use */
+
+/*
+ * What matcher() allocates, kept between calls by the caller.  Everything
+ * in it is sized by the RE alone, so a scratch context belongs to one RE;
+ * the DFA caches are kept too, one for each state representation, and
+ * carry over from call to call.  The RE itself is never written.
+ */
+struct re_scratch {
+	const struct re_guts *g;	/* the RE this is for */
+	regmatch_t *pmatch;	/* [nsub+1] */
+	const char **lastpos;	/* [nplus+1] */
+	const char **pst;	/* [2*nstates] */
+	unsigned long *space;	/* large state vectors */
+	struct dfa *sdfa;	/* small fast()'s DFA cache */
+	struct dfa *ldfa;	/* large fast()'s DFA cache */
+	struct bmemo *memo;	/* backref()'s memo, emptied between calls */
+	struct regstats stats;	/* for regstats() */
+};
+
+static struct dfa *dfainit(struct re_guts *g, size_t setsize);
+static void dfaflush(struct dfa *d);
+static void dfafree(struct dfa *d);
+static unsigned int dfastate(struct dfa *d, const char *set, int ctx, int fresh);
+static int dfactx(struct re_guts *g, int eflags, int c);
+static const char *memfind(const char *start, const char *stop, const struct mustlit *ml);
+static struct bmemo *bminit(size_t klen);
+static void bmflush(struct bmemo *b);
+static void bmfree(struct bmemo *b);
+static unsigned long bmhash(const struct bmemo *b, const regoff_t *key);
+static int bmfind(const struct bmemo *b);
+static void bmadd(struct bmemo *b);
+static void bmunlink(struct bmemo *b, size_t e);
+
+/*
+ - dfainit - set up a DFA cache
+ == static struct dfa *dfainit(struct re_guts *g, size_t setsize);
+ */
+static struct dfa *		/* NULL if no memory or not worth it */
+dfainit(
+    struct re_guts *g,
+    size_t setsize)		/* bytes in an NFA set */
+{
+	struct dfa *d;
+	size_t setoff = offsetof(struct dstate, next) +
+					g->nclasses*sizeof(unsigned int);
+	size_t ssize = (setoff + setsize + DFIRST - 1) & ~(DFIRST - 1);
+
+	if (DFIRST + 4*ssize > DFAMEM)	/* too few states would fit */
+		return(NULL);
+	d = malloc(sizeof(struct dfa));
+	if (d == NULL)
+		return(NULL);
+	d->setoff = setoff;
+	d->setsize = setsize;
+	d->ssize = ssize;
+	d->nclasses = g->nclasses;
+	d->size = DFIRST + 16*d->ssize;
+	d->nhash = 64;
+	d->flushes = 0;
+	d->mem = NULL;
+	d->hash = NULL;
+	if (d->size > DFAMEM)
+		d->size = DFAMEM;
+	d->mem = malloc(d->size);
+	d->hash = malloc(d->nhash*sizeof(unsigned int));
+	if (d->mem == NULL || d->hash == NULL) {
+		dfafree(d);
+		return(NULL);
+	}
+	dfaflush(d);
+	return(d);
+}
+
+/*
+ - dfaflush - empty a DFA cache
+ == static void dfaflush(struct dfa *d);
+ */
+static void
+dfaflush(
+    struct dfa *d)
+{
+	size_t i;
+
+	d->used = DFIRST;
+	d->nstates = 0;
+	for (i = 0; i < d->nhash; i++)
+		d->hash[i] = 0;
+}
+
+/*
+ - dfafree - release a DFA cache
+ == static void dfafree(struct dfa *d);
+ */
+static void
+dfafree(
+    struct dfa *d)
+{
+	if (d == NULL)
+		return;
+	free(d->mem);
+	free(d->hash);
+	free(d);
+}
+
+/*
+ - dfastate - find or add the DFA state for an NFA set and context
+ == static unsigned int dfastate(struct dfa *d, const char *set, int ctx, \
+ ==	int fresh);
+ *
+ * Adding a state may flush the cache, after which offsets into it that
+ * the caller is holding are no good; d->flushes says whether it did.
+ */
+static unsigned int		/* the state, or 0 if giving up on caching */
+dfastate(
+    struct dfa *d,
+    const char *set,
+    int ctx,
+    int fresh)			/* set is the fresh-start set */
+{
+	unsigned long h;
+	unsigned int o;
+	unsigned int *nh;
+	struct dstate *ds;
+	size_t i;
+	size_t n;
+	char *nm;
+
+	h = 2166136261UL;	/* FNV-1a */
+	for (i = 0; i < d->setsize; i++)
+		h = ((h ^ (uch)set[i]) * 16777619UL) & 0xffffffffUL;
+	h = ((h ^ (unsigned long)ctx) * 16777619UL) & 0xffffffffUL;
+
+	for (o = d->hash[h & (d->nhash - 1)]; o != 0; o = ds->hnext) {
+		ds = DSTATE(d, o);
+		if (ds->hv == (unsigned int)h && ds->ctx == ctx &&
+				memcmp(DSET(d, ds), set, d->setsize) == 0)
+			return(o);
+	}
+
+	/* a new one; make room */
+	if (d->used + d->ssize > d->size) {
+		n = (d->size < DFAMEM/2) ? d->size*2 : DFAMEM;
+		nm = (n > d->size) ? realloc(d->mem, n) : NULL;
+		if (nm != NULL) {
+			d->mem = nm;
+			d->size = n;
+		}
+		if (d->used + d->ssize > d->size) {
+			if (++d->flushes > DFAFLUSHES)
+				return(0);
+			dfaflush(d);
+		}
+	}
+	if (d->nstates >= d->nhash) {
+		nh = realloc(d->hash, 2*d->nhash*sizeof(unsigned int));
+		if (nh != NULL) {
+			d->hash = nh;
+			d->nhash *= 2;
+			for (i = 0; i < d->nhash; i++)
+				d->hash[i] = 0;
+			for (i = DFIRST; i < d->used; i += d->ssize) {
+				ds = DSTATE(d, i);
+				ds->hnext = d->hash[ds->hv & (d->nhash - 1)];
+				d->hash[ds->hv & (d->nhash - 1)] = (unsigned int)i;
+			}
+		}
+	}
+
+	o = (unsigned int)d->used;
+	d->used += d->ssize;
+	d->nstates++;
+	ds = DSTATE(d, o);
+	ds->hv = (unsigned int)h;
+	ds->ctx = (unsigned char)ctx;
+	ds->fresh = (unsigned char)fresh;
+	for (i = 0; i < d->nclasses; i++)
+		ds->next[i] = DNONE;
+	(void) memcpy(DSET(d, ds), set, d->setsize);
+	ds->hnext = d->hash[h & (d->nhash - 1)];
+	d->hash[h & (d->nhash - 1)] = o;
+	return(o);
+}
+
+/*
+ - dfactx - DC_* bits for a character, as far as the RE cares
+ == static int dfactx(struct re_guts *g, int eflags, int c);
+ */
+static int
+dfactx(
+    struct re_guts *g,
+    int eflags,
+    int c)			/* character or OUT */
+{
+	int ctx = 0;
+
+	if ((c == '\n' && (g->cflags&REG_NEWLINE)) ||
+				(c == OUT && !(eflags&REG_NOTBOL)))
+		ctx |= DC_BOL;
+	if (g->iflags&USEWORD) {
+		if (c == OUT)
+			ctx |= DC_OUT;
+		else if (ISWORD(c))
+			ctx |= DC_WORD;
+	} else if (g->nbol == 0)
+		ctx = 0;
+	return(ctx);
+}
+
+/*
+ - memfind - find a must literal in a string
+ == static const char *memfind(const char *start, const char *stop, \
+ ==	const struct mustlit *ml);
+ *
+ * memchr() for the guard byte does most of the work; C libraries go to
+ * some trouble to make it fast.
+ */
+static const char *		/* where it starts, or NULL */
+memfind(
+    const char *start,
+    const char *stop,
+    const struct mustlit *ml)
+{
+	const char *dp;
+	const char *last;	/* last place the guard byte can be */
+	char gc = ml->s[ml->guard];
+
+	if ((size_t)(stop - start) < ml->len)
+		return(NULL);
+	last = stop - ml->len + ml->guard;
+	for (dp = start + ml->guard; dp <= last; dp++) {
+		dp = memchr(dp, gc, (size_t)(last - dp) + 1);
+		if (dp == NULL)
+			break;
+		if (memcmp(dp - ml->guard, ml->s, ml->len) == 0)
+			return(dp - ml->guard);
+	}
+	return(NULL);
+}
+
+/*
+ - bminit - set up a failure memo for keys of klen offsets
+ == static struct bmemo *bminit(size_t klen);
+ */
+static struct bmemo *		/* NULL if no memory or not worth it */
+bminit(
+    size_t klen)
+{
+	struct bmemo *b;
+	size_t esize = (klen + 1)*sizeof(regoff_t);
+
+	if (64*esize > BMEMOMEM)	/* too few entries would fit */
+		return(NULL);
+	b = malloc(sizeof(struct bmemo));
+	if (b == NULL)
+		return(NULL);
+	b->klen = klen;
+	b->size = 64;
+	b->nhash = 64;
+	b->mem = malloc(b->size*esize);
+	b->hash = malloc(b->nhash*sizeof(size_t));
+	b->key = malloc(klen*sizeof(regoff_t));
+	if (b->mem == NULL || b->hash == NULL || b->key == NULL) {
+		bmfree(b);
+		return(NULL);
+	}
+	bmflush(b);
+	return(b);
+}
+
+/*
+ - bmflush - empty a failure memo
+ == static void bmflush(struct bmemo *b);
+ */
+static void
+bmflush(
+    struct bmemo *b)
+{
+	size_t i;
+
+	b->used = 0;
+	b->rnd = 1;
+	for (i = 0; i < b->nhash; i++)
+		b->hash[i] = 0;
+}
+
+/*
+ - bmfree - release a failure memo
+ == static void bmfree(struct bmemo *b);
+ */
+static void
+bmfree(
+    struct bmemo *b)
+{
+	if (b == NULL)
+		return;
+	free(b->mem);
+	free(b->hash);
+	free(b->key);
+	free(b);
+}
+
+/*
+ - bmhash - hash a key
+ == static unsigned long bmhash(const struct bmemo *b, const regoff_t *key);
+ */
+static unsigned long
+bmhash(
+    const struct bmemo *b,
+    const regoff_t *key)
+{
+	unsigned long h = 2166136261UL;		/* FNV-1a, a word at a time */
+	size_t i;
+
+	for (i = 0; i < b->klen; i++)
+		h = ((h ^ (unsigned long)key[i]) * 16777619UL) & 0xffffffffUL;
+	return(h);
+}
+
+/*
+ - bmfind - is b->key in the memo?
+ == static int bmfind(const struct bmemo *b);
+ */
+static int
+bmfind(
+    const struct bmemo *b)
+{
+	size_t e;
+	regoff_t *ep;
+
+	for (e = b->hash[bmhash(b, b->key) & (b->nhash - 1)]; e != 0;
+							e = (size_t)ep[0]) {
+		ep = BMENTRY(b, e - 1);
+		if (memcmp(ep + 1, b->key, b->klen*sizeof(regoff_t)) == 0)
+			return(1);
+	}
+	return(0);
+}
+
+/*
+ - bmadd - add b->key to the memo
+ == static void bmadd(struct bmemo *b);
+ *
+ * Failing to make room just means forgetting; it is only a memo.  With
+ * no more room to be had, an entry picked at random is forgotten.
+ */
+static void
+bmadd(
+    struct bmemo *b)
+{
+	size_t esize = (b->klen + 1)*sizeof(regoff_t);
+	size_t n;
+	size_t e;
+	size_t h;
+	size_t *nh;
+	regoff_t *nm;
+	regoff_t *ep;
+
+	if (b->used == b->size) {
+		n = (2*b->size*esize <= BMEMOMEM) ? 2*b->size : BMEMOMEM/esize;
+		nm = (n > b->size) ? realloc(b->mem, n*esize) : NULL;
+		if (nm != NULL) {
+			b->mem = nm;
+			b->size = n;
+		}
+	}
+	if (b->used >= b->nhash) {
+		nh = realloc(b->hash, 2*b->nhash*sizeof(size_t));
+		if (nh != NULL) {
+			b->hash = nh;
+			b->nhash *= 2;
+			for (h = 0; h < b->nhash; h++)
+				b->hash[h] = 0;
+			for (e = 0; e < b->used; e++) {
+				ep = BMENTRY(b, e);
+				h = bmhash(b, ep + 1) & (b->nhash - 1);
+				ep[0] = (regoff_t)b->hash[h];
+				b->hash[h] = e + 1;
+			}
+		}
+	}
+
+	if (b->used == b->size) {
+		b->rnd = (b->rnd*1103515245UL + 12345UL) & 0xffffffffUL;
+		e = (size_t)(b->rnd >> 8) % b->size;
+		bmunlink(b, e);
+	} else
+		e = b->used++;
+	ep = BMENTRY(b, e);
+	(void) memcpy(ep + 1, b->key, b->klen*sizeof(regoff_t));
+	h = bmhash(b, b->key) & (b->nhash - 1);
+	ep[0] = (regoff_t)b->hash[h];
+	b->hash[h] = e + 1;
+}
+
+/*
+ - bmunlink - take an entry off its hash chain
+ == static void bmunlink(struct bmemo *b, size_t e);
+ */
+static void
+bmunlink(
+    struct bmemo *b,
+    size_t e)
+{
+	regoff_t *ep = BMENTRY(b, e);
+	size_t h = bmhash(b, ep + 1) & (b->nhash - 1);
+	size_t f;
+	regoff_t *fp;
+
+	if (b->hash[h] == e + 1) {
+		b->hash[h] = (size_t)ep[0];
+		return;
+	}
+	for (f = b->hash[h]; f != 0; f = (size_t)fp[0]) {
+		fp = BMENTRY(b, f - 1);
+		if ((size_t)fp[0] == e + 1) {
+			fp[0] = ep[0];
+			return;
+		}
+	}
+	assert(0);	/* it was on no chain */
+}
+#endif
+
 /* another structure passed up and down to avoid zillions of parameters */
 struct match {
 	struct re_guts *g;
@@ -85,7 +589,15 @@ struct match {
 	states fresh;		/* states for a fresh start */
 	states tmp;		/* temporary */
 	states empty;		/* empty set of states */
+	struct dfa *dfa;	/* fast()'s DFA cache, or NULL */
+	const char **pst;	/* [2*nstates], for leftmost() */
+	struct bmemo *memo;	/* backref()'s failures, or NULL */
+	unsigned long steps;	/* backref() calls at this start so far */
+	unsigned long depth;	/* backref() calls under way */
+	struct re_scratch *sc;	/* where the above are kept, or NULL */
+	struct regstats *rs;	/* where the counting goes */
 };
+#define	RANOUT(m)	((m)->g->maxsteps != 0 && (m)->steps > (m)->g->maxsteps)
 
 /* ========= begin header generated by ./mkh ========= */
 #ifdef __cplusplus
@@ -93,12 +605,16 @@ extern "C" {
 #endif
 
 /* === engine.c === */
-static int matcher(struct re_guts *g, const char *string, size_t nmatch, regmatch_t pmatch[], int eflags);
+static int matcher(struct re_guts *g, const char *string, size_t nmatch, regmatch_t pmatch[], int eflags, struct re_scratch *sc);
 static const char *dissect(struct match *m, const char *start, const char *stop, sopno startst, sopno stopst);
 static const char *backref(struct match *m, const char *start, const char *stop, sopno startst, sopno stopst, sopno lev);
+static const char *backstep(struct match *m, const char *start, const char *stop, sopno startst, sopno stopst, sopno lev);
+static void memokey(struct match *m, const char *sp, const char *stop, sopno ss, sopno lev);
 static const char *fast(struct match *m, const char *start, const char *stop, sopno startst, sopno stopst);
 static const char *slow(struct match *m, const char *start, const char *stop, sopno startst, sopno stopst);
+static const char *leftmost(struct match *m, const char *start, const char *stop, sopno startst, sopno stopst);
 static states step(struct re_guts *g, sopno start, sopno stop, states bef, int ch, states aft);
+static void pstep(struct re_guts *g, sopno start, sopno stop, const char **bef, int ch, const char **aft);
 #define	BOL	(OUT+1)
 #define	EOL	(BOL+1)
 #define	BOLEOL	(BOL+2)
@@ -137,7 +653,11 @@ static int nope = 0;
 /*
  - matcher - the actual matching engine
  == static int matcher(struct re_guts *g, char *string, \
- ==	size_t nmatch, regmatch_t pmatch[], int eflags);
+ ==	size_t nmatch, regmatch_t pmatch[], int eflags, \
+ ==	struct re_scratch *sc);
+ *
+ * With a scratch context, the buffers come from it and go back to it
+ * rather than being allocated and freed here.
  */
 static int			/* 0 success, REG_NOMATCH failure */
 matcher(
@@ -145,7 +665,8 @@ matcher(
     const char *string,
     size_t nmatch,
     regmatch_t pmatch[],
-    int eflags)
+    int eflags,
+    struct re_scratch *sc)
 {
 	const char *endp;
 	size_t i;
@@ -157,14 +678,12 @@ matcher(
 	const char *start;
 	const char *stop;
 	int error = 0;
+	struct regstats junk;	/* counting with nowhere to keep it */
 
 	assert(g != NULL);
 	assert(string != NULL);
 	/* pmatch checked below */
 
-	/* simplify the situation where possible */
-	if (g->cflags&REG_NOSUB)
-		nmatch = 0;
 	if (eflags&REG_STARTEND) {
 		assert(pmatch != NULL);
 		start = string + (size_t)pmatch[0].rm_so;
@@ -177,13 +696,15 @@ matcher(
 		return(REG_INVARG);
 
 	/* prescreening; this does wonders for this rather slow code */
-	if (g->must != NULL) {
-		for (dp = start; dp < stop; dp++)
-			if (*dp == g->must[0] && (size_t)(stop - dp) >= g->mlen &&
-				memcmp(dp, g->must, g->mlen) == 0)
+	if (g->nmusts > 0) {
+		for (i = 0; i < g->nmusts; i++)
+			if (memfind(start, stop, &g->musts[i]) != NULL)
 				break;
-		if (dp == stop)		/* we didn't find g->must */
+		if (i == g->nmusts) {	/* we didn't find any of them */
+			if (sc != NULL)
+				sc->stats.mustrejects++;
 			return(REG_NOMATCH);
+		}
 	}
 
 	/* match struct setup */
@@ -194,6 +715,28 @@ matcher(
 	m->offp = string;
 	m->beginp = start;
 	m->endp = stop;
+	m->dfa = NULL;
+	m->pst = NULL;
+	m->memo = NULL;
+	m->steps = 0;
+	m->depth = 0;
+	m->sc = sc;
+	m->rs = &junk;
+	if (sc != NULL)
+		m->rs = &sc->stats;
+	else
+		(void) memset(&junk, 0, sizeof(junk));
+	if (sc != NULL) {
+		m->pmatch = sc->pmatch;
+		m->lastpos = sc->lastpos;
+		m->pst = sc->pst;
+		m->dfa = sc->dfaslot;
+		if (m->dfa != NULL)
+			m->dfa->flushes = 0;
+		m->memo = sc->memo;
+		if (m->memo != NULL && m->memo->used > 0)
+			bmflush(m->memo);	/* keys are offsets into the string */
+	}
 	STATESETUP(m, 4);
 	SETUP(m->st);
 	SETUP(m->fresh);
@@ -213,13 +756,27 @@ matcher(
 
 		/* where? */
 		assert(m->coldp != NULL);
-		for (;;) {
-			NOTE("finding start");
-			endp = slow(m, m->coldp, stop, gf, gl);
-			if (endp != NULL)
-				break;
-			assert(m->coldp < m->endp);
-			m->coldp++;
+		NOTE("finding start");
+		endp = slow(m, m->coldp, stop, gf, gl);
+		if (endp == NULL) {
+			/*
+			 * fast() usually leaves coldp right at the start, so
+			 * the single slow() above settles it.  When it does
+			 * not, find the start in one pass.
+			 */
+			if (m->pst == NULL)
+				m->pst = (const char **)malloc(2 * g->nstates *
+							sizeof(const char *));
+			if (m->pst == NULL) {
+				error = REG_ESPACE;
+				goto done;
+			}
+			m->rs->startretries++;
+			dp = leftmost(m, m->coldp, stop, gf, gl);
+			assert(dp != NULL);
+			endp = slow(m, dp, stop, gf, gl);
+			assert(endp != NULL);
+			m->coldp = dp;
 		}
 		if (nmatch == 1 && !g->backrefs)
 			break;		/* no further info needed */
@@ -245,8 +802,15 @@ matcher(
 				error = REG_ESPACE;
 				goto done;
 			}
+			if (m->memo == NULL)
+				m->memo = bminit((size_t)3 + 2*g->nsub +
+							(size_t)g->nplus);
 			NOTE("backref dissect");
 			dp = backref(m, m->coldp, endp, gf, gl, (sopno)0);
+			if (RANOUT(m)) {
+				error = REG_ELIMIT;
+				goto done;
+			}
 		}
 		if (dp != NULL)
 			break;
@@ -270,6 +834,10 @@ matcher(
 #endif
 			NOTE("backoff dissect");
 			dp = backref(m, m->coldp, endp, gf, gl, (sopno)0);
+			if (RANOUT(m)) {
+				error = REG_ELIMIT;
+				goto done;
+			}
 		}
 		assert(dp == NULL || dp == endp);
 		if (dp != NULL)		/* found a shorter one */
@@ -277,6 +845,13 @@ matcher(
 
 		/* despite initial appearances, there is no match here */
 		NOTE("false alarm");
+		m->rs->falsealarms++;
+		m->rs->backrefsteps += m->steps;
+		m->steps = 0;		/* the limit is for each place tried */
+		if (m->coldp == stop) {		/* nowhere later to start */
+			error = REG_NOMATCH;
+			goto done;
+		}
 		start = m->coldp + 1;	/* recycle starting later */
 		assert(start <= stop);
 	}
@@ -299,6 +874,16 @@ matcher(
 	}
 
 done:
+	m->rs->backrefsteps += m->steps;
+	if (sc != NULL) {
+		sc->pmatch = m->pmatch;
+		sc->lastpos = m->lastpos;
+		sc->pst = m->pst;
+		sc->dfaslot = m->dfa;
+		sc->memo = m->memo;
+		STATETEARDOWN(m);
+		return error;
+	}
 	if (m->pmatch != NULL) {
 		free(m->pmatch);
 		m->pmatch = NULL;
@@ -307,6 +892,14 @@ done:
 		free(m->lastpos);
 		m->lastpos = NULL;
 	}
+	dfafree(m->dfa);
+	m->dfa = NULL;
+	if (m->pst != NULL) {
+		free(m->pst);
+		m->pst = NULL;
+	}
+	bmfree(m->memo);
+	m->memo = NULL;
 	STATETEARDOWN(m);
 	return error;
 }
@@ -524,6 +1117,9 @@ dissect(
  - backref - figure out what matched what, figuring in back references
  == static const char *backref(struct match *m, const char *start, \
  ==	const char *stop, sopno startst, sopno stopst, sopno lev);
+ *
+ * This just keeps count of how deep the recursion goes; backstep() does
+ * the work, calling back here to recurse.
  */
 static const char *		/* == stop (success) or NULL (failure) */
 backref(
@@ -533,6 +1129,33 @@ backref(
     sopno startst,
     sopno stopst,
     sopno lev)			/* PLUS nesting level */
+{
+	const char *dp;
+
+	if (++m->depth > m->rs->backrefdepth)
+		m->rs->backrefdepth = m->depth;
+	dp = backstep(m, start, stop, startst, stopst, lev);
+	m->depth--;
+	return(dp);
+}
+
+/*
+ - backstep - one step of backref()
+ == static const char *backstep(struct match *m, const char *start, \
+ ==	const char *stop, sopno startst, sopno stopst, sopno lev);
+ *
+ * A call that fails leaves m->pmatch and m->lastpos as it found them,
+ * which is what lets m->memo remember failures.  Each call is a step;
+ * past g->maxsteps of them, every call fails and RANOUT(m) says why.
+ */
+static const char *		/* == stop (success) or NULL (failure) */
+backstep(
+    struct match *m,
+    const char *start,
+    const char *stop,
+    sopno startst,
+    sopno stopst,
+    sopno lev)			/* PLUS nesting level */
 {
 	int i;
 	sopno ss;	/* start sop of current subRE */
@@ -543,14 +1166,20 @@ backref(
 	const char *dp;
 	size_t len;
 	int hard;
+	int memo;	/* look in and add to m->memo? */
 	sop s;
 	regoff_t offsave;
+	regoff_t endsave;
+	const char *lastsave;
 	cset *cs;
 
 	assert(m != NULL);
 	assert(start != NULL);
 	assert(stop != NULL);
 
+	m->steps++;
+	if (RANOUT(m))
+		return(NULL);
 	AT("back", start, stop, startst, stopst);
 	sp = start;
 
@@ -610,6 +1239,7 @@ backref(
 				return(NULL);
 			break;
 		case O_QUEST:
+		case O_CH:
 			break;
 		case OOR1:	/* matches null but needs to skip */
 			ss++;
@@ -634,6 +1264,15 @@ backref(
 	/* the hard stuff */
 	AT("hard", sp, stop, ss, stopst);
 	s = m->g->strip[ss];
+	/* only the choices are worth remembering; the rest lead to one */
+	memo = m->memo != NULL &&
+		(OP(s) == OQUEST_ || OP(s) == O_PLUS || OP(s) == OCH_);
+	if (memo) {
+		memokey(m, sp, stop, ss, lev);
+		if (bmfind(m->memo))
+			return(NULL);	/* been here, and it didn't work */
+	}
+	dp = NULL;
 	switch (OP(s)) {
 	case OBACK_:		/* the vilest depths */
 		i = OPND(s);
@@ -652,41 +1291,51 @@ backref(
 			return(NULL);
 		while (m->g->strip[ss] != SOP(O_BACK, i))
 			ss++;
-		return(backref(m, sp+len, stop, ss+1, stopst, lev));
+		dp = backref(m, sp+len, stop, ss+1, stopst, lev);
+		break;
 
 	case OQUEST_:		/* to null or not */
 		dp = backref(m, sp, stop, ss+1, stopst, lev);
-		if (dp != NULL)
-			return(dp);	/* not */
-		return(backref(m, sp, stop, ss+OPND(s)+1, stopst, lev));
+		if (dp == NULL)		/* null */
+			dp = backref(m, sp, stop, ss+OPND(s)+1, stopst, lev);
+		break;
 
 	case OPLUS_:
 		assert(m->lastpos != NULL);
 		assert(lev+1 <= m->g->nplus);
+		lastsave = m->lastpos[lev+1];
 		m->lastpos[lev+1] = sp;
-		return(backref(m, sp, stop, ss+1, stopst, lev+1));
+		dp = backref(m, sp, stop, ss+1, stopst, lev+1);
+		if (dp == NULL)
+			m->lastpos[lev+1] = lastsave;
+		break;
 
 	case O_PLUS:
-		if (sp == m->lastpos[lev])	/* last pass matched null */
-			return(backref(m, sp, stop, ss+1, stopst, lev-1));
+		if (sp == m->lastpos[lev]) {	/* last pass matched null */
+			dp = backref(m, sp, stop, ss+1, stopst, lev-1);
+			break;
+		}
 		/* try another pass */
+		lastsave = m->lastpos[lev];
 		m->lastpos[lev] = sp;
 		dp = backref(m, sp, stop, ss-OPND(s)+1, stopst, lev);
+		m->lastpos[lev] = lastsave;
 		if (dp == NULL)
 			dp = backref(m, sp, stop, ss+1, stopst, lev-1);
-		return(dp);
+		break;
 
 	case OCH_:		/* find the right one, if any */
 		ssub = ss + 1;
 		esub = ss + OPND(s) - 1;
 		assert(OP(m->g->strip[esub]) == OOR1);
 		for (;;) {	/* find first matching branch */
-			dp = backref(m, sp, stop, ssub, esub, lev);
-			if (dp != NULL)
-				return(dp);
+			/* OOR1 at the end of it takes us on past the O_CH */
+			dp = backref(m, sp, stop, ssub, stopst, lev);
+			if (dp != NULL || RANOUT(m))
+				break;
 			/* that one missed, try next one */
 			if (OP(m->g->strip[esub]) == O_CH)
-				return(NULL);	/* there is none */
+				break;	/* there is none */
 			esub++;
 			assert(OP(m->g->strip[esub]) == OOR2);
 			ssub = esub + 1;
@@ -696,17 +1345,26 @@ backref(
 			else
 				assert(OP(m->g->strip[esub]) == O_CH);
 		}
+		break;
 
-	case OLPAREN:		/* must undo assignment if rest fails */
+	case OLPAREN:		/* must undo assignments if rest fails */
 		i = OPND(s);
 		assert(0 < i && i <= m->g->nsub);
 		offsave = m->pmatch[i].rm_so;
+		endsave = m->pmatch[i].rm_eo;
 		m->pmatch[i].rm_so = sp - m->offp;
+		/*
+		 * Nothing can look at it before the ORPAREN, and
+		 * forgetting the last pass's end keeps memo keys apart
+		 * only where they need to be.
+		 */
+		m->pmatch[i].rm_eo = (regoff_t)-1;
 		dp = backref(m, sp, stop, ss+1, stopst, lev);
-		if (dp != NULL)
-			return(dp);
-		m->pmatch[i].rm_so = offsave;
-		return(NULL);
+		if (dp == NULL) {
+			m->pmatch[i].rm_so = offsave;
+			m->pmatch[i].rm_eo = endsave;
+		}
+		break;
 
 	case ORPAREN:		/* must undo assignment if rest fails */
 		i = OPND(s);
@@ -714,26 +1372,67 @@ backref(
 		offsave = m->pmatch[i].rm_eo;
 		m->pmatch[i].rm_eo = sp - m->offp;
 		dp = backref(m, sp, stop, ss+1, stopst, lev);
-		if (dp != NULL)
-			return(dp);
-		m->pmatch[i].rm_eo = offsave;
-		return(NULL);
+		if (dp == NULL)
+			m->pmatch[i].rm_eo = offsave;
+		break;
 
 	default:		/* uh oh */
 		assert(nope);
-		break;
+		return(NULL);
 	}
 
-	/* "can't happen" */
-	assert(nope);
-	/* NOTREACHED */
-	return NULL;
+	if (dp == NULL && memo && !RANOUT(m)) {
+		/* everything is as it was on the way in */
+		memokey(m, sp, stop, ss, lev);
+		bmadd(m->memo);
+	}
+	return(dp);
+}
+
+/*
+ - memokey - make backref()'s memo key for where it is now
+ == static void memokey(struct match *m, const char *sp, const char *stop, \
+ ==	sopno ss, sopno lev);
+ *
+ * backref() always stops at g->laststate, so that need not be in it.
+ */
+static void
+memokey(
+    struct match *m,
+    const char *sp,
+    const char *stop,
+    sopno ss,
+    sopno lev)
+{
+	regoff_t *k = m->memo->key;
+	size_t i;
+
+	*k++ = (regoff_t)ss;
+	*k++ = sp - m->offp;
+	*k++ = stop - m->offp;
+	for (i = 1; i <= m->g->nsub; i++) {
+		*k++ = m->pmatch[i].rm_so;
+		*k++ = m->pmatch[i].rm_eo;
+	}
+	/*
+	 * sp never moves backward, so all the null-pass check can ever
+	 * learn from lastpos[i] is whether the pass began right here.
+	 * Passes deeper than lev start afresh before anyone looks.
+	 */
+	for (i = 1; i <= (size_t)m->g->nplus; i++)
+		*k++ = (i > (size_t)lev) ? (regoff_t)-1 :
+					(m->lastpos[i] == sp) ? 1 : 0;
 }
 
 /*
  - fast - step through the string at top speed
  == static const char *fast(struct match *m, const char *start, \
  ==	const char *stop, sopno startst, sopno stopst);
+ *
+ * Where the DFA cache already knows the way, it is a table lookup per
+ * character; the first time through, or when the cache cannot help, the
+ * loop below steps the NFA as it always did and tells the cache what it
+ * found.
  */
 static const char *		/* where tentative match ended, or NULL */
 fast(
@@ -752,6 +1451,13 @@ fast(
 	int flagch;
 	size_t i;
 	const char *coldp; /* last p after which no match was underway */
+	const uch *cl = m->g->classes;
+	struct dfa *d;
+	struct dstate *ds;
+	unsigned int o;		/* DFA state, or 0 if not caching */
+	unsigned int no;
+	int nf;
+	unsigned long steps = 0;	/* characters stepped the slow way */
 
 	assert(m != NULL);
 	assert(start != NULL);
@@ -763,7 +1469,31 @@ fast(
 	ASSIGN(fresh, st);
 	SP("start", st, *p);
 	coldp = NULL;
+	if (m->dfa == NULL && ((size_t)(stop - start) >= DFAMINLEN ||
+							m->sc != NULL))
+		m->dfa = dfainit(m->g, STATEBYTES(m));
+	d = m->dfa;
+	o = 0;
+	if (d != NULL && d->flushes <= DFAFLUSHES)
+		o = dfastate(d, STATEMEM(st), dfactx(m->g, m->eflags, c), 1);
 	for (;;) {
+		if (o != 0) {
+			/* go as far as the known transitions take us */
+			ds = DSTATE(d, o);
+			for (; p < stop; p++) {
+				if (ds->fresh)
+					coldp = p;
+				no = ds->next[cl[(uch)*p]];
+				if (no <= DMATCH)
+					break;
+				ds = DSTATE(d, no);
+			}
+			o = (unsigned int)((char *)ds - d->mem);
+			(void) memcpy(STATEMEM(st), DSET(d, ds), d->setsize);
+			if (p > start)
+				c = *(p-1);
+		}
+
 		/* next character */
 		lastc = c;
 		c = (p == m->endp) ? OUT : *p;
@@ -804,8 +1534,11 @@ fast(
 		}
 
 		/* are we done? */
-		if (ISSET(st, stopst) || p == stop)
+		if (ISSET(st, stopst) || p == stop) {
+			if (o != 0 && p != stop)
+				DSTATE(d, o)->next[cl[(uch)c]] = DMATCH;
 			break;		/* NOTE BREAK OUT */
+		}
 
 		/* no, we must deal with this character */
 		ASSIGN(tmp, st);
@@ -815,10 +1548,23 @@ fast(
 		SP("aft", st, c);
 		assert(EQ(step(m->g, startst, stopst, st, NOTHING, st), st));
 		p++;
+		steps++;
+
+		/* and remember how that went */
+		if (o != 0) {
+			nf = d->flushes;
+			no = dfastate(d, STATEMEM(st),
+				dfactx(m->g, m->eflags, c), EQ(st, fresh));
+			if (no != 0 && d->flushes == nf)
+				DSTATE(d, o)->next[cl[(uch)c]] = no;
+			o = no;
+		}
 	}
 
 	assert(coldp != NULL);
 	m->coldp = coldp;
+	m->rs->fastbytes += p - start;
+	m->rs->faststeps += steps;
 	if (ISSET(st, stopst))
 		return(p+1);
 	else
@@ -912,9 +1658,116 @@ slow(
 		p++;
 	}
 
+	m->rs->slowcalls++;
+	m->rs->slowbytes += p - start;
 	return(matchp);
 }
 
+/*
+ - leftmost - find where the leftmost match starts, in one pass
+ == static const char *leftmost(struct match *m, const char *start, \
+ ==	const char *stop, sopno startst, sopno stopst);
+ *
+ * This runs like slow(), but each NFA state carries the earliest place
+ * that a match which got there could have started, and a fresh match is
+ * started at every character until one gets through.  The earliest start
+ * to reach stopst is the answer, which is known once no state is left
+ * holding an earlier one.  That replaces a slow() from every possible
+ * starting place in turn.
+ */
+static const char *		/* where it starts, or NULL */
+leftmost(
+    struct match *m,
+    const char *start,
+    const char *stop,
+    sopno startst,
+    sopno stopst)
+{
+	const char **st = m->pst;
+	const char **tmp = m->pst + m->g->nstates;
+	const char **x;
+	const char *p = start;
+	int c = (start == m->beginp) ? OUT : *(start-1);
+	int lastc;	/* previous c */
+	int flagch;
+	size_t i;
+	sopno j;
+	const char *best;	/* earliest start of a match so far */
+
+	assert(m != NULL);
+	assert(start != NULL);
+	assert(stop != NULL);
+
+	AT("left", start, stop, startst, stopst);
+	for (j = startst; j <= stopst; j++)
+		st[j] = NULL;
+	st[startst] = p;
+	pstep(m->g, startst, stopst, st, NOTHING, st);
+	best = NULL;
+	for (;;) {
+		/* next character */
+		lastc = c;
+		c = (p == m->endp) ? OUT : *p;
+
+		/* is there an EOL and/or BOL between lastc and c? */
+		flagch = '\0';
+		i = 0;
+		if ( (lastc == '\n' && m->g->cflags&REG_NEWLINE) ||
+				(lastc == OUT && !(m->eflags&REG_NOTBOL)) ) {
+			flagch = BOL;
+			i = m->g->nbol;
+		}
+		if ( (c == '\n' && m->g->cflags&REG_NEWLINE) ||
+				(c == OUT && !(m->eflags&REG_NOTEOL)) ) {
+			flagch = (flagch == BOL) ? BOLEOL : EOL;
+			i += m->g->neol;
+		}
+		for (; i > 0; i--)
+			pstep(m->g, startst, stopst, st, flagch, st);
+
+		/* how about a word boundary? */
+		if ( (flagch == BOL || (lastc != OUT && !ISWORD(lastc))) &&
+					(c != OUT && ISWORD(c)) ) {
+			flagch = BOW;
+		}
+		if ( (lastc != OUT && ISWORD(lastc)) &&
+				(flagch == EOL || (c != OUT && !ISWORD(c))) ) {
+			flagch = EOW;
+		}
+		if (flagch == BOW || flagch == EOW)
+			pstep(m->g, startst, stopst, st, flagch, st);
+
+		/* are we done? */
+		if (st[stopst] != NULL && (best == NULL || st[stopst] < best))
+			best = st[stopst];
+		if (p == stop)
+			break;		/* NOTE BREAK OUT */
+		if (best != NULL) {
+			for (j = startst; j <= stopst; j++)
+				if (st[j] != NULL && st[j] < best)
+					break;
+			if (j > stopst)
+				break;	/* NOTE BREAK OUT */
+		}
+
+		/* no, we must deal with this character */
+		x = tmp;
+		tmp = st;
+		st = x;
+		for (j = startst; j <= stopst; j++)
+			st[j] = NULL;
+		if (best == NULL) {	/* a fresh start after it */
+			st[startst] = p+1;
+			pstep(m->g, startst, stopst, st, NOTHING, st);
+		}
+		assert(c != OUT);
+		pstep(m->g, startst, stopst, tmp, c, st);
+		p++;
+	}
+
+	return(best);
+}
+
 
 /*
  - step - map set of states reachable before char to set reachable after
@@ -949,6 +1802,14 @@ step(
 	assert(g != NULL);
 
 	for (pc = start, INIT(here, pc); pc != stop; pc++, INC(here)) {
+		if (IDLE(bef, aft, here)) {
+			/* nothing is on here, so nothing here can fire */
+			if (WORDEND(pc, stop) >= stop - 1)
+				break;
+			pc = WORDEND(pc, stop);
+			INIT(here, pc);
+			continue;
+		}
 		s = g->strip[pc];
 		switch (OP(s)) {
 		case OEND:
@@ -968,13 +1829,13 @@ step(
 			if (ch == EOL || ch == BOLEOL)
 				FWD(aft, bef, 1);
 			break;
-		case OBOW:
+		case OBOW:		/* from aft: one right after holds too */
 			if (ch == BOW)
-				FWD(aft, bef, 1);
+				FWD(aft, aft, 1);
 			break;
 		case OEOW:
 			if (ch == EOW)
-				FWD(aft, bef, 1);
+				FWD(aft, aft, 1);
 			break;
 		case OANY:
 			if (!NONCHAR(ch))
@@ -1046,6 +1907,126 @@ step(
 	return(aft);
 }
 
+#ifndef PSTEPDONE
+#define	PSTEPDONE	/* never again */
+/* the state n places on from (back from) pc is reachable as early too */
+#define	PFWD(aft, bef, n)	{ if ((bef)[pc] != NULL && \
+		((aft)[pc+(n)] == NULL || (bef)[pc] < (aft)[pc+(n)])) \
+			(aft)[pc+(n)] = (bef)[pc]; }
+#define	PBACK(aft, bef, n)	{ if ((bef)[pc] != NULL && \
+		((aft)[pc-(n)] == NULL || (bef)[pc] < (aft)[pc-(n)])) \
+			(aft)[pc-(n)] = (bef)[pc]; }
+/*
+ - pstep - step() for leftmost(), with start positions for states
+ == static void pstep(struct re_guts *g, sopno start, sopno stop, \
+ ==	const char **bef, int ch, const char **aft);
+ *
+ * A state is NULL if unreachable, else the earliest place a match that
+ * reaches it can have started.  bef and aft may be the same.
+ */
+static void
+pstep(
+    struct re_guts *g,
+    sopno start,		/* start state within strip */
+    sopno stop,			/* state after stop state within strip */
+    const char **bef,		/* states reachable before */
+    int ch,			/* character or NONCHAR code */
+    const char **aft)		/* states already known reachable after */
+{
+	cset *cs;
+	sop s;
+	sopno pc;
+	sopno look;
+	const char *was;
+
+	assert(g != NULL);
+
+	for (pc = start; pc != stop; pc++) {
+		s = g->strip[pc];
+		switch (OP(s)) {
+		case OEND:
+			assert(pc == stop-1);
+			break;
+		case OCHAR:
+			if (ch == (char)OPND(s))
+				PFWD(aft, bef, 1);
+			break;
+		case OBOL:
+			if (ch == BOL || ch == BOLEOL)
+				PFWD(aft, bef, 1);
+			break;
+		case OEOL:
+			if (ch == EOL || ch == BOLEOL)
+				PFWD(aft, bef, 1);
+			break;
+		case OBOW:
+			if (ch == BOW)
+				PFWD(aft, bef, 1);
+			break;
+		case OEOW:
+			if (ch == EOW)
+				PFWD(aft, bef, 1);
+			break;
+		case OANY:
+			if (!NONCHAR(ch))
+				PFWD(aft, bef, 1);
+			break;
+		case OANYOF:
+			cs = &g->sets[OPND(s)];
+			if (!NONCHAR(ch) && CHIN(cs, ch))
+				PFWD(aft, bef, 1);
+			break;
+		case OBACK_:		/* ignored here */
+		case O_BACK:
+		case OPLUS_:
+		case O_QUEST:
+		case OLPAREN:
+		case ORPAREN:
+		case O_CH:
+			PFWD(aft, aft, 1);
+			break;
+		case O_PLUS:		/* both forward and back */
+			PFWD(aft, aft, 1);
+			was = aft[pc - OPND(s)];
+			PBACK(aft, aft, OPND(s));
+			if (aft[pc - OPND(s)] != was) {
+				/* oho, must reconsider loop body */
+				pc -= OPND(s) + 1;
+			}
+			break;
+		case OQUEST_:		/* two branches, both forward */
+			PFWD(aft, aft, 1);
+			PFWD(aft, aft, OPND(s));
+			break;
+		case OCH_:		/* mark the first two branches */
+			PFWD(aft, aft, 1);
+			assert(OP(g->strip[pc+OPND(s)]) == OOR2);
+			PFWD(aft, aft, OPND(s));
+			break;
+		case OOR1:		/* done a branch, find the O_CH */
+			if (aft[pc] != NULL) {
+				for (look = 1;
+						OP(s = g->strip[pc+look]) != O_CH;
+						look += OPND(s))
+					assert(OP(s) == OOR2);
+				PFWD(aft, aft, look);
+			}
+			break;
+		case OOR2:		/* propagate OCH_'s marking */
+			PFWD(aft, aft, 1);
+			if (OP(g->strip[pc+OPND(s)]) != O_CH) {
+				assert(OP(g->strip[pc+OPND(s)]) == OOR2);
+				PFWD(aft, aft, OPND(s));
+			}
+			break;
+		default:		/* ooooops... */
+			assert(nope);
+			break;
+		}
+	}
+}
+#endif
+
 #ifdef REDEBUG
 /*
  - print - print a set of states
@@ -1146,8 +2127,12 @@ pchar(
 #undef	matcher
 #undef	fast
 #undef	slow
+#undef	leftmost
 #undef	dissect
 #undef	backref
+#undef	backstep
+#undef	memokey
+#undef	dfaslot
 #undef	step
 #undef	print
 #undef	at
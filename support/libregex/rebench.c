@@ -0,0 +1,952 @@
+/*-
+ * Copyright (c) 2023 S. V. Nickolas.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * rebench - time this regex library, and check it against the host's
+ *
+ * usage: rebench [-aiovx] [-c class] [-e re] [-f file] [-p file]
+ *		[-S seed] [-s kbytes] [-t seconds]
+ *
+ * Each RE in a built-in corpus (or given with -e, or one to a line in a
+ * -p file, as EREs) is compiled with REG_NEWLINE, the way grep does it,
+ * and run over some text: generated lines shaped like logs, web server
+ * logs, prose and C, or the lines of a -f file.  For each RE it reports
+ * how fast regcomp() goes through the RE, and how fast the text goes by
+ * with regexec() a line at a time (with a scratch context), with
+ * regexec_buf() over the whole text, and with the host library's
+ * regexec() a line at a time; then the same for each class of RE.
+ * Times are CPU time, each taken over passes adding up to at least -t
+ * seconds (default 0.2).
+ *
+ * Unless -x is given, every line is also matched with the host library,
+ * and any line where the two disagree on whether there is a match or
+ * where it is (and with -a, where each subexpression is) is a difference;
+ * so is regexec_buf() finding a different number of lines.  The first
+ * few for each RE are shown, or all with -v.  The exit status is 1 if
+ * there were any differences, 2 for trouble.  Nothing calls setlocale(),
+ * so the host library works in the C locale, as this one does.  Where
+ * the libraries can honestly differ: an ERE here has no back references (\1
+ * is just 1), which the host's may have; and subexpressions are not
+ * always reported alike (see BUGS in regex.3), so expect the odd one
+ * with -a.
+ *
+ * Other options: -c runs only the REs of one class; -i sets REG_ICASE for
+ * -e and -p REs; -o leaves the host out of the timings; -S seeds the
+ * text generator; -s sets how much text to generate (default 1024K).
+ *
+ * Build it with this directory's sources, as build5.sh builds the
+ * library, and the host's dynamic linker library; with no -I, so that
+ * rehost.c gets the host's <regex.h>.  E.g.
+ *
+ *	cc -D__SVR4__ -O2 -o rebench rebench.c rehost.c regcomp.c \
+ *		regerror.c regexec.c regfree.c -ldl
+ */
+
+#include <sys/types.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "regex.h"
+#include "rehost.h"
+
+/* an RE to try */
+struct pat {
+	const char *cls;	/* what sort of RE it is */
+	int flags;		/* REG_EXTENDED, REG_ICASE */
+	const char *re;
+};
+
+#define	E	REG_EXTENDED
+#define	B	REG_BASIC
+#define	I	REG_ICASE
+
+static struct pat corpus[] = {
+	{ "literal",	E,	"error" },
+	{ "literal",	E,	"Connection refused" },
+	{ "literal",	E,	"GET /api/v1/users" },
+	{ "literal",	B,	"segfault at" },
+	{ "literal",	E,	"zqxjzqxj" },
+	{ "class",	E,	"[0-9]+\\.[0-9]+\\.[0-9]+\\.[0-9]+" },
+	{ "class",	E,	"[A-Z][a-z]+ [ 0-9][0-9] [0-9:]+" },
+	{ "class",	E,	"[[:alpha:]_][[:alnum:]_]*\\(" },
+	{ "class",	E,	"[^ ]+@[^ ]+\\.[a-z]+" },
+	{ "class",	B,	"[0-9][0-9]*ms" },
+	{ "class",	E,	"[;{}][[:space:]]" },	/* can match a newline */
+	{ "alternation", E,	"error|warning|fatal" },
+	{ "alternation", E,
+		"(GET|POST|PUT|DELETE) /api/v[0-9]+/(users|items|orders)" },
+	{ "alternation", E,	"Mon|Tue|Wed|Thu|Fri|Sat|Sun" },
+	{ "alternation", E,
+		"sshd|cron|kernel|nginx|postfix|dhclient|systemd|named|ntpd|"
+		"sudo|smartd|dbus|rsyslogd|polkitd|chronyd|avahi|cupsd|"
+		"containerd|dockerd|auditd" },
+	{ "anchor",	E,	"^[A-Z][a-z][a-z] [ 0-9][0-9] " },
+	{ "anchor",	E,	"[0-9]+ms$" },
+	{ "anchor",	E,	"^$" },
+	{ "anchor",	E,	"^10\\.[0-9.]+ .* 200 [0-9]+ " },
+	{ "anchor",	B,	"^	*return" },
+	{ "backref",	B,	"\\([a-z][a-z]*\\) \\1 " },
+	{ "backref",	B,	"\\([0-9]\\)\\1\\1" },
+	{ "backref",	B,	"\\(\"[^\"]*\"\\).*\\1" },
+	{ "icase",	E|I,	"error" },
+	{ "icase",	E|I,	"connection (refused|reset)" },
+	{ "icase",	E|I,	"[a-f0-9]{8}-[a-f0-9]{4}" },
+	{ "icase",	B|I,	"mozilla" },
+	{ NULL,		0,	NULL }
+};
+
+#undef	E
+#undef	B
+#undef	I
+
+/* totals for a class */
+struct tally {
+	const char *cls;
+	double cbytes, csecs;	/* regcomp() */
+	double lbytes, lsecs;	/* regexec(), a line at a time */
+	double bbytes, bsecs;	/* regexec_buf() */
+	double hbytes, hsecs;	/* the host's regexec() */
+	long diffs;
+};
+#define	NTALLY	16
+
+static struct tally tallies[NTALLY];
+static int ntally;
+
+static char *text;		/* newline-terminated lines */
+static size_t textlen;
+static char **lines;		/* the same lines, NUL-terminated */
+static size_t nlines;
+
+static int aflag;		/* check subexpressions too */
+static int oflag;		/* leave the host out of the timings */
+static int vflag;		/* show every difference */
+static int host;		/* checking against the host */
+static double mintime = 0.2;	/* seconds to time over, at least */
+static unsigned long seed = 1;	/* for rnd() */
+static long ndiffs;		/* differences altogether */
+
+/* ========= begin header generated by mkh ========= */
+static unsigned long rnd(void);
+static const char *pick(const char *const *w, size_t n);
+static void genline(char *b);
+static void gentext(size_t size);
+static void readtext(const char *file);
+static void splittext(void);
+static void addpat(struct pat **pp, size_t *np, const char *re, int flags);
+static void readpats(struct pat **pp, size_t *np, const char *file);
+static double cpu(void);
+static size_t bufcount(const regex_t *re, struct re_scratch *sc);
+static long xcheck(const struct pat *p, const regex_t *re, struct re_scratch *sc, void *h, size_t hnsub);
+static void showdiff(size_t i, size_t nm, const regmatch_t *pm, int r1, const long *off, int r2);
+static struct tally *tally(const char *cls);
+static double rate(double bytes, double secs);
+static void bench(const struct pat *p);
+static void usage(void);
+/* ========= end header generated by mkh ========= */
+
+#define	NWORDS(w)	(sizeof(w)/sizeof(w[0]))
+
+static const char *const months[] = {
+	"Jan", "Feb", "Mar", "Apr", "May", "Jun",
+	"Jul", "Aug", "Sep", "Oct", "Nov", "Dec"
+};
+static const char *const hosts[] = {
+	"web01", "web02", "db-primary", "cache3", "mx", "build-7f2"
+};
+static const char *const daemons[] = {
+	"sshd", "cron", "kernel", "nginx", "postfix/smtpd", "systemd",
+	"sudo", "dhclient", "named"
+};
+static const char *const users[] = {
+	"alice", "bob", "root", "www-data", "deploy", "postgres"
+};
+static const char *const methods[] = {
+	"GET", "GET", "GET", "POST", "PUT", "DELETE", "HEAD"
+};
+static const char *const paths[] = {
+	"/api/v1/users/", "/api/v2/items/", "/api/v1/orders?id=",
+	"/index.html?v=", "/static/app.js?", "/login?next=/u/"
+};
+static const char *const agents[] = {
+	"Mozilla/5.0 (X11; Linux x86_64)", "curl/7.88.1", "Wget/1.21.3",
+	"Mozilla/5.0 (Windows NT 10.0; Win64; x64)"
+};
+static const char *const words[] = {
+	"the", "of", "and", "a", "to", "in", "is", "that", "it", "was",
+	"for", "on", "are", "with", "as", "his", "they", "be", "at", "one",
+	"have", "this", "from", "or", "had", "by", "word", "but", "what",
+	"some", "we", "can", "out", "other", "were", "all", "there", "when",
+	"up", "use", "your", "how", "said", "an", "each", "which", "she",
+	"do", "their", "time", "if", "will", "way", "about", "many", "then",
+	"them", "write", "would", "like", "so", "these", "her", "long",
+	"make", "thing", "see", "him", "two", "has", "look", "more", "day",
+	"could", "go", "come", "did", "number", "sound", "no", "most",
+	"people", "my", "over", "know", "water", "than", "call", "first",
+	"who", "may", "down", "side", "been", "now", "find", "error",
+	"connection", "mailbox", "keyboard", "refused", "signal"
+};
+static const char *const idents[] = {
+	"buf", "len", "p", "re", "ctx", "node", "count", "i", "state",
+	"regexec", "memcpy", "strlen", "lookup", "emit"
+};
+
+/*
+ - rnd - next pseudo-random number (xorshift)
+ == static unsigned long rnd(void);
+ */
+static unsigned long		/* 32 bits of it */
+rnd(void)
+{
+	seed ^= (seed << 13) & 0xffffffffUL;
+	seed ^= seed >> 17;
+	seed ^= (seed << 5) & 0xffffffffUL;
+	return(seed);
+}
+
+/*
+ - pick - choose a word at random
+ == static const char *pick(const char *const *w, size_t n);
+ */
+static const char *
+pick(
+    const char *const *w,
+    size_t n)
+{
+	return(w[rnd() % n]);
+}
+
+/*
+ - genline - make up a line of text
+ == static void genline(char *b);
+ *
+ * Four lines in ten look like syslog, three like a web server's access
+ * log, two are prose and one is C.  Each kind has the odd thing in it
+ * for the corpus to find.
+ */
+static void
+genline(
+    char *b)			/* room for 512 bytes */
+{
+	unsigned long r = rnd() % 10;
+	const char *w;
+	int n;
+	int i;
+	int d;
+
+	if (r < 4) {
+		b += sprintf(b, "%s %2d %02d:%02d:%02d %s %s[%d]: ",
+				pick(months, NWORDS(months)),
+				(int)(rnd() % 28) + 1, (int)(rnd() % 24),
+				(int)(rnd() % 60), (int)(rnd() % 60),
+				pick(hosts, NWORDS(hosts)),
+				pick(daemons, NWORDS(daemons)),
+				(int)(rnd() % 32768));
+		switch ((int)(rnd() % 8)) {
+		case 0:
+			(void) sprintf(b,
+				"Connection refused from 10.%d.%d.%d port %d",
+				(int)(rnd() % 256), (int)(rnd() % 256),
+				(int)(rnd() % 256), (int)(rnd() % 65536));
+			break;
+		case 1:
+			(void) sprintf(b, "%s: disk sd%c is %d%% full",
+				(rnd() % 2) ? "error" : "Warning",
+				(int)('a' + rnd() % 4), (int)(rnd() % 100));
+			break;
+		case 2:
+			(void) sprintf(b,
+				"retrying request %08lx-%04lX after %dms",
+				rnd(), rnd() % 65536, (int)(rnd() % 5000));
+			break;
+		case 3:
+			(void) sprintf(b,
+				"Accepted publickey for %s from 192.168.%d.%d",
+				pick(users, NWORDS(users)),
+				(int)(rnd() % 256), (int)(rnd() % 256));
+			break;
+		case 4:
+			(void) sprintf(b,
+				"%s[%d]: segfault at %08lx ip %08lx error 4",
+				pick(idents, NWORDS(idents)),
+				(int)(rnd() % 32768), rnd(), rnd());
+			break;
+		case 5:
+			(void) sprintf(b, "session opened for user %s by %s",
+				pick(users, NWORDS(users)),
+				pick(users, NWORDS(users)));
+			break;
+		case 6:
+			(void) sprintf(b,
+				"to=<%s@example.%s>, delay=%d.%d, status=%s",
+				pick(users, NWORDS(users)),
+				(rnd() % 2) ? "com" : "org",
+				(int)(rnd() % 10), (int)(rnd() % 100),
+				(rnd() % 4) ? "sent" : "deferred");
+			break;
+		default:
+			(void) sprintf(b, "FATAL: connection reset by peer");
+			break;
+		}
+	} else if (r < 7) {
+		d = (int)(rnd() % 10);
+		(void) sprintf(b,
+		"%d.%d.%d.%d - - [%02d/%s/2023:%02d:%02d:%02d +0000] "
+		"\"%s %s%d HTTP/1.1\" %d %d \"-\" \"%s\"",
+			(rnd() % 2) ? 10 : 172, (int)(rnd() % 256),
+			(int)(rnd() % 256), (int)(rnd() % 256),
+			(int)(rnd() % 28) + 1, pick(months, NWORDS(months)),
+			(int)(rnd() % 24), (int)(rnd() % 60),
+			(int)(rnd() % 60), pick(methods, NWORDS(methods)),
+			pick(paths, NWORDS(paths)), (int)(rnd() % 100000),
+			(d < 7) ? 200 : (d < 8) ? 304 : (d < 9) ? 404 : 500,
+			(int)(rnd() % 100000), pick(agents, NWORDS(agents)));
+	} else if (r < 9) {
+		n = 6 + (int)(rnd() % 11);
+		d = (rnd() % 6 == 0) ? (int)(rnd() % n) : -1;
+		for (i = 0; i < n; i++) {
+			w = pick(words, NWORDS(words));
+			b += sprintf(b, (i == 0) ? "%s" : " %s", w);
+			if (i == d)	/* the the */
+				b += sprintf(b, " %s", w);
+		}
+		(void) strcpy(b, ".");
+	} else {
+		switch ((int)(rnd() % 6)) {
+		case 0:
+			(void) sprintf(b, "\tif (%s->%s > %d)",
+					pick(idents, NWORDS(idents)),
+					pick(idents, NWORDS(idents)),
+					(int)(rnd() % 1000));
+			break;
+		case 1:
+			(void) sprintf(b, "\t\treturn(%s(%s, %d));",
+					pick(idents, NWORDS(idents)),
+					pick(idents, NWORDS(idents)),
+					(int)(rnd() % 1000));
+			break;
+		case 2:
+			*b = '\0';
+			break;
+		case 3:
+			(void) strcpy(b, "}");
+			break;
+		case 4:
+			(void) sprintf(b,
+				"static int %s(const char *%s, size_t %s)",
+					pick(idents, NWORDS(idents)),
+					pick(idents, NWORDS(idents)),
+					pick(idents, NWORDS(idents)));
+			break;
+		default:
+			(void) sprintf(b, "\t/* %s %s %s */",
+					pick(words, NWORDS(words)),
+					pick(words, NWORDS(words)),
+					pick(words, NWORDS(words)));
+			break;
+		}
+	}
+}
+
+/*
+ - gentext - make up about size bytes of text
+ == static void gentext(size_t size);
+ */
+static void
+gentext(
+    size_t size)
+{
+	char b[512];
+	size_t n;
+	size_t len = 0;
+	size_t alloc = size + sizeof(b) + 1;
+
+	text = malloc(alloc);
+	if (text == NULL) {
+		perror("rebench");
+		exit(2);
+	}
+	do {
+		genline(b);
+		n = strlen(b);
+		(void) memcpy(text + len, b, n);
+		len += n;
+		text[len++] = '\n';
+	} while (len < size);
+	textlen = len;
+}
+
+/*
+ - readtext - take the text from a file
+ == static void readtext(const char *file);
+ *
+ * A NUL in the text ends its line for regexec() but not regexec_buf(),
+ * which shows up as a difference.
+ */
+static void
+readtext(
+    const char *file)
+{
+	FILE *f;
+	size_t alloc = 65536;
+	size_t n;
+	char *nt;
+
+	f = fopen(file, "rb");
+	if (f == NULL) {
+		perror(file);
+		exit(2);
+	}
+	text = malloc(alloc);
+	textlen = 0;
+	while (text != NULL &&
+		(n = fread(text + textlen, 1, alloc - textlen - 1, f)) > 0) {
+		textlen += n;
+		if (alloc - textlen - 1 == 0) {
+			nt = realloc(text, alloc*2);
+			if (nt == NULL)
+				free(text);
+			text = nt;
+			alloc *= 2;
+		}
+	}
+	if (text == NULL) {
+		perror("rebench");
+		exit(2);
+	}
+	if (ferror(f)) {
+		perror(file);
+		exit(2);
+	}
+	(void) fclose(f);
+	if (textlen == 0) {
+		fprintf(stderr, "rebench: %s is empty\n", file);
+		exit(2);
+	}
+	if (text[textlen - 1] != '\n')
+		text[textlen++] = '\n';
+}
+
+/*
+ - splittext - make the NUL-terminated copy of the lines
+ == static void splittext(void);
+ */
+static void
+splittext(void)
+{
+	char *lbuf;
+	size_t i;
+	size_t n;
+
+	nlines = 0;
+	for (i = 0; i < textlen; i++)
+		if (text[i] == '\n')
+			nlines++;
+	lbuf = malloc(textlen);
+	lines = malloc(nlines * sizeof(char *));
+	if (lbuf == NULL || lines == NULL) {
+		perror("rebench");
+		exit(2);
+	}
+	(void) memcpy(lbuf, text, textlen);
+	lines[0] = lbuf;
+	for (i = 0, n = 1; i < textlen; i++)
+		if (lbuf[i] == '\n') {
+			lbuf[i] = '\0';
+			if (n < nlines)
+				lines[n++] = lbuf + i + 1;
+		}
+}
+
+/*
+ - addpat - add an RE to a list of them
+ == static void addpat(struct pat **pp, size_t *np, const char *re, \
+ ==	int flags);
+ *
+ * The list ends with a null entry, as corpus[] does.
+ */
+static void
+addpat(
+    struct pat **pp,
+    size_t *np,			/* entries, not counting the null one */
+    const char *re,
+    int flags)
+{
+	struct pat *p;
+
+	p = realloc(*pp, (*np + 2) * sizeof(struct pat));
+	if (p == NULL) {
+		perror("rebench");
+		exit(2);
+	}
+	p[*np].cls = "user";
+	p[*np].flags = flags;
+	p[*np].re = re;
+	(*np)++;
+	p[*np].cls = NULL;
+	p[*np].re = NULL;
+	*pp = p;
+}
+
+/*
+ - readpats - add the REs in a file, one to a line
+ == static void readpats(struct pat **pp, size_t *np, const char *file);
+ */
+static void
+readpats(
+    struct pat **pp,
+    size_t *np,
+    const char *file)
+{
+	FILE *f;
+	char b[4096];
+	char *re;
+	size_t n;
+
+	f = fopen(file, "r");
+	if (f == NULL) {
+		perror(file);
+		exit(2);
+	}
+	while (fgets(b, sizeof(b), f) != NULL) {
+		n = strlen(b);
+		if (n > 0 && b[n - 1] == '\n')
+			b[--n] = '\0';
+		re = malloc(n + 1);
+		if (re == NULL) {
+			perror("rebench");
+			exit(2);
+		}
+		(void) strcpy(re, b);
+		addpat(pp, np, re, REG_EXTENDED);
+	}
+	(void) fclose(f);
+}
+
+/*
+ - cpu - CPU time used so far
+ == static double cpu(void);
+ *
+ * CPU time rather than elapsed time, so that whatever else the machine
+ * is doing matters less.
+ */
+static double			/* seconds */
+cpu(void)
+{
+	return((double)clock() / CLOCKS_PER_SEC);
+}
+
+/*
+ - bufcount - count the matching lines with regexec_buf(), as grep does
+ == static size_t bufcount(const regex_t *re, struct re_scratch *sc);
+ */
+static size_t
+bufcount(
+    const regex_t *re,
+    struct re_scratch *sc)
+{
+	regmatch_t ln;
+	size_t len = textlen - 1;	/* not the last newline */
+	size_t off = 0;
+	size_t m = 0;
+
+	while (off <= len) {
+		if (regexec_buf_r(re, text + off, len - off, &ln, 0, sc) != 0)
+			break;
+		m++;
+		off += (size_t)ln.rm_eo + 1;
+	}
+	return(m);
+}
+
+/*
+ - xcheck - match every line with both libraries, and compare
+ == static long xcheck(const struct pat *p, const regex_t *re, \
+ ==	struct re_scratch *sc, void *h, size_t hnsub);
+ */
+static long			/* number of differences */
+xcheck(
+    const struct pat *p,
+    const regex_t *re,
+    struct re_scratch *sc,
+    void *h,			/* the host's compiled RE */
+    size_t hnsub)		/* its number of subexpressions */
+{
+	regmatch_t pm[HOST_NMATCH];
+	long off[2*HOST_NMATCH];
+	size_t nm = 1;
+	size_t i;
+	size_t k;
+	long nd = 0;
+	int r1;
+	int r2;
+	int same;
+
+	if (aflag) {
+		if (hnsub != re->re_nsub) {
+			printf("  /%s/: %lu subexpressions, host says %lu\n",
+					p->re, (unsigned long)re->re_nsub,
+					(unsigned long)hnsub);
+			return(1);
+		}
+		nm = re->re_nsub + 1;
+		if (nm > HOST_NMATCH)
+			nm = HOST_NMATCH;
+	}
+	for (i = 0; i < nlines; i++) {
+		r1 = regexec_r(re, lines[i], nm, pm, 0, sc);
+		r2 = hostexec(h, lines[i], nm, off);
+		same = ((r1 == 0) == (r2 == 0));
+		for (k = 0; same && r1 == 0 && k < nm; k++)
+			if ((long)pm[k].rm_so != off[2*k] ||
+					(long)pm[k].rm_eo != off[2*k + 1])
+				same = 0;
+		if (!same) {
+			if (vflag || nd < 3) {
+				if (nd == 0)
+					printf("  /%s/:\n", p->re);
+				showdiff(i, nm, pm, r1, off, r2);
+			}
+			nd++;
+		}
+	}
+	return(nd);
+}
+
+/*
+ - showdiff - show a line the libraries disagree about
+ == static void showdiff(size_t i, size_t nm, const regmatch_t *pm, \
+ ==	int r1, const long *off, int r2);
+ */
+static void
+showdiff(
+    size_t i,			/* which line */
+    size_t nm,
+    const regmatch_t *pm,	/* what we found, if r1 is 0 */
+    int r1,
+    const long *off,		/* what the host found, if r2 is 0 */
+    int r2)
+{
+	size_t k;
+
+	printf("    line %lu: ours", (unsigned long)i + 1);
+	if (r1 != 0)
+		printf(" none");
+	for (k = 0; r1 == 0 && k < nm; k++)
+		printf(" %ld,%ld", (long)pm[k].rm_so, (long)pm[k].rm_eo);
+	printf("; host");
+	if (r2 != 0)
+		printf(" none");
+	for (k = 0; r2 == 0 && k < nm; k++)
+		printf(" %ld,%ld", off[2*k], off[2*k + 1]);
+	printf("\n      %.70s\n", lines[i]);
+}
+
+/*
+ - tally - find or start the totals for a class
+ == static struct tally *tally(const char *cls);
+ */
+static struct tally *
+tally(
+    const char *cls)
+{
+	int i;
+
+	for (i = 0; i < ntally; i++)
+		if (strcmp(tallies[i].cls, cls) == 0)
+			return(&tallies[i]);
+	if (ntally == NTALLY)		/* lump the rest in together */
+		return(&tallies[NTALLY - 1]);
+	(void) memset(&tallies[ntally], 0, sizeof(struct tally));
+	tallies[ntally].cls = cls;
+	return(&tallies[ntally++]);
+}
+
+/*
+ - rate - MB/s, or 0 for nothing timed
+ == static double rate(double bytes, double secs);
+ */
+static double
+rate(
+    double bytes,
+    double secs)
+{
+	if (secs <= 0)
+		return(0);
+	return(bytes / secs / 1e6);
+}
+
+/*
+ - bench - time one RE and check it
+ == static void bench(const struct pat *p);
+ */
+static void
+bench(
+    const struct pat *p)
+{
+	struct tally *t = tally(p->cls);
+	struct re_scratch *sc;
+	regex_t re;
+	regmatch_t pm;
+	void *h = NULL;
+	size_t hnsub = 0;
+	size_t m = 0;
+	size_t bm = 0;
+	size_t i;
+	long nd = 0;
+	long hoff[2];
+	double t0;
+	double secs = 0;
+	double crate, lrate, brate, hrate = 0;
+	long n;
+	int flags = p->flags|REG_NEWLINE;
+	int e = 0;
+	char eb[100];
+
+	/* regcomp() */
+	n = 0;
+	t0 = cpu();
+	do {
+		e = regcomp(&re, p->re, flags);
+		if (e != 0)
+			break;
+		regfree(&re);
+		n++;
+	} while ((secs = cpu() - t0) < mintime);
+	if (e != 0) {
+		(void) regerror(e, &re, eb, sizeof(eb));
+		printf("%-11s /%s/: regcomp: %s\n", p->cls, p->re, eb);
+		t->diffs++;
+		ndiffs++;
+		return;
+	}
+	t->cbytes += (double)strlen(p->re) * n;
+	t->csecs += secs;
+	crate = rate((double)strlen(p->re) * n, secs);
+	(void) regcomp(&re, p->re, flags);
+	sc = regscratch(&re);		/* regexec_r() manages without */
+
+	/* regexec(), a line at a time */
+	n = 0;
+	t0 = cpu();
+	do {
+		m = 0;
+		for (i = 0; i < nlines; i++)
+			if (regexec_r(&re, lines[i], 1, &pm, 0, sc) == 0)
+				m++;
+		n++;
+	} while ((secs = cpu() - t0) < mintime);
+	t->lbytes += (double)textlen * n;
+	t->lsecs += secs;
+	lrate = rate((double)textlen * n, secs);
+
+	/* regexec_buf() */
+	n = 0;
+	t0 = cpu();
+	do {
+		bm = bufcount(&re, sc);
+		n++;
+	} while ((secs = cpu() - t0) < mintime);
+	t->bbytes += (double)textlen * n;
+	t->bsecs += secs;
+	brate = rate((double)textlen * n, secs);
+	if (bm != m) {
+		printf("  /%s/: regexec_buf() found %lu lines, regexec() %lu\n",
+				p->re, (unsigned long)bm, (unsigned long)m);
+		nd++;
+	}
+
+	/* the host */
+	if (host) {
+		h = hostcomp(p->re, ((p->flags&REG_EXTENDED) ? HOST_EXTENDED :
+				0) | ((p->flags&REG_ICASE) ? HOST_ICASE : 0),
+				&hnsub);
+		if (h == NULL) {
+			printf("  /%s/: the host's regcomp() fails\n", p->re);
+			nd++;
+		}
+	}
+	if (h != NULL && !oflag) {
+		n = 0;
+		t0 = cpu();
+		do {
+			for (i = 0; i < nlines; i++)
+				(void) hostexec(h, lines[i], 1, hoff);
+			n++;
+		} while ((secs = cpu() - t0) < mintime);
+		t->hbytes += (double)textlen * n;
+		t->hsecs += secs;
+		hrate = rate((double)textlen * n, secs);
+	}
+	if (h != NULL) {
+		nd += xcheck(p, &re, sc, h, hnsub);
+		hostfree(h);
+	}
+	regscratchfree(sc);
+	regfree(&re);
+
+	t->diffs += nd;
+	ndiffs += nd;
+	printf("%-11s %-2s %8.2f %9.2f %9.1f %8.1f ", p->cls,
+			(p->flags&REG_ICASE) ?
+				((p->flags&REG_EXTENDED) ? "EI" : "BI") :
+				((p->flags&REG_EXTENDED) ? "E" : "B"),
+			(crate > 0) ? strlen(p->re) / crate : 0.0, crate,
+			lrate, brate);
+	if (hrate > 0)
+		printf("%9.1f", hrate);
+	else
+		printf("%9s", "-");
+	printf(" %8lu %5ld  %s\n", (unsigned long)m, nd, p->re);
+}
+
+/*
+ - usage - complain about the arguments
+ == static void usage(void);
+ */
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: rebench [-aiovx] [-c class] [-e re] "
+		"[-f file] [-p file]\n\t\t[-S seed] [-s kbytes] "
+		"[-t seconds]\n");
+	exit(2);
+}
+
+int
+main(
+    int argc,
+    char *argv[])
+{
+	struct pat *pats = corpus;
+	struct pat *up = NULL;
+	size_t nup = 0;
+	const char *cls = NULL;
+	const char *file = NULL;
+	size_t size = 1024;
+	int xflag = 0;
+	int iflag = 0;
+	int c;
+	int i;
+
+	while ((c = getopt(argc, argv, "ac:e:f:iop:S:s:t:vx")) != -1)
+		switch (c) {
+		case 'a':
+			aflag = 1;
+			break;
+		case 'c':
+			cls = optarg;
+			break;
+		case 'e':
+			addpat(&up, &nup, optarg, REG_EXTENDED);
+			break;
+		case 'f':
+			file = optarg;
+			break;
+		case 'i':
+			iflag = 1;
+			break;
+		case 'o':
+			oflag = 1;
+			break;
+		case 'p':
+			readpats(&up, &nup, optarg);
+			break;
+		case 'S':
+			seed = strtoul(optarg, (char **)NULL, 0) & 0xffffffffUL;
+			if (seed == 0)
+				seed = 1;
+			break;
+		case 's':
+			size = (size_t)strtoul(optarg, (char **)NULL, 0);
+			if (size == 0)
+				usage();
+			break;
+		case 't':
+			mintime = atof(optarg);
+			break;
+		case 'v':
+			vflag = 1;
+			break;
+		case 'x':
+			xflag = 1;
+			break;
+		default:
+			usage();
+		}
+	if (optind != argc)
+		usage();
+	if (up != NULL) {
+		pats = up;
+		if (iflag)
+			for (i = 0; pats[i].re != NULL; i++)
+				pats[i].flags |= REG_ICASE;
+	}
+
+	if (file != NULL)
+		readtext(file);
+	else
+		gentext(size * 1024);
+	splittext();
+	if (!xflag) {
+		host = hostinit();
+		if (!host)
+			fprintf(stderr,
+			"rebench: no host regex functions, not checking\n");
+	}
+
+	printf("%lu bytes, %lu lines", (unsigned long)textlen,
+						(unsigned long)nlines);
+	if (file != NULL)
+		printf(" from %s\n\n", file);
+	else
+		printf(" generated\n\n");
+	printf("%-11s %-2s %8s %9s %9s %8s %9s %8s %5s  %s\n", "class", "",
+		"comp us", "comp MB/s", "line MB/s", "buf MB/s", "host MB/s",
+		"matches", "diffs", "RE");
+	for (i = 0; pats[i].re != NULL; i++)
+		if (cls == NULL || strcmp(cls, pats[i].cls) == 0)
+			bench(&pats[i]);
+
+	printf("\n%-11s %9s %9s %8s %9s %5s\n", "class", "comp MB/s",
+			"line MB/s", "buf MB/s", "host MB/s", "diffs");
+	for (i = 0; i < ntally; i++)
+		printf("%-11s %9.2f %9.1f %8.1f %9.1f %5ld\n",
+				tallies[i].cls,
+				rate(tallies[i].cbytes, tallies[i].csecs),
+				rate(tallies[i].lbytes, tallies[i].lsecs),
+				rate(tallies[i].bbytes, tallies[i].bsecs),
+				rate(tallies[i].hbytes, tallies[i].hsecs),
+				tallies[i].diffs);
+	if (host)
+		printf("\n%ld difference%s from the host\n", ndiffs,
+						(ndiffs == 1) ? "" : "s");
+	exit((ndiffs != 0) ? 1 : 0);
+}
@@ -72,12 +72,40 @@ struct parse {
 	sopno ssize;		/* malloced strip size (allocated) */
 	sopno slen;		/* malloced strip length (used) */
 	size_t ncsalloc;	/* number of csets allocated */
+	int *snext;		/* freezeset() hash chains, by set number */
+	int shead[NC];		/* ...and their heads, by cset hash */
+	sopno bothset[NC];	/* bothcases() set numbers plus one, by char */
+	struct urange *ur;	/* REG_UTF8: non-ASCII part of a bracket */
+	size_t nur;		/* number of ranges in it */
+	size_t urmax;		/* and allocated */
 	struct re_guts *g;
 #	define	NPAREN	10	/* we need to remember () 1-9 for back refs */
 	sopno pbegin[NPAREN];	/* -> ( ([0] unused) */
 	sopno pend[NPAREN];	/* -> ) ([0] unused) */
 };
 
+/* one branch of an alternation, for factor() */
+struct branch {
+	const sop *s;		/* its sops */
+	sopno len;		/* how many */
+};
+
+/* REG_UTF8: a range of code points, or of raw bytes at URAW and up */
+struct urange {
+	long lo;
+	long hi;
+};
+#define	URAW	0x110000L	/* past Unicode; URAW+b is lone byte b */
+#define	UMAX	0x10FFFFL
+
+/* an alternation being emitted a branch at a time, for ubracket() */
+struct alt {
+	sopno start;		/* where the OCH_ goes */
+	sopno prevback;
+	sopno prevfwd;
+	int n;			/* branches so far */
+};
+
 /* ========= begin header generated by ./mkh ========= */
 #ifdef __cplusplus
 extern "C" {
@@ -85,6 +113,9 @@ extern "C" {
 
 /* === regcomp.c === */
 static void p_ere(struct parse *p, int stop, size_t reclimit);
+static void factor(struct parse *p, sopno start, size_t reclimit);
+static void trie(struct parse *p, struct branch *br, size_t n, sopno d, size_t reclimit);
+static int brcmp(const void *a, const void *b);
 static void p_ere_exp(struct parse *p, size_t reclimit);
 static void p_str(struct parse *p);
 static void p_bre(struct parse *p, int end1, int end2, size_t reclimit);
@@ -100,6 +131,17 @@ static int othercase(int ch);
 static void bothcases(struct parse *p, int ch);
 static void ordinary(struct parse *p, int ch);
 static void nonnewline(struct parse *p);
+static void p_uchar(struct parse *p, int ch);
+static void p_b_urange(struct parse *p, cset *cs);
+static long p_b_usymbol(struct parse *p);
+static int ulen(const char *s, const char *end, long *cp);
+static long ufold(long c);
+static void uadd(struct parse *p, cset *cs, long lo, long hi);
+static int urcmp(const void *a, const void *b);
+static void ubracket(struct parse *p, cset *cs, int invert);
+static void usplit(struct parse *p, struct alt *a, long lo, long hi);
+static void ualt(struct parse *p, struct alt *a);
+static void ualtend(struct parse *p, struct alt *a);
 static void repeat(struct parse *p, sopno start, int from, int to, size_t reclimit);
 static int seterr(struct parse *p, int e);
 static cset *allocset(struct parse *p);
@@ -118,14 +160,20 @@ static void mccase(struct parse *p, cset *cs);
 static int isinsets(struct re_guts *g, int c);
 static int samesets(struct re_guts *g, int c1, int c2);
 static void categorize(struct parse *p, struct re_guts *g);
+static void classify(struct parse *p, struct re_guts *g);
 static sopno dupl(struct parse *p, sopno start, sopno finish);
 static void doemit(struct parse *p, sop op, sopno opnd);
 static void doinsert(struct parse *p, sop op, sopno opnd, sopno pos);
 static void dofwd(struct parse *p, sopno pos, sopno value);
 static int enlarge(struct parse *p, sopno size);
+static int re_reallocarr(void *ptrp, size_t n, size_t size);
 static void stripsnug(struct parse *p, struct re_guts *g);
 static void findmust(struct parse *p, struct re_guts *g);
+static sopno mustrun(struct parse *p, sop *scan, sop **startp, sop **chp, sopno *chlenp);
+static sopno mustch(struct parse *p, sop *ch, struct mustlit *ml, size_t *nbrp);
+static int mustlit(sop *start, sopno len, struct mustlit *ml);
 static sopno pluscount(struct parse *p, struct re_guts *g);
+static void specialize(struct parse *p, struct re_guts *g);
 
 #ifdef __cplusplus
 }
@@ -187,6 +235,7 @@ static int never = 0;		/* for use in asserts; shuts lint up */
  = #define	REG_NEWLINE	0010
  = #define	REG_NOSPEC	0020
  = #define	REG_PEND	0040
+ = #define	REG_UTF8	0100
  = #define	REG_DUMP	0200
  */
 int				/* 0 success, otherwise REG_something */
@@ -238,6 +287,14 @@ regcomp(
 	p->end = p->next + len;
 	p->error = 0;
 	p->ncsalloc = 0;
+	p->snext = NULL;
+	p->ur = NULL;
+	p->nur = 0;
+	p->urmax = 0;
+	for (i = 0; i < NC; i++) {
+		p->shead[i] = -1;
+		p->bothset[i] = 0;
+	}
 	for (i = 0; i < NPAREN; i++) {
 		p->pbegin[i] = 0;
 		p->pend[i] = 0;
@@ -250,13 +307,18 @@ regcomp(
 	g->iflags = 0;
 	g->nbol = 0;
 	g->neol = 0;
-	g->must = NULL;
-	g->mlen = 0;
+	g->musts = NULL;
+	g->nmusts = 0;
 	g->nsub = 0;
 	g->ncategories = 1;	/* category 0 is "everything else" */
 	g->categories = &g->catspace[-(CHAR_MIN)];
 	(void) memset((char *)g->catspace, 0, NC*sizeof(cat_t));
 	g->backrefs = 0;
+	g->maxsteps = 0;
+	g->simple = SNONE;
+	g->stab = NULL;
+	g->sfold = NULL;
+	g->slen = 0;
 
 	/* do it */
 	EMIT(OEND, 0);
@@ -272,9 +334,11 @@ regcomp(
 
 	/* tidy up loose ends and fill things in */
 	categorize(p, g);
+	classify(p, g);
 	stripsnug(p, g);
 	findmust(p, g);
 	g->nplus = pluscount(p, g);
+	specialize(p, g);
 	g->magic = MAGIC2;
 	preg->re_nsub = g->nsub;
 	preg->re_g = g;
@@ -286,6 +350,8 @@ regcomp(
 #endif
 
 	/* win or lose, we're done */
+	free(p->snext);
+	free(p->ur);
 	if (p->error != 0)	/* lose */
 		regfree(preg);
 	return(p->error);
@@ -305,6 +371,7 @@ p_ere(
 	sopno prevback = 0;	/* pacify gcc */
 	sopno prevfwd = 0; 	/* pacify gcc */
 	sopno conc;
+	sopno start = HERE();	/* where the OCH_ will go */
 	int first = 1;		/* is this the first alternative? */
 
 	assert(p != NULL);
@@ -340,11 +407,170 @@ p_ere(
 	if (!first) {		/* tail-end fixups */
 		AHEAD(prevfwd);
 		ASTERN(O_CH, prevback);
+		factor(p, start, reclimit);
 	}
 
 	assert(!MORE() || SEE(stop));
 }
 
+/*
+ - factor - rebuild an alternation of plain strings as a trie
+ == static void factor(struct parse *p, sopno start, size_t reclimit);
+ *
+ * When every branch of the alternation from start to the end of the
+ * strip is just single-character matchers, sort the branches, drop
+ * duplicates and emit each common prefix once.  A generated list of
+ * thousands of words then costs states in proportion to its trie, not
+ * its text.  Which branch matched is invisible (there are no parens
+ * inside), so the new order changes nothing but speed.  Up to MUSTMAX
+ * branches are left alone: findmust() can offer each of them whole to
+ * the prescreen, which does better with those than with bare prefixes.
+ */
+static void
+factor(
+    struct parse *p,
+    sopno start,
+    size_t reclimit)
+{
+	sopno end = HERE();
+	sopno i;
+	sopno b;
+	size_t nb;
+	sop *old;
+	struct branch *br;
+
+	if (p->error != 0 || OP(p->strip[start]) != OCH_)
+		return;
+
+	/* check the shape and count the branches */
+	nb = 0;
+	for (i = start + 1; i < end; i++)
+		switch (OP(p->strip[i])) {
+		case OCHAR:
+		case OANY:
+		case OANYOF:
+			break;
+		case OOR1:
+			if (OP(p->strip[++i]) != OOR2)
+				return;
+			nb++;
+			break;
+		case O_CH:
+			if (i != end - 1)
+				return;
+			nb++;
+			break;
+		default:
+			return;		/* not so plain after all */
+		}
+	if (nb <= MUSTMAX)
+		return;
+
+	old = malloc((size_t)(end - start) * sizeof(sop));
+	br = malloc(nb * sizeof(struct branch));
+	if (old == NULL || br == NULL) {
+		free(old);
+		free(br);
+		return;			/* leave it as it was */
+	}
+	(void) memcpy(old, p->strip + start,
+	    (size_t)(end - start) * sizeof(sop));
+
+	nb = 0;
+	for (b = i = 1; i < end - start; i++)
+		if (OP(old[i]) == OOR1 || OP(old[i]) == O_CH) {
+			br[nb].s = old + b;
+			br[nb].len = i - b;
+			nb++;
+			b = i + 2;	/* past the OOR2 */
+		}
+	qsort(br, nb, sizeof(struct branch), brcmp);
+
+	DROP(end - start);
+	trie(p, br, nb, 0, reclimit);
+	free(old);
+	free(br);
+}
+
+/*
+ - trie - emit sorted branches that agree up to d, from d on
+ == static void trie(struct parse *p, struct branch *br, size_t n, \
+ ==	sopno d, size_t reclimit);
+ *
+ * Past RECLIMIT nesting, branches are no longer merged, just emitted.
+ */
+static void
+trie(
+    struct parse *p,
+    struct branch *br,
+    size_t n,
+    sopno d,
+    size_t reclimit)
+{
+	size_t i;
+	size_t j;
+	int empty;		/* does some branch end at d? */
+	int flat = reclimit++ > RECLIMIT;
+	sopno prevback;
+	sopno prevfwd;
+
+	/* the stretch that all the branches share */
+	for (;;) {
+		empty = 0;
+		while (n > 0 && br[0].len == d) {	/* sorted first */
+			empty = 1;
+			br++;
+			n--;
+		}
+		if (n == 0)
+			return;
+		if (empty || (n > 1 && (flat || br[0].s[d] != br[n-1].s[d])))
+			break;
+		EMIT(OP(br[0].s[d]), OPND(br[0].s[d]));
+		d++;
+	}
+
+	/* a branch per distinct next sop, and maybe an empty one */
+	prevfwd = HERE();
+	prevback = prevfwd;
+	EMIT(OCH_, 0);			/* offset is wrong */
+	for (i = 0; i < n; i = j) {
+		for (j = i + 1; j < n && !flat && br[j].s[d] == br[i].s[d]; j++)
+			continue;
+		trie(p, br + i, j - i, d, reclimit);
+		if (j == n && !empty)
+			break;
+		ASTERN(OOR1, prevback);
+		prevback = THERE();
+		AHEAD(prevfwd);			/* fix previous offset */
+		prevfwd = HERE();
+		EMIT(OOR2, 0);			/* offset is very wrong */
+	}
+	AHEAD(prevfwd);
+	ASTERN(O_CH, prevback);
+}
+
+/*
+ - brcmp - qsort() comparison of branches, a prefix before its extensions
+ == static int brcmp(const void *a, const void *b);
+ */
+static int
+brcmp(
+    const void *a,
+    const void *b)
+{
+	const struct branch *x = a;
+	const struct branch *y = b;
+	sopno i;
+
+	for (i = 0; i < x->len && i < y->len; i++)
+		if (x->s[i] != y->s[i])
+			return((x->s[i] < y->s[i]) ? -1 : 1);
+	if (x->len != y->len)
+		return((x->len < y->len) ? -1 : 1);
+	return(0);
+}
+
 /*
  - p_ere_exp - parse one subERE, an atom possibly followed by a repetition op
  == static void p_ere_exp(struct parse *p, size_t reclimit);
@@ -416,7 +642,9 @@ p_ere_exp(
 		SETERROR(REG_BADRPT);
 		break;
 	case '.':
-		if (p->g->cflags&REG_NEWLINE)
+		if (p->g->cflags&REG_UTF8)
+			ubracket(p, allocset(p), 1);
+		else if (p->g->cflags&REG_NEWLINE)
 			nonnewline(p);
 		else
 			EMIT(OANY, 0);
@@ -427,7 +655,7 @@ p_ere_exp(
 	case '\\':
 		REQUIRE(MORE(), REG_EESCAPE);
 		c = GETNEXT();
-		ordinary(p, c);
+		p_uchar(p, c);
 		break;
 	case '{':		/* okay as ordinary except if digit follows */
 		REQUIRE(!MORE() || !isdigit((unsigned char)PEEK()), REG_BADRPT);
@@ -435,7 +663,7 @@ p_ere_exp(
 	default:
 		if (p->error != 0)
 			return;
-		ordinary(p, c);
+		p_uchar(p, c);
 		break;
 	}
 
@@ -512,7 +740,7 @@ p_str(
 
 	REQUIRE(MORE(), REG_EMPTY);
 	while (MORE())
-		ordinary(p, GETNEXT());
+		p_uchar(p, GETNEXT());
 }
 
 /*
@@ -595,7 +823,9 @@ p_simp_re(
 	}
 	switch (c) {
 	case '.':
-		if (p->g->cflags&REG_NEWLINE)
+		if (p->g->cflags&REG_UTF8)
+			ubracket(p, allocset(p), 1);
+		else if (p->g->cflags&REG_NEWLINE)
 			nonnewline(p);
 		else
 			EMIT(OANY, 0);
@@ -655,7 +885,7 @@ p_simp_re(
 	default:
 		if (p->error != 0)
 			return(0);
-		ordinary(p, c &~ BACKSL);
+		p_uchar(p, c &~ BACKSL);
 		break;
 	}
 
@@ -728,6 +958,7 @@ p_bracket(
 	cs = allocset(p);
 	if (cs == NULL)
 		return;
+	p->nur = 0;
 
 	/* Dept of Truly Sickening Special-Case Kludges */
 	if (p->next + 5 < p->end && strncmp(p->next, "[:<:]]",
@@ -758,6 +989,11 @@ p_bracket(
 	if (p->error != 0)	/* don't mess things up further */
 		return;
 
+	if (p->g->cflags&REG_UTF8) {
+		ubracket(p, cs, invert);
+		return;
+	}
+
 	if (p->g->cflags&REG_ICASE) {
 		ssize_t i;
 		int ci;
@@ -845,6 +1081,10 @@ p_b_term(
 		REQUIRE(EATTWO('=', ']'), REG_ECOLLATE);
 		break;
 	default:		/* symbol, ordinary character, or range */
+		if (p->g->cflags&REG_UTF8) {
+			p_b_urange(p, cs);
+			break;
+		}
 /* xxx revision needed for multichar stuff */
 		start = p_b_symbol(p);
 		if (SEE('-') && MORE2() && PEEK2() != ']') {
@@ -1012,6 +1252,12 @@ bothcases(
 
 	assert(p != NULL);
 
+	/* the set for this character never changes; make it just once */
+	if (p->bothset[(uch)ch] != 0) {
+		EMIT(OANYOF, p->bothset[(uch)ch] - 1);
+		return;
+	}
+
 	oldnext = p->next;
 	oldend = p->end;
 
@@ -1025,6 +1271,8 @@ bothcases(
 	assert(p->next == bracket+2);
 	p->next = oldnext;
 	p->end = oldend;
+	if (p->error == 0 && OP(p->strip[THERE()]) == OANYOF)
+		p->bothset[(uch)ch] = (sopno)OPND(p->strip[THERE()]) + 1;
 }
 
 /*
@@ -1046,10 +1294,11 @@ ordinary(
 		bothcases(p, uc);
 	else {
 		EMIT(OCHAR, (sopno)uc);
-		if (cap[uc] == 0) {
+		/* categories is indexed by char, not unsigned char */
+		if (cap[(int)(char)uc] == 0) {
 			assert(__type_fit(unsigned char,
 			    p->g->ncategories + 1));
-			cap[uc] = (unsigned char)p->g->ncategories++;
+			cap[(int)(char)uc] = (unsigned char)p->g->ncategories++;
 		}
 	}
 }
@@ -1085,6 +1334,470 @@ nonnewline(
 	p->end = oldend;
 }
 
+/*
+ - p_uchar - emit an ordinary character, all of it under REG_UTF8
+ == static void p_uchar(struct parse *p, int ch);
+ *
+ * ch has just been taken from the RE.  If it starts a UTF-8 sequence the
+ * rest is taken too, so that a following repetition applies to the whole
+ * character.  Bytes that are not valid UTF-8 stand for themselves.
+ */
+static void
+p_uchar(
+    struct parse *p,
+    int ch)
+{
+	const char *sp = p->next - 1;
+	long c;
+	int n;
+	int i;
+	cset *cs;
+
+	assert(p != NULL);
+
+	if (!(p->g->cflags&REG_UTF8) || (uch)ch < 0x80 ||
+				(n = ulen(sp, p->end, &c)) == 0) {
+		ordinary(p, ch);
+		return;
+	}
+	NEXTn(n - 1);
+	if ((p->g->cflags&REG_ICASE) && ufold(c) != c) {
+		cs = allocset(p);
+		if (cs == NULL)
+			return;
+		p->nur = 0;
+		uadd(p, cs, c, c);
+		ubracket(p, cs, 0);
+		return;
+	}
+	for (i = 0; i < n; i++)
+		ordinary(p, (uch)sp[i]);
+}
+
+/*
+ - p_b_urange - parse a REG_UTF8 character or range in a bracket
+ == static void p_b_urange(struct parse *p, cset *cs);
+ */
+static void
+p_b_urange(
+    struct parse *p,
+    cset *cs)
+{
+	long start;
+	long finish;
+
+	assert(p != NULL);
+	assert(cs != NULL);
+
+	start = p_b_usymbol(p);
+	if (SEE('-') && MORE2() && PEEK2() != ']') {
+		/* range */
+		NEXT();
+		if (EAT('-'))
+			finish = '-';
+		else
+			finish = p_b_usymbol(p);
+	} else
+		finish = start;
+	/* a lone byte can only range to another */
+	REQUIRE(start <= finish && (start < URAW) == (finish < URAW),
+								REG_ERANGE);
+	if (p->error == 0)
+		uadd(p, cs, start, finish);
+}
+
+/*
+ - p_b_usymbol - parse a REG_UTF8 character-list symbol
+ == static long p_b_usymbol(struct parse *p);
+ */
+static long			/* code point, or URAW + lone byte */
+p_b_usymbol(
+    struct parse *p)
+{
+	long c;
+	int n;
+
+	REQUIRE(MORE(), REG_EBRACK);
+	if (!MORE())
+		return(0);
+	if ((uch)PEEK() < 0x80)
+		return((uch)p_b_symbol(p));
+	n = ulen(p->next, p->end, &c);
+	if (n == 0)
+		return(URAW + (uch)GETNEXT());
+	NEXTn(n);
+	return(c);
+}
+
+/*
+ - ulen - length and value of the UTF-8 sequence at s
+ == static int ulen(const char *s, const char *end, long *cp);
+ *
+ * Overlong forms, surrogates and values past U+10FFFF are not valid.
+ */
+static int			/* 2..4, or 0 if not a valid multibyte sequence */
+ulen(
+    const char *s,
+    const char *end,
+    long *cp)
+{
+	const uch *u = (const uch *)s;
+	long c;
+	int n;
+	int i;
+
+	if (u[0] < 0xc2)
+		return(0);
+	else if (u[0] < 0xe0) {
+		n = 2;
+		c = u[0] & 0x1f;
+	} else if (u[0] < 0xf0) {
+		n = 3;
+		c = u[0] & 0x0f;
+	} else if (u[0] < 0xf5) {
+		n = 4;
+		c = u[0] & 0x07;
+	} else
+		return(0);
+	if (end - s < n)
+		return(0);
+	for (i = 1; i < n; i++) {
+		if ((u[i] & 0xc0) != 0x80)
+			return(0);
+		c = (c << 6) | (u[i] & 0x3f);
+	}
+	if ((n == 3 && c < 0x800) || (n == 4 && (c < 0x10000 || c > UMAX)) ||
+						(c >= 0xd800 && c <= 0xdfff))
+		return(0);
+	*cp = c;
+	return(n);
+}
+
+/*
+ - ufold - return the other case of a non-ASCII code point
+ == static long ufold(long c);
+ *
+ * Only Latin-1, Latin Extended-A, Greek and Cyrillic are known, which
+ * covers the languages our logs are written in; a full table is not
+ * worth its size here.
+ */
+static long			/* if no counterpart, return c */
+ufold(
+    long c)
+{
+	if (c >= 0xc0 && c <= 0xde && c != 0xd7)
+		return(c + 0x20);
+	if (c >= 0xe0 && c <= 0xfe && c != 0xf7)
+		return(c - 0x20);
+	if (c == 0xff)
+		return(0x178);
+	if (c == 0x178)
+		return(0xff);
+	if ((c >= 0x100 && c <= 0x12f) || (c >= 0x132 && c <= 0x137) ||
+					(c >= 0x14a && c <= 0x177))
+		return(c ^ 1);		/* even upper, odd lower */
+	if ((c >= 0x139 && c <= 0x148) || (c >= 0x179 && c <= 0x17e))
+		return((c & 1) ? c + 1 : c - 1);	/* odd upper */
+	if (c >= 0x391 && c <= 0x3a9 && c != 0x3a2)
+		return(c + 0x20);
+	if (c >= 0x3b1 && c <= 0x3c9 && c != 0x3c2)
+		return(c - 0x20);
+	if (c >= 0x400 && c <= 0x40f)
+		return(c + 0x50);
+	if (c >= 0x410 && c <= 0x42f)
+		return(c + 0x20);
+	if (c >= 0x430 && c <= 0x44f)
+		return(c - 0x20);
+	if (c >= 0x450 && c <= 0x45f)
+		return(c - 0x50);
+	return(c);
+}
+#define	UFOLDMAX	0x45f	/* ufold() changes nothing above this */
+
+/*
+ - uadd - add a REG_UTF8 range to a bracket
+ == static void uadd(struct parse *p, cset *cs, long lo, long hi);
+ *
+ * ASCII (and lone bytes) go in cs as usual; the rest is kept in p->ur.
+ */
+static void
+uadd(
+    struct parse *p,
+    cset *cs,
+    long lo,
+    long hi)
+{
+	long c;
+
+	assert(lo <= hi);
+
+	if (lo >= URAW) {
+		for (c = lo; c <= hi; c++)
+			CHadd(cs, (int)(c - URAW));
+		return;
+	}
+	for (c = lo; c <= hi && c < 0x80; c++)
+		CHadd(cs, (int)c);
+	if (hi < 0x80)
+		return;
+	if (p->nur >= p->urmax) {
+		if (re_reallocarr(&p->ur, p->urmax + 16, sizeof(struct urange))) {
+			SETERROR(REG_ESPACE);
+			return;
+		}
+		p->urmax += 16;
+	}
+	p->ur[p->nur].lo = (lo < 0x80) ? 0x80 : lo;
+	p->ur[p->nur].hi = hi;
+	p->nur++;
+}
+
+/*
+ - urcmp - qsort() comparison of ranges
+ == static int urcmp(const void *a, const void *b);
+ */
+static int
+urcmp(
+    const void *a,
+    const void *b)
+{
+	const struct urange *x = a;
+	const struct urange *y = b;
+
+	if (x->lo != y->lo)
+		return((x->lo < y->lo) ? -1 : 1);
+	return(0);
+}
+
+/*
+ - ubracket - finish and emit a REG_UTF8 bracket
+ == static void ubracket(struct parse *p, cset *cs, int invert);
+ *
+ * The ASCII part stays one set; each run of longer characters becomes a
+ * sequence of byte sets, so the matcher still goes a byte at a time.
+ * "." is the inverse of the empty bracket.  Inverting yields only valid
+ * characters, never lone bytes.
+ */
+static void
+ubracket(
+    struct parse *p,
+    cset *cs,
+    int invert)
+{
+	struct urange *r;
+	struct alt a;
+	size_t i;
+	size_t n;
+	long c;
+	long f;
+
+	assert(p != NULL);
+
+	if (cs == NULL)
+		return;
+
+	if (p->g->cflags&REG_ICASE) {
+		for (c = 0; c < 0x80; c++)
+			if (CHIN(cs, c) && isalpha((int)c) &&
+					!CHIN(cs, othercase((int)c)))
+				CHadd(cs, othercase((int)c));
+		n = p->nur;
+		for (i = 0; i < n; i++)
+			for (c = p->ur[i].lo; c <= p->ur[i].hi &&
+						c <= UFOLDMAX; c++)
+				if ((f = ufold(c)) != c)
+					uadd(p, cs, f, f);
+	}
+
+	/* sort and merge the ranges */
+	if (p->nur > 1)
+		qsort(p->ur, p->nur, sizeof(struct urange), urcmp);
+	for (i = n = 0; i < p->nur; i++)
+		if (n > 0 && p->ur[i].lo <= p->ur[n-1].hi + 1) {
+			if (p->ur[i].hi > p->ur[n-1].hi)
+				p->ur[n-1].hi = p->ur[i].hi;
+		} else
+			p->ur[n++] = p->ur[i];
+	p->nur = n;
+
+	if (invert) {
+		for (c = 0; c < NC; c++)
+			if (CHIN(cs, c))
+				CHsub(cs, (int)c);
+			else if (c < 0x80)
+				CHadd(cs, (int)c);
+		if ((p->g->cflags&REG_NEWLINE) && CHIN(cs, '\n'))
+			CHsub(cs, '\n');
+		/* the gaps between n ranges are at most n+1 ranges */
+		r = malloc((n + 1) * sizeof(struct urange));
+		if (r == NULL) {
+			SETERROR(REG_ESPACE);
+			return;
+		}
+		c = 0x80;
+		for (i = n = 0; i < p->nur; i++) {
+			if (p->ur[i].lo > c) {
+				r[n].lo = c;
+				r[n++].hi = p->ur[i].lo - 1;
+			}
+			c = p->ur[i].hi + 1;
+		}
+		if (c <= UMAX) {
+			r[n].lo = c;
+			r[n++].hi = UMAX;
+		}
+		free(p->ur);
+		p->ur = r;
+		p->urmax = p->nur + 1;
+		p->nur = n;
+	}
+
+	if (p->nur == 0 || nch(p, cs) == 0) {
+		if (p->nur == 0) {	/* just the one set, as usual */
+			if (nch(p, cs) == 1) {
+				ordinary(p, firstch(p, cs));
+				freeset(p, cs);
+			} else
+				EMIT(OANYOF, freezeset(p, cs));
+			return;
+		}
+		freeset(p, cs);
+		cs = NULL;
+	}
+
+	a.start = HERE();
+	a.n = 0;
+	if (cs != NULL) {
+		ualt(p, &a);
+		if (nch(p, cs) == 1) {
+			ordinary(p, firstch(p, cs));
+			freeset(p, cs);
+		} else
+			EMIT(OANYOF, freezeset(p, cs));
+	}
+	for (i = 0; i < p->nur; i++)
+		usplit(p, &a, p->ur[i].lo, p->ur[i].hi);
+	ualtend(p, &a);
+	p->nur = 0;
+}
+
+/*
+ - usplit - emit code points lo..hi as branches of byte sequences
+ == static void usplit(struct parse *p, struct alt *a, long lo, long hi);
+ *
+ * Split the range until every byte of the encodings of lo and hi
+ * bounds a contiguous range of bytes; then those ranges, one after
+ * another, match exactly lo..hi.  Surrogates are left out.
+ */
+static void
+usplit(
+    struct parse *p,
+    struct alt *a,
+    long lo,
+    long hi)
+{
+	static const long lens[] = { 0x7f, 0x7ff, 0xffff };
+	uch blo[4];
+	uch bhi[4];
+	long m;
+	int i;
+	int n;
+	int b;
+	cset *cs;
+
+	if (lo > hi || p->error != 0)
+		return;
+	if (lo <= 0xdfff && hi >= 0xd800) {
+		usplit(p, a, lo, 0xd7ff);
+		usplit(p, a, 0xe000, hi);
+		return;
+	}
+	for (i = 0; i < 3; i++)		/* same encoded length */
+		if (lo <= lens[i] && hi > lens[i]) {
+			usplit(p, a, lo, lens[i]);
+			usplit(p, a, lens[i] + 1, hi);
+			return;
+		}
+	for (i = 1; i < 4; i++) {	/* same leading bytes */
+		m = (1L << (6 * i)) - 1;
+		if ((lo & ~m) != (hi & ~m)) {
+			if ((lo & m) != 0) {
+				usplit(p, a, lo, lo | m);
+				usplit(p, a, (lo | m) + 1, hi);
+				return;
+			}
+			if ((hi & m) != m) {
+				usplit(p, a, lo, (hi & ~m) - 1);
+				usplit(p, a, hi & ~m, hi);
+				return;
+			}
+		}
+	}
+
+	/* encode; lo and hi have the same length here */
+	n = (hi < 0x800) ? 2 : (hi < 0x10000) ? 3 : 4;
+	for (i = n - 1; i > 0; i--) {
+		blo[i] = (uch)(0x80 | ((lo >> (6 * (n - 1 - i))) & 0x3f));
+		bhi[i] = (uch)(0x80 | ((hi >> (6 * (n - 1 - i))) & 0x3f));
+	}
+	blo[0] = (uch)(((0xf00 >> n) & 0xff) | (lo >> (6 * (n - 1))));
+	bhi[0] = (uch)(((0xf00 >> n) & 0xff) | (hi >> (6 * (n - 1))));
+
+	ualt(p, a);
+	for (i = 0; i < n; i++)
+		if (blo[i] == bhi[i])
+			ordinary(p, blo[i]);
+		else {
+			cs = allocset(p);
+			if (cs == NULL)
+				return;
+			for (b = blo[i]; b <= bhi[i]; b++)
+				CHadd(cs, b);
+			EMIT(OANYOF, freezeset(p, cs));
+		}
+}
+
+/*
+ - ualt - start another branch of an alternation
+ == static void ualt(struct parse *p, struct alt *a);
+ *
+ * As in p_ere(), but the OCH_ goes in only once a second branch shows up.
+ */
+static void
+ualt(
+    struct parse *p,
+    struct alt *a)
+{
+	if (a->n == 1) {
+		INSERT(OCH_, a->start);	/* offset is wrong */
+		a->prevfwd = a->start;
+		a->prevback = a->start;
+	}
+	if (a->n >= 1) {
+		ASTERN(OOR1, a->prevback);
+		a->prevback = THERE();
+		AHEAD(a->prevfwd);		/* fix previous offset */
+		a->prevfwd = HERE();
+		EMIT(OOR2, 0);			/* offset is very wrong */
+	}
+	a->n++;
+}
+
+/*
+ - ualtend - finish an alternation started by ualt()
+ == static void ualtend(struct parse *p, struct alt *a);
+ */
+static void
+ualtend(
+    struct parse *p,
+    struct alt *a)
+{
+	if (a->n > 1) {
+		AHEAD(a->prevfwd);
+		ASTERN(O_CH, a->prevback);
+	}
+}
+
 /*
  - repeat - generate code for a bounded repetition, recursively if needed
  == static void repeat(struct parse *p, sopno start, int from, int to,
@@ -1211,10 +1924,12 @@ allocset(
 		nbytes = nc / CHAR_BIT * css;
 		if (MEMSIZE(p) > MEMLIMIT)
 			goto oomem;
-		if (realloc(&p->g->sets, (nc * sizeof(cset))))
+		if (re_reallocarr(&p->g->sets, nc, sizeof(cset)))
+			goto oomem;
+		if (re_reallocarr(&p->snext, nc, sizeof(int)))
 			goto oomem;
 		old_ptr = p->g->setbits;
-		if (realloc(&p->g->setbits, (nc / CHAR_BIT) * css)) {
+		if (re_reallocarr(&p->g->setbits, nc / CHAR_BIT, css)) {
 			free(old_ptr);
 			goto oomem;
 		}
@@ -1273,7 +1988,8 @@ freeset(
  * of time (although the hash code minimizes the overhead), but can win
  * big if REG_ICASE is being used.  REG_ICASE, by the way, is why the hash
  * is done using addition rather than xor -- all ASCII [aA] sets xor to
- * the same value!
+ * the same value!  Frozen sets are chained by hash, so only sets that
+ * might be the same get compared.
  */
 static sopno			/* set number */
 freezeset(
@@ -1282,7 +1998,7 @@ freezeset(
 {
 	uch h;
 	size_t i;
-	cset *top;
+	int n;
 	cset *cs2;
 	size_t css;
 
@@ -1290,26 +2006,28 @@ freezeset(
 	assert(cs != NULL);
 
 	h = cs->hash;
-	top = &p->g->sets[p->g->ncsets];
 	css = (size_t)p->g->csetsize;
 
 	/* look for an earlier one which is the same */
-	for (cs2 = &p->g->sets[0]; cs2 < top; cs2++)
-		if (cs2->hash == h && cs2 != cs) {
-			/* maybe */
-			for (i = 0; i < css; i++)
-				if (!!CHIN(cs2, i) != !!CHIN(cs, i))
-					break;		/* no */
-			if (i == css)
-				break;			/* yes */
-		}
+	for (n = p->shead[h]; n >= 0; n = p->snext[n]) {
+		cs2 = &p->g->sets[n];
+		assert(cs2 != cs && cs2->hash == h);
+		for (i = 0; i < css; i++)
+			if (!!CHIN(cs2, i) != !!CHIN(cs, i))
+				break;		/* no */
+		if (i == css)
+			break;			/* yes */
+	}
 
-	if (cs2 < top) {	/* found one */
+	if (n >= 0) {		/* found one */
 		freeset(p, cs);
-		cs = cs2;
+		return (sopno)n;
 	}
 
-	return (sopno)(cs - p->g->sets);
+	n = (int)(cs - p->g->sets);
+	p->snext[n] = p->shead[h];
+	p->shead[h] = n;
+	return (sopno)n;
 }
 
 /*
@@ -1562,6 +2280,11 @@ samesets(
 /*
  - categorize - sort out character categories
  == static void categorize(struct parse *p, struct re_guts *g);
+ *
+ * A signature of each character's set membership is worked out first,
+ * so that samesets() is called only for characters that might agree;
+ * with thousands of sets that is the difference between scanning every
+ * column once per character and once per pair.
  */
 static void
 categorize(
@@ -1572,6 +2295,10 @@ categorize(
 	int c;
 	int c2;
 	cat_t cat;
+	unsigned long sig[NC];
+	uch *col;
+	size_t i;
+	size_t ncols;
 
 	assert(p != NULL);
 	assert(g != NULL);
@@ -1582,6 +2309,12 @@ categorize(
 	if (p->error != 0)
 		return;
 
+	(void) memset(sig, 0, sizeof(sig));
+	ncols = (g->ncsets+(CHAR_BIT-1)) / CHAR_BIT;
+	for (i = 0, col = g->setbits; i < ncols; i++, col += g->csetsize)
+		for (c = 0; c < NC; c++)
+			sig[c] = sig[c] * 31 + col[c];
+
 	for (c = CHAR_MIN; c <= CHAR_MAX; c++)
 		if (cats[c] == 0 && isinsets(g, c)) {
 			assert(__type_fit(unsigned char,
@@ -1589,11 +2322,74 @@ categorize(
 			cat = g->ncategories++;
 			cats[c] = cat;
 			for (c2 = c+1; c2 <= CHAR_MAX; c2++)
-				if (cats[c2] == 0 && samesets(g, c, c2))
+				if (cats[c2] == 0 &&
+				    sig[(uch)c2] == sig[(uch)c] &&
+				    samesets(g, c, c2))
 					cats[c2] = cat;
 		}
 }
 
+/*
+ - classify - sort out byte classes for the matcher's DFA
+ == static void classify(struct parse *p, struct re_guts *g);
+ *
+ * While looking at the strip, note whether anything in it can match a
+ * newline; regexec_buf() wants to know.
+ *
+ * Two bytes are in the same class if nothing in the RE can tell them
+ * apart:  same category, and alike as to being a newline (if that ends
+ * lines) and a word character (if word boundaries are used).
+ */
+static void
+classify(
+    struct parse *p,
+    struct re_guts *g)
+{
+	int seen[NC*4];
+	sopno i;
+	int c;
+	int k;
+
+	assert(p != NULL);
+	assert(g != NULL);
+
+	g->nclasses = 0;
+	if (p->error != 0)
+		return;
+
+	for (i = 0; i < p->slen; i++)
+		switch (OP(p->strip[i])) {
+		case OBOW:
+		case OEOW:
+			g->iflags |= USEWORD;
+			break;
+		case OCHAR:
+			if ((char)OPND(p->strip[i]) == '\n')
+				g->iflags |= MATCHNL;
+			break;
+		case OANY:
+			g->iflags |= MATCHNL;
+			break;
+		case OANYOF:
+			if (CHIN(&g->sets[OPND(p->strip[i])], '\n'))
+				g->iflags |= MATCHNL;
+			break;
+		}
+
+	for (k = 0; k < NC*4; k++)
+		seen[k] = -1;
+	for (c = CHAR_MIN; c <= CHAR_MAX; c++) {
+		k = g->categories[c] * 4;
+		if (c == '\n' && (g->cflags&REG_NEWLINE))
+			k += 2;
+		if ((g->iflags&USEWORD) && ISWORD(c))
+			k++;
+		if (seen[k] < 0)
+			seen[k] = (int)g->nclasses++;
+		g->classes[(uch)c] = (uch)seen[k];
+	}
+}
+
 /*
  - dupl - emit a duplicate of a bunch of sops
  == static sopno dupl(struct parse *p, sopno start, sopno finish);
@@ -1614,7 +2410,7 @@ dupl(
 	assert(finish >= start);
 	if (len == 0)
 		return(ret);
-	if (!enlarge(p, p->ssize + len))/* this many unexpected additions */
+	if (!enlarge(p, p->slen + len))	/* this many unexpected additions */
 		return ret;
 	(void)memcpy(p->strip + p->slen, p->strip + start,
 	    (size_t)len * sizeof(sop));
@@ -1647,7 +2443,7 @@ doemit(
 
 	/* deal with undersized strip */
 	if (p->slen >= p->ssize)
-		if (!enlarge(p, (p->ssize+1) / 2 * 3))	/* +50% */
+		if (!enlarge(p, p->slen + 1))	/* enlarge() adds 50% */
 			return;
 
 	/* finally, it's all reduced to the easy case */
@@ -1727,8 +2523,10 @@ enlarge(struct parse *p, sopno size)
 
 	if (p->ssize >= size)
 		return 1;
+	if (size < (p->ssize+1) / 2 * 3)
+		size = (p->ssize+1) / 2 * 3;	/* grow by half, at least */
 
-	if (MEMSIZE(p) > MEMLIMIT || realloc(&p->strip, (size * sizeof(sop)))) {
+	if (MEMSIZE(p) > MEMLIMIT || re_reallocarr(&p->strip, size, sizeof(sop))) {
 		SETERROR(REG_ESPACE);
 		return 0;
 	}
@@ -1751,32 +2549,58 @@ stripsnug(
 
 	g->nstates = p->slen;
 	g->strip = p->strip;
-	realloc(&g->strip, (p->slen * sizeof(sop)));
+	(void) re_reallocarr(&g->strip, p->slen, sizeof(sop));
 	/* Ignore error as tries to free memory only. */
 }
 
 /*
- - findmust - fill in must and mlen with longest mandatory literal string
+ - re_reallocarr - NetBSD's reallocarr(3), which other systems lack
+ == static int re_reallocarr(void *ptrp, size_t n, size_t size);
+ *
+ * ptrp points at the pointer to be reallocated; it is left alone on
+ * failure.
+ */
+static int			/* 0 success, otherwise nonzero */
+re_reallocarr(
+    void *ptrp,
+    size_t n,
+    size_t size)
+{
+	void *optr, *nptr;
+
+	if (n != 0 && size > ((size_t)-1) / n)
+		return(1);
+	(void) memcpy(&optr, ptrp, sizeof(optr));
+	nptr = realloc(optr, n * size != 0 ? n * size : 1);
+	if (nptr == NULL)
+		return(1);
+	(void) memcpy(ptrp, &nptr, sizeof(nptr));
+	return(0);
+}
+
+/*
+ - findmust - fill in musts with mandatory literal strings
  == static void findmust(struct parse *p, struct re_guts *g);
  *
- * This algorithm could do fancy things like analyzing the operands of |
- * for common subsequences.  Someday.  This code is simple and finds most
- * of the interesting cases.
+ * A match must contain the longest literal string that is not inside
+ * anything optional; or, if it is better, one of the literals from the
+ * branches of an alternation, when every branch has one.  This does not
+ * look for common subsequences in the operands of |, which would be
+ * fancier.  Someday.
  *
- * Note that must and mlen got initialized during setup.
+ * Note that musts and nmusts got initialized during setup.
  */
 static void
 findmust(
     struct parse *p,
     struct re_guts *g)
 {
-	sop *scan;
-	sop *start = NULL;
-	sop *newstart = NULL;
-	sopno newlen;
-	sop s;
-	char *cp;
-	sopno i;
+	sop *start;
+	sop *ch;
+	sopno len;
+	sopno chlen;
+	size_t n;
+	int bad;
 
 	assert(p != NULL);
 	assert(g != NULL);
@@ -1785,11 +2609,68 @@ findmust(
 	if (p->error != 0)
 		return;
 
-	/* find the longest OCHAR sequence in strip */
+	ch = NULL;
+	chlen = 0;
+	len = mustrun(p, g->strip + 1, &start, &ch, &chlen);
+	if (g->iflags&BAD)
+		return;
+	if (chlen > len)
+		(void) mustch(p, ch, (struct mustlit *)NULL, &n);
+	else if (len > 0)
+		n = 1;
+	else
+		return;		/* there isn't one */
+
+	g->musts = calloc(n, sizeof(struct mustlit));
+	if (g->musts == NULL)		/* argh; just forget it */
+		return;
+	g->nmusts = n;
+	if (chlen > len)
+		bad = (mustch(p, ch, g->musts, &n) == 0);
+	else
+		bad = mustlit(start, len, &g->musts[0]);
+	if (bad) {
+		for (n = 0; n < g->nmusts; n++)
+			if (g->musts[n].s != NULL)
+				free(g->musts[n].s);
+		free(g->musts);
+		g->musts = NULL;
+		g->nmusts = 0;
+	}
+}
+
+/*
+ - mustrun - find the longest mandatory OCHAR sequence in part of the strip
+ == static sopno mustrun(struct parse *p, sop *scan, sop **startp, \
+ ==	sop **chp, sopno *chlenp);
+ *
+ * The part ends at the OEND, or at the end of the branch it starts in.
+ * Things that are optional, and alternations, are skipped over; but if
+ * chp is not NULL, the alternation with the longest shortest-literal
+ * (see mustch()) is noted in *chp, and that length in *chlenp.
+ */
+static sopno			/* its length, 0 if there isn't one */
+mustrun(
+    struct parse *p,
+    sop *scan,
+    sop **startp,		/* where it starts, for mustlit() */
+    sop **chp,
+    sopno *chlenp)
+{
+	sop *start = NULL;
+	sop *newstart = NULL;
+	sopno len;
+	sopno newlen;
+	sopno n;
+	size_t nbr;
+	sop s;
+
+	len = 0;
 	newlen = 0;
-	scan = g->strip + 1;
-	do {
+	for (;;) {
 		s = *scan++;
+		if (OP(s) == OEND || OP(s) == OOR1 || OP(s) == O_CH)
+			break;
 		switch (OP(s)) {
 		case OCHAR:		/* sequence member */
 			if (newlen == 0)		/* new sequence */
@@ -1800,52 +2681,149 @@ findmust(
 		case OLPAREN:
 		case ORPAREN:
 			break;
+		case OCH_:		/* perhaps a better bet */
+			if (chp != NULL) {
+				n = mustch(p, scan - 1, (struct mustlit *)NULL,
+									&nbr);
+				if (n > *chlenp) {
+					*chp = scan - 1;
+					*chlenp = n;
+				}
+			}
+			/* FALLTHROUGH */
 		case OQUEST_:		/* things that must be skipped */
-		case OCH_:
 			scan--;
 			do {
 				scan += OPND(s);
+				if (scan >= p->g->strip + p->g->nstates) {
+					p->g->iflags |= BAD;
+					return(0);
+				}
 				s = *scan;
 				/* assert() interferes w debug printouts */
 				if (OP(s) != O_QUEST && OP(s) != O_CH &&
 							OP(s) != OOR2) {
-					g->iflags |= BAD;
-					return;
+					p->g->iflags |= BAD;
+					return(0);
 				}
 			} while (OP(s) != O_QUEST && OP(s) != O_CH);
+			scan++;
 			/* FALLTHROUGH */
 		default:		/* things that break a sequence */
-			if (newlen > g->mlen) {		/* ends one */
+			if (newlen > len) {		/* ends one */
 				start = newstart;
-				g->mlen = newlen;
+				len = newlen;
 			}
 			newlen = 0;
 			break;
 		}
-	} while (OP(s) != OEND);
+	}
+	if (newlen > len) {
+		start = newstart;
+		len = newlen;
+	}
 
-	if (start == NULL)
-		g->mlen = 0;
+	*startp = start;
+	return(len);
+}
 
-	if (g->mlen == 0)	/* there isn't one */
-		return;
+/*
+ - mustch - find the literals of the branches of an alternation
+ == static sopno mustch(struct parse *p, sop *ch, struct mustlit *ml, \
+ ==	size_t *nbrp);
+ *
+ * ch points at the OCH_.  If ml is not NULL, the literals are put there,
+ * one per branch; *nbrp gets the number of branches.
+ */
+static sopno			/* shortest literal, 0 if no good */
+mustch(
+    struct parse *p,
+    sop *ch,
+    struct mustlit *ml,
+    size_t *nbrp)
+{
+	sop *scan = ch;
+	sop *start;
+	sop s = *ch;
+	sopno n;
+	sopno min = 0;
+	size_t nbr = 0;
+
+	/* the first branch follows the OCH_, the others an OOR2 each */
+	do {
+		if (nbr >= MUSTMAX)
+			return(0);
+		n = mustrun(p, scan + 1, &start, (sop **)NULL, (sopno *)NULL);
+		if (n == 0)
+			return(0);
+		if (ml != NULL && mustlit(start, n, &ml[nbr]) != 0)
+			return(0);
+		nbr++;
+		if (min == 0 || n < min)
+			min = n;
+		scan += OPND(s);
+		if (scan >= p->g->strip + p->g->nstates) {
+			p->g->iflags |= BAD;
+			return(0);
+		}
+		s = *scan;
+		if (OP(s) != OOR2 && OP(s) != O_CH) {
+			p->g->iflags |= BAD;
+			return(0);
+		}
+	} while (OP(s) != O_CH);
 
-	/* turn it into a character string */
-	g->must = malloc((size_t)g->mlen + 1);
-	if (g->must == NULL) {		/* argh; just forget it */
-		g->mlen = 0;
-		return;
-	}
-	cp = g->must;
-	scan = start;
-	for (i = g->mlen; i > 0; i--) {
+	*nbrp = nbr;
+	return(min);
+}
+
+/*
+ - mustlit - turn an OCHAR sequence into a string for the prescreen
+ == static int mustlit(sop *start, sopno len, struct mustlit *ml);
+ *
+ * The prescreen looks first for the byte that seems least likely to be
+ * common, going by a rough idea of what text is made of.
+ */
+static int			/* 0 success, otherwise nonzero */
+mustlit(
+    sop *start,
+    sopno len,
+    struct mustlit *ml)
+{
+	static const char common[] =
+		" etaoinsrhldcumfpgwybvkxjqz\n_.,;:()=-0123456789"
+		"ETAOINSRHLDCUMFPGWYBVKXJQZ";
+	sop *scan = start;
+	sop s;
+	char *cp;
+	const char *r;
+	size_t rank;
+	size_t best;
+	sopno i;
+
+	ml->s = malloc((size_t)len + 1);
+	if (ml->s == NULL)
+		return(1);
+	ml->len = len;
+	cp = ml->s;
+	for (i = len; i > 0; i--) {
 		while (OP(s = *scan++) != OCHAR)
 			continue;
-		assert(cp < g->must + g->mlen);
 		*cp++ = (char)OPND(s);
 	}
-	assert(cp == g->must + g->mlen);
 	*cp++ = '\0';		/* just on general principles */
+
+	ml->guard = 0;
+	best = 0;
+	for (i = 0; i < len; i++) {
+		r = (ml->s[i] == '\0') ? NULL : strchr(common, ml->s[i]);
+		rank = (r == NULL) ? sizeof(common) : (size_t)(r - common);
+		if (rank > best) {
+			best = rank;
+			ml->guard = i;
+		}
+	}
+	return(0);
 }
 
 /*
@@ -1886,3 +2864,122 @@ pluscount(
 		g->iflags |= BAD;
 	return(maxnest);
 }
+
+/*
+ - specialize - see whether simple() can match the RE by itself
+ == static void specialize(struct parse *p, struct re_guts *g);
+ *
+ * Without parentheses, a string of ordinary characters, or of characters
+ * alike up to case, or a single bracket expression or `.', always matches
+ * that many characters; so the first place it matches, with the anchors
+ * (if any) holding, is the leftmost-longest match, and a plain search
+ * finds it.  The string up to case goes through a map from each byte to
+ * its lower case, which must pick out exactly each position's characters;
+ * anything else is left to the matchers.
+ */
+static void
+specialize(
+    struct parse *p,
+    struct re_guts *g)
+{
+	sop *scan;
+	sop *end;
+	sop s;
+	cset *cs;
+	size_t n;
+	size_t nchar;
+	size_t i;
+	int c;
+	int lc;
+
+	assert(p != NULL);
+	assert(g != NULL);
+
+	if (p->error != 0 || (g->iflags&BAD) || g->nsub > 0)
+		return;
+
+	scan = g->strip + g->firststate + 1;
+	end = g->strip + g->laststate;
+	if (scan < end && OP(*scan) == OBOL)
+		scan++;
+	if (end > scan && OP(*(end-1)) == OEOL)
+		end--;
+	if (scan >= end)
+		return;		/* nothing but anchors */
+	n = (size_t)(end - scan);
+	nchar = 0;
+	for (i = 0; i < n; i++)
+		switch (OP(scan[i])) {
+		case OCHAR:
+			nchar++;
+			break;
+		case OANY:
+		case OANYOF:
+			break;
+		default:
+			return;
+		}
+
+	if (nchar == n) {
+		/* findmust() has already made it into a literal */
+		if (g->nmusts != 1 || g->musts[0].len != n)
+			return;
+		g->slen = n;
+		g->simple = SLIT;
+		return;
+	}
+
+	g->stab = malloc(NC);
+	if (g->stab == NULL)
+		return;
+	if (n == 1) {
+		s = *scan;
+		cs = (OP(s) == OANYOF) ? &g->sets[OPND(s)] : NULL;
+		for (c = 0; c < NC; c++)
+			g->stab[c] = (uch)(cs == NULL || CHIN(cs, c));
+		g->slen = 1;
+		g->simple = SSET;
+		return;
+	}
+
+	for (c = 0; c < NC; c++)
+		g->stab[c] = (uch)(isupper(c) ? tolower(c) : c);
+	g->sfold = malloc(n);
+	if (g->sfold == NULL) {
+		free(g->stab);
+		g->stab = NULL;
+		return;
+	}
+	for (i = 0; i < n; i++) {
+		s = scan[i];
+		if (OP(s) == OANY)
+			break;
+		cs = (OP(s) == OANYOF) ? &g->sets[OPND(s)] : NULL;
+		if (cs == NULL)
+			lc = g->stab[(uch)OPND(s)];
+		else {
+			for (c = 0; c < NC; c++)
+				if (CHIN(cs, c))
+					break;
+			if (c == NC)
+				break;		/* empty set */
+			lc = g->stab[c];
+		}
+		for (c = 0; c < NC; c++)
+			if ((cs == NULL ? c == (uch)OPND(s) : CHIN(cs, c) != 0) !=
+							(g->stab[c] == lc))
+				break;
+		if (c < NC)
+			break;		/* the map gets this one wrong */
+		g->sfold[i] = (char)lc;
+	}
+	if (i < n) {
+		free(g->stab);
+		g->stab = NULL;
+		free(g->sfold);
+		g->sfold = NULL;
+		return;
+	}
+	g->slen = n;
+	g->simple = SFOLD;
+}
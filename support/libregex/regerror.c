@@ -81,6 +81,7 @@ static const char *regatoi(const regex_t *preg, char *localbuf, size_t buflen);
  = #define	REG_EMPTY	14
  = #define	REG_ASSERT	15
  = #define	REG_INVARG	16
+ = #define	REG_ELIMIT	18
  = #define	REG_ATOI	255	// convert name to number (!)
  = #define	REG_ITOA	0400	// convert number to name (!)
  */
@@ -105,6 +106,7 @@ static const struct rerr {
 	{ REG_EMPTY,	"REG_EMPTY",	"empty (sub)expression" },
 	{ REG_ASSERT,	"REG_ASSERT",	"\"can't happen\" -- you found a bug" },
 	{ REG_INVARG,	"REG_INVARG",	"invalid argument to regex routine" },
+	{ REG_ELIMIT,	"REG_ELIMIT",	"back-reference step limit exceeded" },
 	{ 0,		"",		"*** unknown regexp error code ***" }
 };
 
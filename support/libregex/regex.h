@@ -47,6 +47,8 @@
 #ifdef __SVR4__
 typedef unsigned long uint32_t;
 typedef signed long ssize_t;
+#else
+#include <stdint.h>
 #endif
 
 /* types */
@@ -72,6 +74,7 @@ typedef struct {
 #define	REG_NEWLINE	0010
 #define	REG_NOSPEC	0020
 #define	REG_PEND	0040
+#define	REG_UTF8	0100
 #define	REG_DUMP	0200
 
 /* regerror() flags */
@@ -92,6 +95,7 @@ typedef struct {
 #define	REG_ASSERT	15
 #define	REG_INVARG	16
 #define	REG_ENOSYS	17
+#define	REG_ELIMIT	18
 #define	REG_ATOI	255	/* convert name to number (!) */
 #define	REG_ITOA	0400	/* convert number to name (!) */
 
@@ -108,6 +112,36 @@ size_t	regerror(int, const regex_t *, char *, size_t);
 int	regexec(const regex_t *,
 	    const char *, size_t, regmatch_t [], int);
 void	regfree(regex_t *);
+int	regexec_buf(const regex_t *,
+	    const char *, size_t, regmatch_t *, int);
+#define	REGEXEC_BUF		/* regexec_buf() is available */
+int	reglimit(regex_t *, unsigned long);
+#define	REGLIMIT		/* reglimit() is available */
+struct re_scratch;
+struct re_scratch *regscratch(const regex_t *);
+void	regscratchfree(struct re_scratch *);
+int	regexec_r(const regex_t *,
+	    const char *, size_t, regmatch_t [], int, struct re_scratch *);
+int	regexec_buf_r(const regex_t *,
+	    const char *, size_t, regmatch_t *, int, struct re_scratch *);
+#define	REGSCRATCH		/* regscratch() and friends are available */
+struct regstats {		/* what searches through a context did */
+	unsigned long simple;	/* searches that needed no state sets */
+	unsigned long small;	/* searches with the small state sets */
+	unsigned long large;	/* searches with the large state sets */
+	unsigned long mustrejects;	/* searches the musts turned away */
+	unsigned long fastbytes;	/* bytes through fast() */
+	unsigned long faststeps;	/* of those, bytes its DFA did not know */
+	unsigned long slowcalls;	/* slow() calls */
+	unsigned long slowbytes;	/* bytes through slow() */
+	unsigned long startretries;	/* extra passes to find a match's start */
+	unsigned long falsealarms;	/* matches back references disproved */
+	unsigned long backrefsteps;	/* backref() calls */
+	unsigned long backrefdepth;	/* deepest backref() recursion */
+	unsigned long buflines;	/* lines regexec_buf() handed on */
+};
+int	regstats(const struct re_scratch *, struct regstats *);
+#define	REGSTATS		/* regstats() is available */
 #ifdef _NETBSD_SOURCE
 ssize_t regnsub(char *, size_t, const char *, const regmatch_t *, const char *);
 ssize_t regasub(char **buf, const char *, const regmatch_t *, const char *);
@@ -138,11 +138,24 @@ typedef struct {
 #define	MCsub(p, cs, cp)	mcsub(p, cs, cp)
 #define	MCin(p, cs, cp)	mcin(p, cs, cp)
 
+/* a literal string that a match must contain */
+struct mustlit {
+	char *s;		/* the string */
+	size_t len;		/* its length */
+	size_t guard;		/* offset of its least common-looking byte */
+};
+#define	MUSTMAX	8		/* most musts findmust() will offer */
+
 /* stuff for character categories */
 typedef unsigned char cat_t;
 
 /*
  * main compiled-expression structure
+ *
+ * Only regcomp() and reglimit() write to this.  The matchers just read it,
+ * keeping what they need per call in a struct match (engine.c) and between
+ * calls in a struct re_scratch, so any number of threads can search with
+ * one compiled RE at once.
  */
 struct re_guts {
 	int magic;
@@ -160,15 +173,28 @@ struct re_guts {
 #		define	USEBOL	01	/* used ^ */
 #		define	USEEOL	02	/* used $ */
 #		define	BAD	04	/* something wrong */
+#		define	USEWORD	010	/* used [[:<:]] or [[:>:]] */
+#		define	MATCHNL	020	/* something can match a newline */
 	size_t nbol;		/* number of ^ used */
 	size_t neol;		/* number of $ used */
 	size_t ncategories;	/* how many character categories */
 	cat_t *categories;	/* ->catspace[-CHAR_MIN] */
-	char *must;		/* match must contain this string */
-	size_t mlen;		/* length of must */
+	struct mustlit *musts;	/* match must contain one of these */
+	size_t nmusts;		/* how many musts, 0 if no such luck */
 	size_t nsub;		/* copy of re_nsub */
 	int backrefs;		/* does it use back references? */
 	sopno nplus;		/* how deep does it nest +s? */
+	size_t nclasses;	/* how many byte classes */
+	uch classes[NC];	/* byte class, indexed by (uch) */
+	unsigned long maxsteps;	/* backref() step budget, 0 for none */
+	int simple;		/* what simple() can do for it */
+#		define	SNONE	0	/* nothing; the matchers do it all */
+#		define	SLIT	1	/* find musts[0] */
+#		define	SFOLD	2	/* find sfold, mapping bytes by stab */
+#		define	SSET	3	/* find a byte that is in stab */
+	uch *stab;		/* [NC] SFOLD case map or SSET members */
+	char *sfold;		/* [slen] SFOLD's string, already mapped */
+	size_t slen;		/* length of every match, if simple */
 	/* catspace must be last */
 	cat_t catspace[1];	/* actually [NC] */
 };
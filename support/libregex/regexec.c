@@ -48,6 +48,7 @@
 #include <assert.h>
 #include <ctype.h>
 #include <limits.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -72,6 +73,8 @@ __weak_alias(regexec,_regexec)
 #define	STATEVARS	int dummy	/* dummy version */
 #define	STATESETUP(m, n)	/* nothing */
 #define	STATETEARDOWN(m)	/* nothing */
+#define	STATEBYTES(m)	sizeof(unsigned long)
+#define	STATEMEM(v)	((char *)&(v))
 #define	SETUP(v)	((v) = 0)
 #define	onestate	unsigned long
 #define	INIT(o, n)	((o) = (unsigned long)1 << (n))
@@ -82,6 +85,9 @@ __weak_alias(regexec,_regexec)
 #define	FWD(dst, src, n)	((dst) |= ((unsigned long)(src)&(here)) << (n))
 #define	BACK(dst, src, n)	((dst) |= ((unsigned long)(src)&(here)) >> (n))
 #define	ISSETBACK(v, n)	(((v) & ((unsigned long)here >> (n))) != 0)
+/* is no state at o or later on in either set? */
+#define	IDLE(a, b, o)	((((a) | (b)) & ~((o) - 1)) == 0)
+#define	WORDEND(pc, stop)	((stop) - 1)
 /* function names */
 #define SNAMES			/* engine.c looks after details */
 
@@ -98,6 +104,8 @@ __weak_alias(regexec,_regexec)
 #undef	STATEVARS
 #undef	STATESETUP
 #undef	STATETEARDOWN
+#undef	STATEBYTES
+#undef	STATEMEM
 #undef	SETUP
 #undef	onestate
 #undef	INIT
@@ -106,39 +114,161 @@ __weak_alias(regexec,_regexec)
 #undef	FWD
 #undef	BACK
 #undef	ISSETBACK
+#undef	IDLE
+#undef	WORDEND
 #undef	SNAMES
 
 /* macros for manipulating states, large version */
-#define	states	char *
-#define	CLEAR(v)	memset(v, 0, (size_t)m->g->nstates)
-#define	SET0(v, n)	((v)[n] = 0)
-#define	SET1(v, n)	((v)[n] = 1)
-#define	ISSET(v, n)	((v)[n])
-#define	ASSIGN(d, s)	memcpy(d, s, (size_t)m->g->nstates)
-#define	EQ(a, b)	(memcmp(a, b, (size_t)m->g->nstates) == 0)
-#define	STATEVARS	int vn; char *space
+/* states are packed LBITS to a word, so whole words go at once */
+#define	LBITS	(CHAR_BIT*sizeof(unsigned long))
+#define	LWORDS(g)	(((size_t)(g)->nstates + LBITS - 1) / LBITS)
+#define	LWORD(n)	((size_t)(n) / LBITS)
+#define	LBIT(n)	((unsigned long)1 << ((size_t)(n) % LBITS))
+#define	states	unsigned long *
+#define	CLEAR(v)	memset(v, 0, STATEBYTES(m))
+#define	SET0(v, n)	((v)[LWORD(n)] &= ~LBIT(n))
+#define	SET1(v, n)	((v)[LWORD(n)] |= LBIT(n))
+#define	ISSET(v, n)	(((v)[LWORD(n)] & LBIT(n)) != 0)
+#define	ASSIGN(d, s)	memcpy(d, s, STATEBYTES(m))
+#define	EQ(a, b)	(memcmp(a, b, STATEBYTES(m)) == 0)
+#define	STATEVARS	int vn; unsigned long *space
 #define	STATESETUP(m, nv) \
-    if (((m)->space = malloc((size_t)((nv)*(m)->g->nstates))) == NULL) \
+    if (((m)->space = ((m)->sc != NULL) ? (m)->sc->space : NULL) == NULL && \
+	((m)->space = malloc((nv)*STATEBYTES(m))) == NULL) \
 	return(REG_ESPACE); \
     else \
 	(m)->vn = 0
 
-#define	STATETEARDOWN(m)	{ free((m)->space); m->space = NULL; }
-#define	SETUP(v)	((v) = &m->space[(size_t)(m->vn++ * m->g->nstates)])
-#define	onestate	int
-#define	INIT(o, n)	((o) = (int)(n))
+#define	STATETEARDOWN(m) \
+    { \
+	if ((m)->sc != NULL) \
+		(m)->sc->space = (m)->space; \
+	else \
+		free((m)->space); \
+	(m)->space = NULL; \
+    }
+#define	STATEBYTES(m)	(LWORDS((m)->g) * sizeof(unsigned long))
+#define	STATEMEM(v)	((char *)(v))
+#define	SETUP(v)	((v) = &m->space[(size_t)m->vn++ * LWORDS(m->g)])
+#define	onestate	sopno
+#define	INIT(o, n)	((o) = (n))
 #define	INC(o)	((o)++)
-#define	ISSTATEIN(v, o)	((v)[o])
+#define	ISSTATEIN(v, o)	ISSET(v, o)
+/* is no state at o or later in o's word on in either set? */
+#define	IDLE(a, b, o) \
+    ((((a)[LWORD(o)] | (b)[LWORD(o)]) >> ((size_t)(o) % LBITS)) == 0)
+#define	WORDEND(pc, stop)	((sopno)(LWORD(pc) * LBITS + LBITS - 1))
 /* some abbreviations; note that some of these know variable names! */
 /* do "if I'm here, I can also be there" etc without branches */
-#define	FWD(dst, src, n)	((dst)[here+(n)] |= (src)[here])
-#define	BACK(dst, src, n)	((dst)[here-(n)] |= (src)[here])
-#define	ISSETBACK(v, n)	((v)[here - (n)])
+#define	FWD(dst, src, n)	((dst)[LWORD(here+(n))] |= \
+	(((src)[LWORD(here)] >> ((size_t)here % LBITS)) & 1) << \
+	((size_t)(here+(n)) % LBITS))
+#define	BACK(dst, src, n)	((dst)[LWORD(here-(n))] |= \
+	(((src)[LWORD(here)] >> ((size_t)here % LBITS)) & 1) << \
+	((size_t)(here-(n)) % LBITS))
+#define	ISSETBACK(v, n)	ISSET(v, here - (n))
 /* function names */
 #define	LNAMES			/* flag */
 
 #include "engine.c"
 
+/*
+ - simple - match an RE that specialize() found simple
+ == static int simple(struct re_guts *g, const char *string, size_t nmatch, \
+ ==	regmatch_t pmatch[], int eflags);
+ *
+ * Every match is g->slen characters long, so the first place where the
+ * characters match and the anchors hold is the answer.  Without
+ * REG_NEWLINE an anchor leaves just one place to look.
+ */
+static int			/* 0 success, REG_NOMATCH failure */
+simple(
+    struct re_guts *g,
+    const char *string,
+    size_t nmatch,
+    regmatch_t pmatch[],
+    int eflags)
+{
+	const char *start;
+	const char *stop;
+	const char *p;
+	const char *q;
+	const char *last;	/* last place a match can start */
+	const size_t n = g->slen;
+	const int nl = (g->cflags&REG_NEWLINE) != 0;
+	size_t i;
+
+	if (eflags&REG_STARTEND) {
+		assert(pmatch != NULL);
+		start = string + (size_t)pmatch[0].rm_so;
+		stop = string + (size_t)pmatch[0].rm_eo;
+	} else {
+		start = string;
+		stop = start + strlen(start);
+	}
+	if (stop < start)
+		return(REG_INVARG);
+	if ((size_t)(stop - start) < n)
+		return(REG_NOMATCH);
+
+	p = start;
+	last = stop - n;
+	if ((g->iflags&USEBOL) && !nl)
+		last = start;		/* the only line start */
+	if ((g->iflags&USEEOL) && !nl)
+		p = stop - n;		/* the only line end */
+
+	for (; p <= last; p++) {
+		/* the next place the characters match */
+		switch (g->simple) {
+		case SLIT:
+			p = memfind(p, last + n, &g->musts[0]);
+			if (p == NULL)
+				return(REG_NOMATCH);
+			break;
+		case SFOLD:
+			for (; p <= last; p++) {
+				for (i = 0; i < n; i++)
+					if (g->stab[(uch)p[i]] != (uch)g->sfold[i])
+						break;
+				if (i == n)
+					break;
+			}
+			break;
+		case SSET:
+			while (p <= last && !g->stab[(uch)*p])
+				p++;
+			break;
+		}
+		if (p > last)
+			break;
+
+		/* do the anchors hold there? */
+		if ((g->iflags&USEBOL) && !((p == start) ?
+				!(eflags&REG_NOTBOL) : (nl && *(p-1) == '\n'))) {
+			if (!nl)
+				break;
+			q = memchr(p, '\n', (size_t)(last - p));
+			if (q == NULL)
+				break;
+			p = q;		/* and on to the next line */
+			continue;
+		}
+		if ((g->iflags&USEEOL) && !((p + n == stop) ?
+				!(eflags&REG_NOTEOL) : (nl && p[n] == '\n')))
+			continue;
+
+		if (nmatch > 0) {
+			pmatch[0].rm_so = p - string;
+			pmatch[0].rm_eo = p + n - string;
+			for (i = 1; i < nmatch; i++)
+				pmatch[i].rm_so = pmatch[i].rm_eo = (regoff_t)-1;
+		}
+		return(0);
+	}
+	return(REG_NOMATCH);
+}
+
 /*
  - regexec - interface for matching
  = extern int regexec(const regex_t *, const char *, size_t, \
@@ -161,6 +291,26 @@ regexec(
     size_t nmatch,
     regmatch_t pmatch[],
     int eflags)
+{
+	return(regexec_r(preg, string, nmatch, pmatch, eflags,
+						(struct re_scratch *)NULL));
+}
+
+/*
+ - regexec_r - regexec() with a scratch context
+ = extern int regexec_r(const regex_t *, const char *, size_t, \
+ =				regmatch_t [], int, struct re_scratch *);
+ *
+ * sc is from regscratch() for this RE, or NULL to work as regexec().
+ */
+int				/* 0 success, REG_NOMATCH failure */
+regexec_r(
+    const regex_t *preg,
+    const char *string,
+    size_t nmatch,
+    regmatch_t pmatch[],
+    int eflags,
+    struct re_scratch *sc)
 {
 	struct re_guts *g = preg->re_g;
 	char *s;
@@ -178,12 +328,348 @@ regexec(
 	assert(!(g->iflags&BAD));
 	if (g->iflags&BAD)		/* backstop for no-debug case */
 		return(REG_BADPAT);
+	if (sc != NULL && sc->g != g)
+		return(REG_INVARG);
 	eflags = GOODFLAGS(eflags);
 
 	s = (char*) string;
+	if (g->cflags&REG_NOSUB)
+		nmatch = 0;
+
+	if (g->simple != SNONE && !(eflags&(REG_LARGE|REG_BACKR))) {
+		if (sc != NULL)
+			sc->stats.simple++;
+		return(simple(g, s, nmatch, pmatch, eflags));
+	}
+
+	if (g->nstates <= (sopno)(CHAR_BIT*sizeof(states1)) && !(eflags&REG_LARGE)) {
+		if (sc != NULL)
+			sc->stats.small++;
+		return(smatcher(g, s, nmatch, pmatch, eflags, sc));
+	} else {
+		if (sc != NULL)
+			sc->stats.large++;
+		return(lmatcher(g, s, nmatch, pmatch, eflags, sc));
+	}
+}
+
+#define	MUSTWIN	256	/* regexec_buf()'s first look for a must */
+
+/*
+ - regexec_buf - find the first line of a buffer that matches
+ = extern int regexec_buf(const regex_t *, const char *, size_t, \
+ =					regmatch_t *, int);
+ *
+ * The buffer is len bytes of newline-separated lines, and need not be
+ * NUL-terminated.  On a match, *line gets the offsets of the start and
+ * end (not counting the newline) of the line the match is in.  With
+ * REG_NEWLINE a match is always within one line, even for an RE such as
+ * [[:space:]] that can match a newline; without it, a match can span
+ * lines, and *line then covers all of them.  REG_NOTBOL and REG_NOTEOL
+ * say that the buffer does not begin or end at a line boundary, as for
+ * regexec().
+ *
+ * If the RE was compiled with REG_NEWLINE and nothing in it matches a
+ * newline, then a match is within a line, and one that must contain a
+ * literal is within a line that contains it; so only those lines need
+ * to be looked at.  Otherwise the whole buffer goes to regexec().
+ * The musts are looked for no further than the nearest one found so
+ * far, or than a window that starts at MUSTWIN bytes and doubles, so a
+ * must that is rare or missing costs little more than a common one; and
+ * where each was found, or how far it is known not to be, is remembered
+ * from line to line, so nothing is searched twice.
+ */
+int				/* 0 success, REG_NOMATCH failure */
+regexec_buf(
+    const regex_t *preg,
+    const char *buf,
+    size_t len,
+    regmatch_t *line,
+    int eflags)
+{
+	return(regexec_buf_r(preg, buf, len, line, eflags,
+						(struct re_scratch *)NULL));
+}
+
+/*
+ - regexec_buf_r - regexec_buf() with a scratch context
+ = extern int regexec_buf_r(const regex_t *, const char *, size_t, \
+ =				regmatch_t *, int, struct re_scratch *);
+ */
+int				/* 0 success, REG_NOMATCH failure */
+regexec_buf_r(
+    const regex_t *preg,
+    const char *buf,
+    size_t len,
+    regmatch_t *line,
+    int eflags,
+    struct re_scratch *sc)
+{
+	struct re_guts *g = preg->re_g;
+	regmatch_t pm;
+	const char *p;
+	const char *end = buf + len;
+	const char *q;
+	const char *dp;
+	const char *ls;
+	const char *le;
+	const char *lim;
+	const char *wend;
+	const char *at[MUSTMAX];	/* where each must was found */
+	const char *clear[MUSTMAX];	/* or none starts before here */
+	const struct mustlit *ml;
+	size_t win;
+	size_t i;
+	int ef;
+	int r;
+
+	assert(preg != NULL);
+	assert(buf != NULL);
+	assert(line != NULL);
+
+	if (preg->re_magic != MAGIC1 || g->magic != MAGIC2)
+		return(REG_BADPAT);
+	if (g->iflags&BAD)
+		return(REG_BADPAT);
+	if (sc != NULL && sc->g != g)
+		return(REG_INVARG);
+	eflags &= REG_NOTBOL|REG_NOTEOL;
+
+	if ((g->cflags&REG_NEWLINE) && !(g->iflags&MATCHNL) &&
+							g->nmusts > 0) {
+		for (i = 0; i < g->nmusts; i++) {
+			at[i] = NULL;
+			clear[i] = buf;
+		}
+		win = MUSTWIN;
+		for (p = buf; ; p = le + 1) {
+			/* the first line with any of the musts */
+			q = NULL;
+			for (i = 0; i < g->nmusts; i++) {
+				if (at[i] != NULL && at[i] < p)
+					at[i] = NULL;	/* on a line that failed */
+				if (at[i] != NULL && (q == NULL || at[i] < q))
+					q = at[i];
+			}
+			for (;;) {
+				/* look no further than the nearest one yet */
+				if (q != NULL)
+					wend = q;
+				else
+					wend = ((size_t)(end - p) > win) ? p + win : end;
+				for (i = 0; i < g->nmusts; i++) {
+					ml = &g->musts[i];
+					if (at[i] != NULL || clear[i] >= wend)
+						continue;
+					dp = (clear[i] > p) ? clear[i] : p;
+					lim = ((size_t)(end - wend) < ml->len) ? end :
+							wend + ml->len - 1;
+					at[i] = memfind(dp, lim, ml);
+					if (at[i] == NULL)
+						clear[i] = wend;
+					else
+						q = wend = at[i];
+				}
+				if (q != NULL || wend == end)
+					break;
+				win *= 2;
+			}
+			if (q == NULL)
+				break;
+			for (ls = q; ls > p && *(ls-1) != '\n'; ls--)
+				continue;
+			le = memchr(q, '\n', (size_t)(end - q));
+			if (le == NULL)
+				le = end;
 
-	if (g->nstates <= (sopno)(CHAR_BIT*sizeof(states1)) && !(eflags&REG_LARGE))
-		return(smatcher(g, s, nmatch, pmatch, eflags));
-	else
-		return(lmatcher(g, s, nmatch, pmatch, eflags));
+			ef = REG_STARTEND;
+			if (ls == buf)
+				ef |= eflags&REG_NOTBOL;
+			if (le == end)
+				ef |= eflags&REG_NOTEOL;
+			pm.rm_so = 0;
+			pm.rm_eo = le - ls;
+			if (sc != NULL)
+				sc->stats.buflines++;
+			r = regexec_r(preg, ls, (size_t)0, &pm, ef, sc);
+			if (r == 0) {
+				line->rm_so = ls - buf;
+				line->rm_eo = le - buf;
+				return(0);
+			}
+			if (r != REG_NOMATCH)
+				return(r);
+			if (le == end)
+				break;
+		}
+		return(REG_NOMATCH);
+	}
+
+	/* straight to the matcher, which knows nothing of REG_NOSUB */
+	for (p = buf; ; p = le + 1) {
+		pm.rm_so = p - buf;
+		pm.rm_eo = (regoff_t)len;
+		ef = REG_STARTEND | (eflags&REG_NOTEOL);
+		if (p == buf)
+			ef |= eflags&REG_NOTBOL;
+		if (g->simple != SNONE) {
+			if (sc != NULL)
+				sc->stats.simple++;
+			r = simple(g, buf, (size_t)1, &pm, ef);
+		} else if (g->nstates <= (sopno)(CHAR_BIT*sizeof(states1))) {
+			if (sc != NULL)
+				sc->stats.small++;
+			r = smatcher(g, buf, (size_t)1, &pm, ef, sc);
+		} else {
+			if (sc != NULL)
+				sc->stats.large++;
+			r = lmatcher(g, buf, (size_t)1, &pm, ef, sc);
+		}
+		if (r != 0)
+			return(r);
+		for (ls = buf + pm.rm_so; ls > p && *(ls-1) != '\n'; ls--)
+			continue;
+		le = memchr(ls, '\n', (size_t)(end - ls));
+		if (le == NULL)
+			le = end;
+		if (!(g->cflags&REG_NEWLINE) || buf + pm.rm_eo <= le)
+			break;
+
+		/*
+		 * A bracket expression can match a newline even with
+		 * REG_NEWLINE, so the match runs on into the next line.
+		 * That says nothing about this line alone; ask again.
+		 */
+		ef = REG_STARTEND;
+		if (ls == buf)
+			ef |= eflags&REG_NOTBOL;
+		if (le == end)
+			ef |= eflags&REG_NOTEOL;
+		pm.rm_so = 0;
+		pm.rm_eo = le - ls;
+		r = regexec_r(preg, ls, (size_t)0, &pm, ef, sc);
+		if (r == 0) {
+			line->rm_so = ls - buf;
+			line->rm_eo = le - buf;
+			return(0);
+		}
+		if (r != REG_NOMATCH)
+			return(r);
+		if (le == end)
+			return(REG_NOMATCH);
+	}
+	if (buf + pm.rm_eo > le) {	/* no REG_NEWLINE; all it spans */
+		q = buf + pm.rm_eo - 1;
+		le = memchr(q, '\n', (size_t)(end - q));
+		if (le == NULL)
+			le = end;
+	}
+	line->rm_so = ls - buf;
+	line->rm_eo = le - buf;
+	return(0);
+}
+
+/*
+ - reglimit - bound the work regexec() puts into back references
+ = extern int reglimit(regex_t *, unsigned long);
+ *
+ * Matching back references is a search, and a bad RE can make that
+ * search very long even with backref()'s memo.  Once a regexec() call
+ * has taken more than steps backref() steps trying for a match at any
+ * one place it gives up, returning REG_ELIMIT.  The count starts over
+ * at each place, so that a long string with many near misses is not
+ * taken for a bad RE.  Zero, the default, means no limit.  Set the
+ * limit before sharing the RE; regexec() only reads it.
+ */
+int				/* 0 success, REG_BADPAT failure */
+reglimit(
+    regex_t *preg,
+    unsigned long steps)
+{
+	struct re_guts *g = preg->re_g;
+
+	assert(preg != NULL);
+
+	if (preg->re_magic != MAGIC1 || g->magic != MAGIC2)
+		return(REG_BADPAT);
+	g->maxsteps = steps;
+	return(0);
+}
+
+/*
+ - regscratch - make a scratch context for regexec_r() and regexec_buf_r()
+ = extern struct re_scratch *regscratch(const regex_t *);
+ *
+ * regexec() allocates its working storage on every call and frees it
+ * again.  A scratch context holds it between calls instead:  the first
+ * few calls through it allocate, later ones do not, and fast()'s DFA
+ * cache carries over from one call to the next.  A context is for one
+ * RE and one thread at a time; threads sharing an RE each want their
+ * own.  Free it with regscratchfree() before the RE is regfree()d.
+ */
+struct re_scratch *		/* NULL if bad RE or no memory */
+regscratch(
+    const regex_t *preg)
+{
+	struct re_guts *g = preg->re_g;
+	struct re_scratch *sc;
+
+	assert(preg != NULL);
+
+	if (preg->re_magic != MAGIC1 || g->magic != MAGIC2)
+		return(NULL);
+	sc = malloc(sizeof(struct re_scratch));
+	if (sc == NULL)
+		return(NULL);
+	sc->g = g;
+	sc->pmatch = NULL;
+	sc->lastpos = NULL;
+	sc->pst = NULL;
+	sc->space = NULL;
+	sc->sdfa = NULL;
+	sc->ldfa = NULL;
+	sc->memo = NULL;
+	(void) memset(&sc->stats, 0, sizeof(sc->stats));
+	return(sc);
+}
+
+/*
+ - regscratchfree - free a scratch context
+ = extern void regscratchfree(struct re_scratch *);
+ */
+void
+regscratchfree(
+    struct re_scratch *sc)
+{
+	if (sc == NULL)
+		return;
+	free(sc->pmatch);
+	free(sc->lastpos);
+	free(sc->pst);
+	free(sc->space);
+	dfafree(sc->sdfa);
+	dfafree(sc->ldfa);
+	bmfree(sc->memo);
+	free(sc);
+}
+
+/*
+ - regstats - what the searches through a scratch context have done
+ = extern int regstats(const struct re_scratch *, struct regstats *);
+ *
+ * The counters start at zero in regscratch() and only ever go up; they
+ * are for finding out why an RE is slow, so they say which matcher ran,
+ * how much of the string each pass of it went over, and how often the
+ * expensive fallbacks were needed.  Searches without a context are not
+ * counted.
+ */
+int				/* 0 success, REG_INVARG failure */
+regstats(
+    const struct re_scratch *sc,
+    struct regstats *st)
+{
+	if (sc == NULL || st == NULL)
+		return(REG_INVARG);
+	*st = sc->stats;
+	return(0);
 }
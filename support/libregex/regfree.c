@@ -37,6 +37,7 @@
  */
 
 #include <assert.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include "regex.h"
@@ -56,6 +57,7 @@ void
 regfree(regex_t *preg)
 {
 	struct re_guts *g;
+	size_t i;
 
 	assert(preg != NULL);
 
@@ -75,7 +77,14 @@ regfree(regex_t *preg)
 		free(g->sets);
 	if (g->setbits != NULL)
 		free(g->setbits);
-	if (g->must != NULL)
-		free(g->must);
+	if (g->musts != NULL) {
+		for (i = 0; i < g->nmusts; i++)
+			free(g->musts[i].s);
+		free(g->musts);
+	}
+	if (g->stab != NULL)
+		free(g->stab);
+	if (g->sfold != NULL)
+		free(g->sfold);
 	free(g);
 }
@@ -0,0 +1,128 @@
+/*-
+ * Copyright (c) 2023 S. V. Nickolas.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * The host C library's regex functions, for rebench to check this library
+ * against.  Both sets have the same names, and the ones linked into rebench
+ * are ours, so the host's are looked up with dlsym(RTLD_NEXT).  This file
+ * must see the host's <regex.h>, not ours, so it is compiled without -I for
+ * this directory; nothing of the host's types gets out of it.
+ */
+
+#define	_GNU_SOURCE		/* RTLD_NEXT */
+#include <sys/types.h>
+#include <dlfcn.h>
+#include <regex.h>
+#include <stdlib.h>
+
+#include "rehost.h"
+
+static int (*h_regcomp)(regex_t *, const char *, int);
+static int (*h_regexec)(const regex_t *, const char *, size_t,
+							regmatch_t *, int);
+static void (*h_regfree)(regex_t *);
+
+/*
+ - hostinit - find the host's regex functions
+ = int hostinit(void);
+ */
+int				/* 0 if they are not there */
+hostinit(void)
+{
+#ifdef RTLD_NEXT
+	h_regcomp = (int (*)(regex_t *, const char *, int))
+					dlsym(RTLD_NEXT, "regcomp");
+	h_regexec = (int (*)(const regex_t *, const char *, size_t,
+				regmatch_t *, int))dlsym(RTLD_NEXT, "regexec");
+	h_regfree = (void (*)(regex_t *))dlsym(RTLD_NEXT, "regfree");
+#endif
+	return(h_regcomp != NULL && h_regexec != NULL && h_regfree != NULL);
+}
+
+/*
+ - hostcomp - compile an RE with the host's regcomp()
+ = void *hostcomp(const char *re, int flags, size_t *nsub);
+ */
+void *				/* NULL if it will not compile */
+hostcomp(
+    const char *re,
+    int flags,			/* HOST_* */
+    size_t *nsub)		/* number of subexpressions goes here */
+{
+	regex_t *h;
+	int f = REG_NEWLINE;
+
+	if (flags&HOST_EXTENDED)
+		f |= REG_EXTENDED;
+	if (flags&HOST_ICASE)
+		f |= REG_ICASE;
+	h = malloc(sizeof(regex_t));
+	if (h == NULL)
+		return(NULL);
+	if ((*h_regcomp)(h, re, f) != 0) {
+		free(h);
+		return(NULL);
+	}
+	*nsub = h->re_nsub;
+	return((void *)h);
+}
+
+/*
+ - hostexec - match a string with the host's regexec()
+ = int hostexec(void *h, const char *s, size_t nmatch, long *off);
+ */
+int				/* 0 success, 1 failure */
+hostexec(
+    void *h,
+    const char *s,		/* NUL-terminated */
+    size_t nmatch,
+    long *off)			/* [2*nmatch] offsets, -1 if unset */
+{
+	regmatch_t pm[HOST_NMATCH];
+	size_t i;
+
+	if (nmatch > HOST_NMATCH)
+		nmatch = HOST_NMATCH;
+	if ((*h_regexec)((regex_t *)h, s, nmatch, pm, 0) != 0)
+		return(1);
+	for (i = 0; i < nmatch; i++) {
+		off[2*i] = (long)pm[i].rm_so;
+		off[2*i + 1] = (long)pm[i].rm_eo;
+	}
+	return(0);
+}
+
+/*
+ - hostfree - free an RE from hostcomp()
+ = void hostfree(void *h);
+ */
+void
+hostfree(
+    void *h)
+{
+	(*h_regfree)((regex_t *)h);
+	free(h);
+}
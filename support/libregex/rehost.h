@@ -0,0 +1,14 @@
+/*
+ * The host C library's regex functions, for rebench; see rehost.c.
+ */
+
+/* hostcomp() flags; REG_NEWLINE is always set */
+#define	HOST_EXTENDED	01
+#define	HOST_ICASE	02
+
+#define	HOST_NMATCH	10	/* most subexpressions hostexec() reports */
+
+int hostinit(void);
+void *hostcomp(const char *re, int flags, size_t *nsub);
+int hostexec(void *h, const char *s, size_t nmatch, long *off);
+void hostfree(void *h);
@@ -0,0 +1,554 @@
+/*-
+ * Copyright (c) 2023 S. V. Nickolas.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * retest - check this regex library against the answers in a file
+ *
+ * usage: retest [-v] [file]
+ *
+ * Each line of the file (or of the standard input) is a test, in the
+ * manner of Henry Spencer's original "tests" file: fields separated by
+ * tabs, being
+ *
+ *	RE	flags	string	answer	[matcher]
+ *
+ * The flags are "-" for none, or some of:
+ *	b	a basic RE (REG_BASIC); otherwise it is extended
+ *	i	REG_ICASE
+ *	n	REG_NEWLINE
+ *	u	REG_UTF8
+ *	^	REG_NOTBOL
+ *	$	REG_NOTEOL
+ *	B	search with regexec_buf(); the answer is then the line
+ *
+ * In the string, \n is a newline, \t a tab, \xHH that byte and \\ a
+ * backslash; X\{N} is N X's in all; and "" is the empty string.  The
+ * answer is "-" for no match, !REG_XXX for regcomp() failing with that
+ * error, or the offsets of the match and then of each subexpression as
+ * so,eo pairs separated by spaces (-1,-1 for one that took no part).
+ * The matcher, if given, is simple, small or large: the one regstats()
+ * must say ran (an RE of more than 64 states or so gets the large state
+ * sets; a branch like |z{70} that never matches will see to it).  Empty
+ * lines and lines starting with # are ignored.
+ *
+ * Each test is run with regexec() and then twice with one scratch
+ * context, so that what the context keeps from a search (the DFA cache)
+ * is used by the next; all three must get the answer.  Failures are
+ * shown, and with -v every test is.  The exit status is 1 if any test
+ * failed, 2 for trouble.
+ *
+ * Build it with this directory's sources, or the library build5.sh
+ * builds.  E.g.
+ *
+ *	cc -D__SVR4__ -o retest retest.c regcomp.c regerror.c regexec.c \
+ *		regfree.c
+ *	./retest tests
+ */
+
+#include <sys/types.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "regex.h"
+
+#define	NSUB	10		/* most subexpressions an answer can give */
+
+/* what a test expects */
+struct answer {
+	int error;		/* 0, REG_NOMATCH, or regcomp()'s error */
+	size_t nm;		/* so,eo pairs in pm */
+	regmatch_t pm[NSUB];
+	const char *matcher;	/* "simple", "small", "large" or NULL */
+};
+
+static int vflag;		/* show every test */
+static long lineno;		/* of the test file */
+
+/* ========= begin header generated by mkh ========= */
+static char *field(char **sp);
+static int cflagsof(const char *f);
+static int eflagsof(const char *f);
+static char *unescape(const char *s, size_t *lenp);
+static int answerof(const char *s, const char *m, struct answer *a);
+static const char *ran(const struct regstats *st);
+static int search(const regex_t *re, const char *s, size_t len, int eflags, int buf, size_t nm, regmatch_t *pm, struct re_scratch *sc);
+static int same(const struct answer *a, int r, const regmatch_t *pm);
+static void show(const char *what, int r, size_t nm, const regmatch_t *pm);
+static int runtest(char *line);
+static void usage(void);
+/* ========= end header generated by mkh ========= */
+
+/*
+ - field - split off the next tab-separated field
+ == static char *field(char **sp);
+ */
+static char *			/* NULL if there are no more */
+field(
+    char **sp)
+{
+	char *s = *sp;
+	char *f;
+
+	while (*s == '\t')
+		s++;
+	if (*s == '\0')
+		return(NULL);
+	f = s;
+	while (*s != '\t' && *s != '\0')
+		s++;
+	if (*s == '\t')
+		*s++ = '\0';
+	*sp = s;
+	return(f);
+}
+
+/*
+ - cflagsof - regcomp() flags from a flags field
+ == static int cflagsof(const char *f);
+ */
+static int
+cflagsof(
+    const char *f)
+{
+	int cflags = REG_EXTENDED;
+
+	for (; *f != '\0'; f++)
+		switch (*f) {
+		case 'b':
+			cflags &= ~REG_EXTENDED;
+			break;
+		case 'i':
+			cflags |= REG_ICASE;
+			break;
+		case 'n':
+			cflags |= REG_NEWLINE;
+			break;
+		case 'u':
+			cflags |= REG_UTF8;
+			break;
+		}
+	return(cflags);
+}
+
+/*
+ - eflagsof - regexec() flags from a flags field
+ == static int eflagsof(const char *f);
+ */
+static int
+eflagsof(
+    const char *f)
+{
+	int eflags = 0;
+
+	for (; *f != '\0'; f++)
+		switch (*f) {
+		case '^':
+			eflags |= REG_NOTBOL;
+			break;
+		case '$':
+			eflags |= REG_NOTEOL;
+			break;
+		}
+	return(eflags);
+}
+
+/*
+ - unescape - make a test's string from its field
+ == static char *unescape(const char *s, size_t *lenp);
+ */
+static char *			/* malloc()ed, NUL-terminated; NULL if bad */
+unescape(
+    const char *s,
+    size_t *lenp)		/* the length goes here */
+{
+	char *b;
+	char *e;
+	size_t len = 0;
+	size_t size = 64;
+	unsigned long n;
+	char c = '\0';
+
+	b = malloc(size);
+	if (b == NULL) {
+		fprintf(stderr, "retest: out of memory\n");
+		exit(2);
+	}
+	if (strcmp(s, "\"\"") == 0)
+		s = "";
+	while (*s != '\0') {
+		if (s[0] == '\\' && s[1] == '{' && len > 0) {
+			n = strtoul(s + 2, &e, 10);
+			if (*e != '}' || n == 0)
+				goto bad;
+			s = e + 1;
+			n--;		/* one is there already */
+		} else {
+			if (s[0] != '\\')
+				c = *s++;
+			else if (s[1] == 'n' || s[1] == 't' || s[1] == '\\') {
+				c = (s[1] == 'n') ? '\n' :
+						(s[1] == 't') ? '\t' : '\\';
+				s += 2;
+			} else if (s[1] == 'x') {
+				c = (char)strtoul(s + 2, &e, 16);
+				if (e != s + 4)
+					goto bad;
+				s = e;
+			} else
+				goto bad;
+			n = 1;
+		}
+		while (len + n + 1 > size) {
+			size *= 2;
+			b = realloc(b, size);
+			if (b == NULL) {
+				fprintf(stderr, "retest: out of memory\n");
+				exit(2);
+			}
+		}
+		for (; n > 0; n--)
+			b[len++] = c;
+	}
+	b[len] = '\0';
+	*lenp = len;
+	return(b);
+
+bad:
+	free(b);
+	return(NULL);
+}
+
+/*
+ - answerof - make a test's answer from its fields
+ == static int answerof(const char *s, const char *m, struct answer *a);
+ */
+static int			/* 0 if it does not make sense */
+answerof(
+    const char *s,
+    const char *m,		/* the matcher field, or NULL */
+    struct answer *a)
+{
+	char num[16];
+	regex_t named;
+	char *e;
+	long so;
+	long eo;
+
+	a->error = 0;
+	a->nm = 0;
+	a->matcher = m;
+	if (m != NULL && strcmp(m, "simple") != 0 && strcmp(m, "small") != 0 &&
+						strcmp(m, "large") != 0)
+		return(0);
+	if (strcmp(s, "-") == 0) {
+		a->error = REG_NOMATCH;
+		return(1);
+	}
+	if (*s == '!') {		/* regerror() looks the name up */
+		named.re_endp = s + 1;
+		(void) regerror(REG_ATOI, &named, num, sizeof(num));
+		a->error = atoi(num);
+		return(a->error > REG_NOMATCH);
+	}
+	while (*s != '\0') {
+		if (a->nm == NSUB)
+			return(0);
+		so = strtol(s, &e, 10);
+		if (*e != ',')
+			return(0);
+		eo = strtol(e + 1, &e, 10);
+		if (*e != ' ' && *e != '\0')
+			return(0);
+		a->pm[a->nm].rm_so = (regoff_t)so;
+		a->pm[a->nm].rm_eo = (regoff_t)eo;
+		a->nm++;
+		for (s = e; *s == ' '; s++)
+			continue;
+	}
+	return(a->nm > 0);
+}
+
+/*
+ - ran - which matcher the counters say ran
+ == static const char *ran(const struct regstats *st);
+ */
+static const char *
+ran(
+    const struct regstats *st)
+{
+	if (st->large != 0)
+		return("large");
+	if (st->small != 0)
+		return("small");
+	if (st->simple != 0)
+		return("simple");
+	return("none");
+}
+
+/*
+ - search - run one search the way a test says
+ == static int search(const regex_t *re, const char *s, size_t len, \
+ ==	int eflags, int buf, size_t nm, regmatch_t *pm, \
+ ==	struct re_scratch *sc);
+ */
+static int			/* what regexec() or regexec_buf() said */
+search(
+    const regex_t *re,
+    const char *s,
+    size_t len,
+    int eflags,
+    int buf,			/* use regexec_buf() */
+    size_t nm,
+    regmatch_t *pm,
+    struct re_scratch *sc)
+{
+	size_t k;
+
+	for (k = 0; k < NSUB; k++)
+		pm[k].rm_so = pm[k].rm_eo = -2;	/* to catch them unset */
+	if (buf)
+		return(regexec_buf_r(re, s, len, pm, eflags, sc));
+	pm[0].rm_so = 0;
+	pm[0].rm_eo = (regoff_t)len;
+	return(regexec_r(re, s, (nm > 0) ? nm : 1, pm, eflags|REG_STARTEND,
+									sc));
+}
+
+/*
+ - same - does what a search got agree with the answer?
+ == static int same(const struct answer *a, int r, const regmatch_t *pm);
+ */
+static int
+same(
+    const struct answer *a,
+    int r,
+    const regmatch_t *pm)
+{
+	size_t k;
+
+	if (r != a->error)
+		return(0);
+	for (k = 0; r == 0 && k < a->nm; k++)
+		if (pm[k].rm_so != a->pm[k].rm_so ||
+					pm[k].rm_eo != a->pm[k].rm_eo)
+			return(0);
+	return(1);
+}
+
+/*
+ - show - show an answer, expected or got
+ == static void show(const char *what, int r, size_t nm, \
+ ==	const regmatch_t *pm);
+ */
+static void
+show(
+    const char *what,
+    int r,
+    size_t nm,
+    const regmatch_t *pm)
+{
+	char name[64];
+	size_t k;
+
+	printf("  %s", what);
+	if (r == REG_NOMATCH)
+		printf(" no match");
+	else if (r != 0) {
+		(void) regerror(r|REG_ITOA, (regex_t *)NULL, name,
+							sizeof(name));
+		printf(" %s", name);
+	}
+	for (k = 0; r == 0 && k < nm; k++)
+		printf(" %ld,%ld", (long)pm[k].rm_so, (long)pm[k].rm_eo);
+	printf("\n");
+}
+
+/*
+ - runtest - run the test on one line of the file
+ == static int runtest(char *line);
+ */
+static int			/* 0 passed or not a test, 1 failed */
+runtest(
+    char *line)
+{
+	char *fre;
+	char *fflags;
+	char *fstr;
+	char *fans;
+	char *fm;
+	char *s;
+	char *str;
+	size_t len;
+	struct answer a;
+	regex_t re;
+	regmatch_t pm[NSUB];
+	struct re_scratch *sc;
+	struct regstats st;
+	const char *how;
+	int buf;
+	int eflags;
+	int r;
+	int i;
+	int bad = 0;
+
+	s = line;
+	if (*s == '#' || *s == '\0')
+		return(0);
+	fre = field(&s);
+	fflags = field(&s);
+	fstr = field(&s);
+	fans = field(&s);
+	fm = field(&s);
+	if (fans == NULL || field(&s) != NULL) {
+		printf("line %ld: should have 4 or 5 fields\n", lineno);
+		return(1);
+	}
+	if (strcmp(fflags, "-") == 0)
+		fflags = "";
+	if (!answerof(fans, fm, &a)) {
+		printf("line %ld: bad answer \"%s\"\n", lineno, fans);
+		return(1);
+	}
+	str = unescape(fstr, &len);
+	if (str == NULL) {
+		printf("line %ld: bad string \"%s\"\n", lineno, fstr);
+		return(1);
+	}
+	buf = (strchr(fflags, 'B') != NULL);
+	eflags = eflagsof(fflags);
+	if (vflag)
+		printf("line %ld: /%s/ %s\n", lineno, fre, fflags);
+
+	r = regcomp(&re, fre, cflagsof(fflags));
+	if (r != 0 || a.error > REG_NOMATCH) {
+		if (r != a.error) {
+			printf("line %ld: /%s/ %s: regcomp()\n", lineno, fre,
+									fflags);
+			show("wanted", a.error, a.nm, a.pm);
+			show("got", r, 0, pm);
+			bad = 1;
+		}
+		if (r == 0)
+			regfree(&re);
+		free(str);
+		return(bad);
+	}
+	sc = regscratch(&re);
+	if (sc == NULL) {
+		fprintf(stderr, "retest: out of memory\n");
+		exit(2);
+	}
+
+	for (i = 0; i < 3 && !bad; i++) {
+		how = (i == 0) ? "regexec()" : (i == 1) ? "with a context" :
+							"with the context again";
+		r = search(&re, str, len, eflags, buf, a.nm, pm,
+						(i == 0) ? NULL : sc);
+		if (!same(&a, r, pm)) {
+			printf("line %ld: /%s/ %s: %s\n", lineno, fre, fflags,
+									how);
+			show("wanted", a.error, a.nm, a.pm);
+			show("got", r, a.nm, pm);
+			bad = 1;
+		}
+		if (i == 1 && a.matcher != NULL && !bad) {
+			(void) regstats(sc, &st);
+			if (strcmp(a.matcher, ran(&st)) != 0) {
+				printf("line %ld: /%s/ %s: %s ran, not %s\n",
+						lineno, fre, fflags, ran(&st),
+						a.matcher);
+				bad = 1;
+			}
+		}
+	}
+
+	regscratchfree(sc);
+	regfree(&re);
+	free(str);
+	return(bad);
+}
+
+/*
+ - usage - complain
+ == static void usage(void);
+ */
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: retest [-v] [file]\n");
+	exit(2);
+}
+
+int
+main(
+    int argc,
+    char *argv[])
+{
+	static char line[8192];
+	FILE *f = stdin;
+	long ntests = 0;
+	long nfailed = 0;
+	size_t n;
+	int c;
+
+	while ((c = getopt(argc, argv, "v")) != -1)
+		switch (c) {
+		case 'v':
+			vflag = 1;
+			break;
+		default:
+			usage();
+		}
+	if (argc - optind > 1)
+		usage();
+	if (optind < argc) {
+		f = fopen(argv[optind], "r");
+		if (f == NULL) {
+			perror(argv[optind]);
+			exit(2);
+		}
+	}
+
+	while (fgets(line, sizeof(line), f) != NULL) {
+		lineno++;
+		n = strlen(line);
+		if (n > 0 && line[n-1] == '\n')
+			line[--n] = '\0';
+		else if (!feof(f)) {
+			printf("line %ld: too long\n", lineno);
+			exit(2);
+		}
+		if (line[0] == '#' || line[0] == '\0')
+			continue;
+		ntests++;
+		nfailed += runtest(line);
+	}
+	printf("%ld tests, %ld failed\n", ntests, nfailed);
+	exit((nfailed != 0) ? 1 : 0);
+}
@@ -0,0 +1,331 @@
+#!/bin/sh
+#
+# Regression tests for grep.
+#
+# usage: sh tests/grep.sh [path/to/grep]
+#
+# Each case names grep's arguments and says what it should print and the
+# exit status it should give.  Input comes from the file "in" in a scratch
+# directory, which is also the working directory, so that file and
+# directory operands can be made there too (or, with pcheck, from "in"
+# through a pipe).  Failures are shown; the exit status is 1 if there were
+# any.
+#
+
+GREP=${1:-grep}
+case "$GREP" in
+ /*) ;;
+ *) GREP=`pwd`/$GREP ;;
+esac
+
+tmp=${TMPDIR:-/tmp}/greptest.$$
+mkdir "$tmp" || exit 2
+trap 'rm -rf "$tmp"' 0
+trap 'exit 2' 1 2 15
+cd "$tmp" || exit 2
+
+fails=0
+cases=0
+
+# check name expected-output expected-status grep-arguments...
+check ()
+{
+ name=$1
+ want=$2
+ wstat=$3
+ shift 3
+ cases=`expr $cases + 1`
+ if [ "$pipe" ]
+ then
+  got=`cat in | "$GREP" "$@" 2>err`
+ else
+  got=`"$GREP" "$@" < in 2>err`
+ fi
+ stat=$?
+ if [ "$got" != "$want" ] || [ "$stat" != "$wstat" ]
+ then
+  echo "FAIL: $name: grep $*"
+  echo "  wanted status $wstat:"
+  echo "$want" | sed 's/^/    /'
+  echo "  got status $stat:"
+  echo "$got" | sed 's/^/    /'
+  sed 's/^/    stderr: /' err
+  fails=`expr $fails + 1`
+ fi
+}
+
+# jcheck name grep-arguments...: check that -j 4 gives what a search
+# without it does, output and exit status both.
+jcheck ()
+{
+ jname=$1
+ shift
+ jwant=`"$GREP" "$@" < in 2>/dev/null`
+ check "$jname" "$jwant" $? -j 4 "$@"
+}
+
+# pcheck: the same, with the input through a pipe.
+pcheck ()
+{
+ pipe=1
+ check "$@"
+ pipe=
+}
+
+nl='
+'
+
+# A bracket expression can match a newline, but a match is within a line.
+printf 'ab\n\ncd\nb\nx y\n' > in
+check "space class, plain" "" 1 'b[[:space:]]'
+check "space class, -c" "1" 0 -c '[[:space:]]'
+check "space class, -v" "ab${nl}${nl}cd${nl}b" 0 -v '[[:space:]]'
+check "space class, -E" "x y" 0 -E '[[:space:]]y$'
+check "negated class, -x" "b" 0 -x 'b[^a]*'
+check "negated class" "" 1 -E 'b[^y]'
+
+# A BRE gives the same answers joined to others as it does alone.
+check "literal \$ repeated" "5" 0 -c '$*'
+check "literal \$ repeated, joined" "5" 0 -c -e '$*' -e zzz
+check "literal \$ repeated, then x, joined" "x y" 0 -e '$*x' -e zzz
+check "literal * repeated" "5" 0 -c '**'
+check "literal * repeated, joined" "5" 0 -c -e '**' -e zzz
+check "literal * repeated, then b, joined" "ab${nl}b" 0 -e '**b' -e zzz
+
+# -r says "no match" when every file is left out.
+mkdir d
+echo needle > d/a.c
+check "-r" "d/a.c:needle" 0 -r needle d
+check "-r, all included" "d/a.c:needle" 0 -r --include='*.c' needle d
+check "-r, none included" "" 1 -r --include='*.zzz' needle d
+
+# Files are scanned a block at a time (or mapped, if big enough), not a
+# line at a time: line numbers and block numbers must come out the same
+# across block edges, whether the file is mapped or read from a pipe, and
+# a last line need not end in a newline.
+awk 'BEGIN { for (i=1; i<=30000; i++) printf "line %d of the file\n", i }' > in
+check "blocks, -c" "30000" 0 -c 'file$'
+check "blocks, -n -b" "511:11880:line 11880 of the file${nl}512:11881:line 11881 of the file" \
+ 0 -n -b 'line 1188[01] of'
+pcheck "blocks, -n -b, pipe" "511:11880:line 11880 of the file${nl}512:11881:line 11881 of the file" \
+ 0 -n -b 'line 1188[01] of'
+pcheck "blocks, last line, pipe" "30000:line 30000 of the file" 0 -n 'line 30000'
+check "blocks, -v -c" "29999" 0 -v -c 'line 11881 of'
+printf 'a\nb' > in
+check "no newline at the end" "2:b" 0 -n b
+pcheck "no newline at the end, pipe" "2:b" 0 -n b
+check "no newline at the end, -x" "b" 0 -x b
+: > in
+check "empty file" "0" 1 -c x
+
+# -F with more than one pattern: all of them at once, one found inside
+# another, one found where a longer one starting earlier gave out, and
+# hundreds from a file.
+printf 'ushers\nhis\nxhex\nabce\nabcd\nBCD\nnothing\n' > in
+printf 'he\nshe\nhis\nhers\n' > pats
+check "-F, many" "ushers${nl}his${nl}xhex" 0 -F -f pats
+check "-F, many, -v -c" "4" 0 -F -v -c -f pats
+check "-F, one in another" "abce${nl}abcd" 0 -F -e abcd -e bc
+check "-F, one in another, -i" "abcd${nl}BCD" 0 -F -i -e bcd -e zz
+check "-F, empty pattern" "7" 0 -F -c -e '' -e zz
+printf 'xaaay\na\n' > in
+check "-F, overlapping" "1:xaaay" 0 -F -n -e aaa -e aa -e aaaa
+awk 'BEGIN { for (i=0; i<500; i++) printf "w%dq\n", i*7 }' > pats
+awk 'BEGIN { for (i=0; i<2000; i++) printf "x w%dq y\n", i }' > in
+check "-F, 500 patterns" "286" 0 -c -F -f pats
+check "-F, 501 patterns" "287" 0 -c -F -f pats -e w1999q
+check "-F, 500 patterns, -x" "0" 1 -c -x -F -f pats
+
+# -F with one pattern is looked for many bytes at a time, by its first and
+# last bytes: the pattern at every place in a line, lines where only the
+# first and last bytes agree, a pattern longer than a vector, and a match
+# in the bytes left over at the end of the input.
+awk 'BEGIN { d="......................................................................";
+             for (i=0; i<=70; i++) print substr(d, 1, i) "needle" substr(d, i+1);
+             for (i=0; i<=70; i++) print substr(d, 1, i) "nobble" substr(d, i+1);
+             print "NeEdLe"; print "-x-Y-" }' > in
+check "-F, every place" "71" 0 -F -c needle
+check "-F, every place, -i" "72" 0 -F -c -i needle
+check "-F, first and last bytes only" "0" 1 -F -c needdle
+check "-F, -i, not letters" "144:-x-Y-" 0 -F -n -i -- -X-y
+long=0123456789abcdefghijklmnopqrstuvwxyzABCD
+printf "x${long}y\n${long}\nx${long}\n" > in
+check "-F, long" "3" 0 -F -c $long
+check "-F, long, -i" "2:${long}" 0 -F -n -x -i $long
+printf 'a\nb\nthe tail end' > in
+check "-F, at the very end" "3:the tail end" 0 -F -n 'tail end'
+check "-F, one byte at the very end" "3:the tail end" 0 -F -n d
+
+# -F -x looks whole lines up in a hash set of the patterns: not lines that
+# only start or end like one, but the empty line for an empty pattern, and
+# with -i, lines that differ only in case.
+printf 'apple\napple pie\n\nApple\npie\nappl\nbanana' > in
+printf 'apple\npie\napple\nbanana\n' > pats
+check "-F -x" "1:apple${nl}5:pie${nl}7:banana" 0 -n -F -x -f pats
+check "-F -x, -i" "1:apple${nl}4:Apple${nl}5:pie${nl}7:banana" 0 -n -F -x -i -f pats
+check "-F -x, -v" "4" 0 -c -F -x -v -f pats
+check "-F -x, empty pattern" "3:${nl}5:pie" 0 -n -F -x -e '' -e pie
+awk 'BEGIN { for (i=0; i<4000; i+=2) print i }' > pats
+awk 'BEGIN { for (i=0; i<4000; i++) print i; print "01"; print "2 " }' > in
+check "-F -x, 2000 patterns" "2000" 0 -c -F -x -f pats
+
+# -j searches files in worker threads, but the output and exit status are
+# what they would be without it, file by file in the order given or found.
+mkdir j j/sub
+i=0
+while [ $i -lt 40 ]
+do
+ awk "BEGIN { for (k=0; k<$i*50; k++) print \"filler\", k;
+              if ($i%3==0) print \"hit $i\" }" > j/f$i
+ [ $i -lt 10 ] && cp j/f$i j/sub/g$i
+ i=`expr $i + 1`
+done
+echo hit > in
+jcheck "-j -r" -r hit j
+jcheck "-j -r -n" -r -n hit j
+jcheck "-j -r -c" -r -c hit j
+jcheck "-j -r -l" -r -l hit j
+jcheck "-j -r -v -l" -r -v -l filler j
+jcheck "-j, files" -n hit j/f3 j/f4 j/f6 - j/sub/g9
+jcheck "-j, all match" -h hit j/f0 j/f3 j/f6
+check "-j, all match, status" "hit 0${nl}hit 3" 0 -j 4 -h hit j/f0 j/f3
+check "-j, a missing file" "j/f3:hit 3" 2 -j 4 -s hit j/f3 j/nonesuch j/f4
+check "-j -q" "" 0 -j 4 -q hit j/nonesuch j/f1 j/f3
+check "-j -r, no match" "" 1 -j 4 -r zzz j
+
+# A file bigger than a chunk (8M by default) is searched in pieces under
+# -j, but the line numbers, block numbers and counts must come out as for
+# one piece.
+awk 'BEGIN { for (i=1; i<=450000; i++) printf "line %d of the file\n", i }' > in
+check "chunks, -c" "45000" 0 -j 4 -c '7 of'
+jcheck "chunks, -n" -n '7 of'
+jcheck "chunks, -b" -b 'line 35415[0-9] of'
+jcheck "chunks, -n -b, file" -n -b 'line 35415[0-9] of' in
+jcheck "chunks, -v -c" -v -c 5
+jcheck "chunks, -m" -n -m 3 '9 of'
+jcheck "chunks, -l" -l 'line 449999 of' in
+: > in
+
+# A NUL in the first block makes a file binary: a match is only reported,
+# -a searches it as text all the same, and -I passes it over as having no
+# match.  Counts and -l are as for text.
+printf 'text\000more\nneedle here\n' > in
+mkdir b
+cp in b/bin
+echo 'needle text' > b/txt
+check "binary" "Binary file (standard input) matches" 0 needle
+check "binary, files" "Binary file b/bin matches${nl}b/txt:needle text" 0 \
+ needle b/bin b/txt
+check "binary, -a" "2:needle here" 0 -a -n needle
+check "binary, -I" "" 1 -I needle
+check "binary, -I, files" "b/txt:needle text" 0 -I needle b/bin b/txt
+check "binary, -I -r" "b/txt:needle text" 1 -I -r needle b
+check "binary, -I -l" "b/txt" 0 -I -l needle b/bin b/txt
+check "binary, -c" "1" 0 -c needle
+check "binary, -v -c" "1" 0 -v -c needle
+check "binary, -l" "b/bin" 0 -l needle b/bin
+check "binary, no match" "" 1 nothing
+
+# -m stops selecting lines in a file after the number given, and so caps
+# -c; with -v it is the lines that do not match that are counted off.  -q
+# settles the exit status at the first line selected anywhere.
+printf 'a1\nb\na2\nc\na3\nd\n' > in
+echo a > m2
+check "-m" "1:a1${nl}3:a2" 0 -n -m 2 a
+check "-m, --max-count" "a1" 0 --max-count=1 a
+check "-m, -c" "2" 0 -m 2 -c a
+check "-m, -c, fewer" "3" 0 -m 5 -c a
+check "-m, -v" "b${nl}c" 0 -m 2 -v a
+check "-m, -v -c" "2" 0 -m 2 -v -c a
+check "-m, files" "in:1:a1${nl}in:3:a2${nl}m2:1:a" 0 -m 2 -n a in m2
+check "-m, -l" "in${nl}m2" 0 -m 1 -l a in m2
+check "-m 0" "" 1 -m 0 a
+check "-q, a missing file" "" 0 -q a nonesuch in
+check "-q, no match" "" 1 -q zzz in m2
+check "-q -v" "" 0 -q -v a
+
+# -z reads gzip files as they would read uncompressed (several members one
+# after another too), and other files as they are.  A gzip file that is
+# cut short or corrupt is an error.  (Only where grep has zlib, and there
+# is a gzip to make the files with.)
+"$GREP" -z x < /dev/null 2>/dev/null
+if [ $? != 2 ] && gzip -c < /dev/null > /dev/null 2>&1
+then
+ printf 'one\ntwo needle\nthree\n' > in
+ mkdir z z/r
+ cp in z/plain
+ gzip -c in > z/one.gz
+ cp z/one.gz z/r/one.gz
+ cat z/one.gz z/one.gz > z/two.gz
+ head -c 20 z/one.gz > z/short.gz
+ printf '\037\213\010\000garbage, not deflate' > z/bad.gz
+ check "-z" "2:two needle" 0 -z -n needle z/one.gz
+ check "-z, not compressed" "z/plain:two needle${nl}z/one.gz:two needle" 0 \
+  -z needle z/plain z/one.gz
+ check "-z, -c" "3" 0 -z -c e z/one.gz
+ check "-z, two members" "2:two needle${nl}5:two needle" 0 \
+  -z -n needle z/two.gz
+ check "-z -r -c" "z/r/one.gz:1" 0 -z -r -c needle z/r
+ cp z/one.gz in
+ check "-z, stdin" "two needle" 0 -z needle
+ pcheck "-z, stdin, pipe" "two needle" 0 -z needle
+ check "-z, cut short" "" 2 -z -s needle z/short.gz
+ check "-z, corrupt" "" 2 -z -s needle z/bad.gz
+ check "-z, corrupt, then good" "z/one.gz:two needle" 2 -z -s needle z/bad.gz z/one.gz
+ check "without -z" "" 1 needle z/one.gz
+fi
+
+# --index passes over files that cannot match, but not files changed since,
+# even where the size is the same and the mtime is put back.  (A file
+# changed in the second the index is made in is always searched, hence the
+# sleep.)
+mkdir t
+echo 'alpha beta' > t/a
+echo 'gamma delta' > t/b
+echo 'alpha gamma' > t/c
+sleep 1
+check "--make-index" "" 0 --make-index=idx t
+check "-r, --index" "`"$GREP" -r alpha t`" 1 -r --index=idx alpha t
+check "-r -c, --index" "`"$GREP" -r -c alpha t`" 1 -r -c --index=idx alpha t
+check "-r, --index, no match" "" 1 -r --index=idx zeta t
+echo 'alpha delta' > t/b
+check "-r, --index, changed" "`"$GREP" -r alpha t`" 0 -r --index=idx alpha t
+echo 'gamma delta' > t/b
+"$GREP" --make-index=idx t
+echo 'delta alpha' > t/b.new
+touch -r t/b t/b.new
+mv t/b.new t/b
+check "-r, --index, mtime put back" "`"$GREP" -r alpha t`" 0 \
+ -r --index=idx alpha t
+head -c 100 idx > idx.short
+check "--index, truncated" "" 2 -r --index=idx.short alpha t
+echo junk > idx.junk
+check "--index, not an index" "" 2 -r --index=idx.junk alpha t
+cat idx > idx.bad
+printf 'XXXX' | dd of=idx.bad bs=1 seek=16 conv=notrunc 2>/dev/null
+check "--index, bad header" "" 2 -r --index=idx.bad alpha t
+
+# Back references, with the bundled regex library (which --debug-regex
+# reports on); the host's may take too long over these.
+echo x > in
+if "$GREP" --debug-regex x in 2>&1 >/dev/null | grep 'regex 1:' >/dev/null
+then
+ awk 'BEGIN { for (i=0; i<700; i++) printf "a"; printf "b";
+              for (i=0; i<701; i++) printf "a"; print "x"; print "ok" }' > in
+ check "backref memo" "0" 1 -c '\(a*\)*b\1x'
+ check "backref step limit" "" 2 --regex-steps=1000000 \
+  '\(a*\)*\(a*\)*b\1\2x'
+
+ # -q stops at the first line, but still reports.
+ echo x > in
+ check "-q, --debug-regex" "" 0 -q --debug-regex x
+ if grep 'regex 1:' err >/dev/null
+ then
+  :
+ else
+  echo "FAIL: -q, --debug-regex: no statistics"
+  fails=`expr $fails + 1`
+ fi
+fi
+echo "$cases cases, $fails failed"
+[ $fails = 0 ]